@@ -0,0 +1,111 @@
+// this example makes a lot of assumptions: Apple II 16-sector floppy which is
+// already inserted, and only reading is supported. The disk appears as a 140K
+// disk image, in DOS 3.3 order (like a .dsk file) unless changed below.
+
+#include "Adafruit_TinyUSB.h"
+#include <Adafruit_Floppy.h>
+
+#if defined(ADAFRUIT_FEATHER_M4_EXPRESS)
+#define APPLE2_ENABLE_PIN (6)
+#define APPLE2_PHASE1_PIN (A2)
+#define APPLE2_PHASE2_PIN (13)
+#define APPLE2_PHASE3_PIN (12)
+#define APPLE2_PHASE4_PIN (11)
+#define APPLE2_RDDATA_PIN (5)
+#define APPLE2_INDEX_PIN  (A3)
+#define APPLE2_PROTECT_PIN (21) // "SDA"
+#elif defined(ARDUINO_ADAFRUIT_FEATHER_RP2040) || defined(ARDUINO_ADAFRUIT_FEATHER_RP2350_HSTX)
+#define APPLE2_ENABLE_PIN (8)  // D6
+#define APPLE2_PHASE1_PIN (A2)
+#define APPLE2_PHASE2_PIN (13)
+#define APPLE2_PHASE3_PIN (12)
+#define APPLE2_PHASE4_PIN (11)
+#define APPLE2_RDDATA_PIN (7)  // D5
+#define APPLE2_INDEX_PIN  (A3)
+#define APPLE2_PROTECT_PIN (2) // "SDA"
+#elif defined(ARDUINO_ADAFRUIT_FLOPPSY_RP2040)
+// Yay built in pin definitions!
+#else
+#error "Please set up pin definitions!"
+#endif
+
+#ifndef USE_TINYUSB
+#error "Please set Adafruit TinyUSB under Tools > USB Stack"
+#endif
+
+Adafruit_USBD_MSC usb_msc;
+
+Adafruit_Apple2Floppy floppy(APPLE2_INDEX_PIN, APPLE2_ENABLE_PIN,
+                             APPLE2_PHASE1_PIN, APPLE2_PHASE2_PIN, APPLE2_PHASE3_PIN, APPLE2_PHASE4_PIN,
+                             -1, -1, APPLE2_PROTECT_PIN, APPLE2_RDDATA_PIN);
+
+// You can select APPLE2_DOS_ORDER or APPLE2_PRODOS_ORDER (like a .po file)
+auto SECTOR_ORDER = APPLE2_DOS_ORDER;
+Adafruit_GCR_Floppy gcr_floppy(&floppy, SECTOR_ORDER);
+
+constexpr size_t SECTOR_SIZE = 512UL;
+
+void setup() {
+  Serial.begin(115200);
+
+#if defined(ARDUINO_ARCH_MBED) && defined(ARDUINO_ARCH_RP2040)
+  // Manual begin() is required on core without built-in support for TinyUSB
+  // such as
+  // - mbed rp2040
+  TinyUSB_Device_Init(0);
+#endif
+
+  // Set disk vendor id, product id and revision with string up to 8, 16, 4
+  // characters respectively
+  usb_msc.setID("Adafruit", "Apple II Floppy", "1.0");
+
+  // Set disk size
+  usb_msc.setCapacity(0, SECTOR_SIZE);
+  // Set callbacks
+  usb_msc.setReadyCallback(0, msc_ready_callback);
+  usb_msc.setWritableCallback(0, msc_writable_callback);
+  usb_msc.setReadWriteCallback(msc_read_callback, msc_write_callback,
+                               msc_flush_callback);
+
+  // floppy.debug_serial = &Serial;
+  // Set Lun ready
+  usb_msc.setUnitReady(false);
+  usb_msc.begin();
+
+  Serial.println("serial Ready!");
+
+  if (!gcr_floppy.begin()) {
+    Serial.println("Failed to read the disk");
+  }
+}
+
+void loop() {}
+
+// Callback invoked when received READ10 command.
+// Copy disk's data to buffer (up to bufsize) and
+// return number of copied bytes (must be multiple of block size)
+int32_t msc_read_callback(uint32_t lba, void *buffer, uint32_t bufsize) {
+  auto result = gcr_floppy.readSectors(lba, reinterpret_cast<uint8_t *>(buffer),
+                                       bufsize / SECTOR_SIZE);
+  return result ? bufsize : -1;
+}
+
+// Callback invoked when received WRITE10 command. Writing is not supported.
+int32_t msc_write_callback(uint32_t lba, uint8_t *buffer, uint32_t bufsize) {
+  (void)lba;
+  (void)buffer;
+  (void)bufsize;
+  return -1;
+}
+
+// Callback invoked when WRITE10 command is completed (status received and
+// accepted by host). used to flush any pending cache.
+void msc_flush_callback(void) {}
+
+bool msc_ready_callback(void) {
+  auto sectors = gcr_floppy.sectorCount();
+  usb_msc.setCapacity(sectors, SECTOR_SIZE);
+  return sectors != 0;
+}
+
+bool msc_writable_callback(void) { return false; }
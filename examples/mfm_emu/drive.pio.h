@@ -107,3 +107,51 @@ static inline void index_pulse_program_init(PIO pio, uint sm, uint offset, uint
 
 #endif
 
+
+// ------ //
+// fluxin //
+// ------ //
+
+#define fluxin_wrap_target 0
+#define fluxin_wrap 6
+#define fluxin_pio_version 0
+
+static const uint16_t fluxin_program_instructions[] = {
+            //     .wrap_target
+    0x0041, //  0: jmp    x--, 1                     
+    0x00c3, //  1: jmp    pin, 3                     
+    0x0000, //  2: jmp    0                          
+    0x0044, //  3: jmp    x--, 4                     
+    0x01c3, //  4: jmp    pin, 3                 [1] 
+    0x4030, //  5: in     x, 16                      
+    0x0040, //  6: jmp    x--, 0                     
+            //     .wrap
+};
+
+#if !PICO_NO_HARDWARE
+static const struct pio_program fluxin_program = {
+    .instructions = fluxin_program_instructions,
+    .length = 7,
+    .origin = -1,
+    .pio_version = 0,
+#if PICO_PIO_VERSION > 0
+    .used_gpio_ranges = 0x0
+#endif
+};
+
+static inline pio_sm_config fluxin_program_get_default_config(uint offset) {
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset + fluxin_wrap_target, offset + fluxin_wrap);
+    return c;
+}
+
+static inline void fluxin_program_init(PIO pio, uint sm, uint offset, uint pin) {
+    pio_sm_config c = fluxin_program_get_default_config(offset);
+    sm_config_set_jmp_pin(&c, pin);
+    sm_config_set_in_shift(&c, /* shift right */ true, /* autopush */ true, 32);
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
+    pio_sm_set_consecutive_pindirs(pio, sm, pin, 1, /* is_out */ false);
+    pio_sm_init(pio, sm, offset, &c);
+}
+
+#endif
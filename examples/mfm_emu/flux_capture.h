@@ -0,0 +1,93 @@
+#pragma once
+
+// Turn flux captured from the controller's WDATA line back into the compact
+// track format used for output (one bit per bitcell, most significant bit
+// first, 1 = flux transition), writing it over the track in place just like a
+// real drive head would.
+//
+// This is plain C so the same code can be tested on the host, see
+// host_src/emu_write.c
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct flux_capture {
+  uint8_t *track;      ///< Compact flux of the track being written
+  size_t n_bits;       ///< Length of the track in bitcells
+  size_t bit;          ///< Where the next bitcell will be written
+  size_t written;      ///< How many bitcells have been written
+  uint32_t cell_q8;    ///< Capture counts per bitcell, times 256
+  int32_t residual_q8; ///< Timing error carried over to the next interval
+  uint16_t last;       ///< Counter value at the last flux transition
+  bool have_last;      ///< Set once the first transition has been seen
+} flux_capture_t;
+
+// Longest run of bitcells without a flux transition that is written. Longer
+// gaps only happen before the first transition or after the last one.
+enum { flux_capture_max_cells = 16 };
+
+// Start capturing over `track`, which is `n_bits` bitcells long, at bitcell
+// `start_bit`. `cell_q8` is the number of capture counts per bitcell, times
+// 256.
+static void flux_capture_start(flux_capture_t *fc, uint8_t *track,
+                               size_t n_bits, size_t start_bit,
+                               uint32_t cell_q8) {
+  fc->track = track;
+  fc->n_bits = n_bits;
+  fc->bit = start_bit % n_bits;
+  fc->written = 0;
+  fc->cell_q8 = cell_q8;
+  fc->residual_q8 = 0;
+  fc->have_last = false;
+}
+
+static void flux_capture_put_cells(flux_capture_t *fc, uint32_t cells) {
+  // the track wraps around, as on a real disk
+  while (cells--) {
+    uint8_t mask = 0x80 >> (fc->bit % 8);
+    if (cells) {
+      fc->track[fc->bit / 8] &= ~mask;
+    } else {
+      fc->track[fc->bit / 8] |= mask;
+    }
+    if (++fc->bit == fc->n_bits) {
+      fc->bit = 0;
+    }
+    fc->written++;
+  }
+}
+
+// Consume `n` values of the capture counter, each latched at a flux
+// transition. The counter counts down, so the interval between transitions is
+// the previous value minus the current one.
+static void flux_capture_samples(flux_capture_t *fc, const uint16_t *samples,
+                                 size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    uint16_t count = samples[i];
+    if (!fc->have_last) {
+      fc->last = count;
+      fc->have_last = true;
+      continue;
+    }
+    uint16_t delta = fc->last - count;
+    fc->last = count;
+
+    // Round to whole bitcells. Half the rounding error is carried forward, so
+    // a transition that comes early or late is mostly corrected in the next
+    // interval, but a controller clocked slightly differently from us does
+    // not build up an error that grows without limit.
+    int32_t t = (int32_t)delta * 256 + fc->residual_q8;
+    int32_t cells = (t + (int32_t)fc->cell_q8 / 2) / (int32_t)fc->cell_q8;
+    if (cells <= 0) {
+      fc->residual_q8 = t; // a glitch; fold it into the next interval
+      continue;
+    }
+    fc->residual_q8 = (t - cells * (int32_t)fc->cell_q8) / 2;
+    if (cells > flux_capture_max_cells) {
+      cells = flux_capture_max_cells;
+      fc->residual_q8 = 0;
+    }
+    flux_capture_put_cells(fc, cells);
+  }
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+// Read the headers of disk images that describe the disk themselves:
+// ImageDisk (.IMD) holds the sectors of each track, HxC (.HFE) holds the
+// bitstream of each track. Only the geometry and where each track starts are
+// read here; the tracks are read when the drive steps to them.
+//
+// This is plain C so the same code can be tested on the host, see
+// host_src/image_header.c
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum { image_max_tracks = 84 * 2 };
+
+typedef struct image_file {
+  /// Read up to `len` bytes at `pos` into `buf`, returning how many were read
+  size_t (*read)(void *context, uint32_t pos, uint8_t *buf, size_t len);
+  void *context;
+  uint32_t pos; ///< Where the next read starts
+} image_file_t;
+
+typedef struct image_geometry {
+  uint8_t cylinders, sectors, sides;
+  uint8_t n; ///< sector size is 128<<n
+  bool is_fm;
+  uint16_t bit_time_ns;
+  uint8_t interleave, cylinder_skew, head_skew; ///< see mfm_io_sector_order()
+  /// Where each track (cylinder * 2 + side) starts in the image, 0 if
+  /// missing. For IMD this is the track header, for HFE the track data.
+  uint32_t track_offset[image_max_tracks];
+  uint16_t track_len[image_max_tracks]; ///< HFE: bytes of both sides
+  char error[48]; ///< Why the image can't be used
+} image_geometry_t;
+
+static size_t image_read(image_file_t *f, void *buf, size_t len) {
+  size_t n = f->read(f->context, f->pos, (uint8_t *)buf, len);
+  f->pos += n;
+  return n;
+}
+
+// The next byte, or -1 at the end of the file
+static int image_getc(image_file_t *f) {
+  uint8_t c;
+  return image_read(f, &c, 1) ? c : -1;
+}
+
+static uint16_t image_le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+// Where sector `id` is in an IMD sector map, or -1
+static int image_imd_sector_place(const uint8_t *map, int n_sectors, int id) {
+  for (int i = 0; i < n_sectors; i++) {
+    if (map[i] == id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Read the IMD track headers, checking that every track has the same layout
+// and that no track holds more than `max_track_bytes` of sectors
+static bool image_open_imd(image_file_t *f, image_geometry_t *g,
+                           size_t max_track_bytes) {
+  *g = (image_geometry_t){.interleave = 1};
+  f->pos = 0;
+  int c;
+  do { // skip the comment
+    c = image_getc(f);
+  } while (c >= 0 && c != 0x1a);
+
+  // modes 0-2 are FM and 3-5 MFM, each at 500, 300 and 250kbps. FM carries
+  // half as many bits at the same rate, so its bitcells are twice as long.
+  static const uint16_t bit_time_ns[] = {2000, 3333, 4000, 1000, 1667, 2000};
+  uint8_t map[256];
+  uint8_t hdr[5];
+  bool first = true;
+  // where sector 1 is on tracks 0.0, 1.0 and 0.1, to find the skew
+  int first_place[3] = {-1, -1, -1};
+  while (image_read(f, hdr, sizeof(hdr)) == sizeof(hdr)) {
+    uint32_t track_offset = f->pos - sizeof(hdr);
+    uint8_t mode = hdr[0], cylinder = hdr[1], head = hdr[2], n_sectors = hdr[3],
+            n = hdr[4];
+    size_t sector_size = 128 << n;
+    if (mode > 5 || cylinder >= image_max_tracks / 2 || (head & 0x3f) > 1 ||
+        n > 6 || n_sectors * sector_size > max_track_bytes) {
+      snprintf(g->error, sizeof(g->error), "Unsupported IMD track %d.%d",
+               cylinder, head & 1);
+      return false;
+    }
+    // keep the sector numbering map; skip the optional cylinder and head maps
+    if (image_read(f, map, n_sectors) != n_sectors) {
+      snprintf(g->error, sizeof(g->error), "Truncated IMD image");
+      return false;
+    }
+    f->pos += n_sectors * (!!(head & 0x80) + !!(head & 0x40));
+    for (int i = 0; i < n_sectors; i++) {
+      c = image_getc(f);
+      if (c < 0 || c > 8) {
+        snprintf(g->error, sizeof(g->error), "Bad IMD sector record");
+        return false;
+      }
+      if (c == 0) { // no data
+        continue;
+      }
+      // odd records hold the sector data, even ones a single fill byte
+      f->pos += (c & 1) ? sector_size : 1;
+    }
+    if (n_sectors == 0) {
+      continue;
+    }
+    bool is_fm = mode < 3;
+    if (first) {
+      int place1 = image_imd_sector_place(map, n_sectors, 1);
+      int place2 = image_imd_sector_place(map, n_sectors, 2);
+      if (place1 >= 0 && place2 >= 0) {
+        g->interleave = (place2 - place1 + n_sectors) % n_sectors;
+      }
+      g->sectors = n_sectors;
+      g->n = n;
+      g->is_fm = is_fm;
+      g->bit_time_ns = bit_time_ns[mode];
+      first = false;
+    } else if (g->sectors != n_sectors || g->n != n || g->is_fm != is_fm ||
+               g->bit_time_ns != bit_time_ns[mode]) {
+      snprintf(g->error, sizeof(g->error),
+               "IMD track %d.%d has a different layout", cylinder, head & 1);
+      return false;
+    }
+    g->track_offset[cylinder * 2 + (head & 1)] = track_offset;
+    if (cylinder + (head & 1) <= 1) {
+      first_place[cylinder + (head & 1) * 2] =
+          image_imd_sector_place(map, n_sectors, 1);
+    }
+    if (cylinder + 1 > g->cylinders) {
+      g->cylinders = cylinder + 1;
+    }
+    if ((head & 1) + 1 > g->sides) {
+      g->sides = (head & 1) + 1;
+    }
+  }
+  if (first) {
+    snprintf(g->error, sizeof(g->error), "Empty IMD image");
+    return false;
+  }
+  int n_sectors = g->sectors;
+  if (first_place[0] >= 0 && first_place[1] >= 0) {
+    g->cylinder_skew = (first_place[1] - first_place[0] + n_sectors) % n_sectors;
+  }
+  if (first_place[0] >= 0 && first_place[2] >= 0) {
+    g->head_skew = (first_place[2] - first_place[0] + n_sectors) % n_sectors;
+  }
+  return true;
+}
+
+// Read the HFE (version 1) header and track list. Tracks hold every bitcell,
+// FM clock bits included, so they are output like MFM whatever the encoding.
+static bool image_open_hfe(image_file_t *f, image_geometry_t *g) {
+  *g = (image_geometry_t){.interleave = 1};
+  uint8_t hdr[32];
+  f->pos = 0;
+  if (image_read(f, hdr, sizeof(hdr)) != sizeof(hdr) || hdr[8] != 0) {
+    snprintf(g->error, sizeof(g->error), "Unsupported HFE version");
+    return false;
+  }
+  uint8_t n_tracks = hdr[9], n_sides = hdr[10];
+  uint16_t bit_rate = image_le16(hdr + 12); // kbps
+  if (n_tracks > image_max_tracks / 2 || n_sides < 1 || n_sides > 2 ||
+      bit_rate == 0) {
+    snprintf(g->error, sizeof(g->error), "Unsupported HFE geometry");
+    return false;
+  }
+  f->pos = image_le16(hdr + 18) * 512;
+  for (int i = 0; i < n_tracks; i++) {
+    uint8_t entry[4];
+    if (image_read(f, entry, sizeof(entry)) != sizeof(entry)) {
+      snprintf(g->error, sizeof(g->error), "Truncated HFE track list");
+      return false;
+    }
+    g->track_offset[i * 2] = g->track_offset[i * 2 + 1] =
+        image_le16(entry) * 512;
+    g->track_len[i * 2] = g->track_len[i * 2 + 1] = image_le16(entry + 2);
+  }
+  g->cylinders = n_tracks;
+  g->sides = n_sides;
+  g->bit_time_ns = 500000 / bit_rate;
+  return true;
+}
@@ -3,6 +3,8 @@
 #define WAIT_SERIAL
 #define XEROX_820
 // #define USE_CUSTOM_PINOUT
+// Feed flux to the PIO with DMA instead of from loop1(), leaving core 1 free
+// #define USE_DMA_FLUXOUT
 
 #if defined(USE_CUSTOM_PINOUT) && __has_include("custom_pinout.h")
 #warning Using custom pinout
@@ -90,18 +92,113 @@ Adafruit_NeoPixel strip(NEOPIXEL_COUNT, NEOPIXEL_PIN, NEOPIXEL_FORMAT);
   } while (0)
 #include "mfm_impl.h"
 
-enum {
-  max_flux_bits = 200000 // 300RPM (200ms rotational time), 1us bit times
-};
+// 300RPM (200ms rotational time), 1us bit times. Boards with room for twice as
+// much flux per track can also emulate 2.88MB extra density drives.
+#if !defined(MAX_FLUX_BITS)
+#if defined(PICO_RP2350)
+#define MAX_FLUX_BITS (400000)
+#else
+#define MAX_FLUX_BITS (200000)
+#endif
+#endif
+enum { max_flux_bits = MAX_FLUX_BITS };
 enum { max_flux_count_long = (max_flux_bits + 31) / 32 };
 
+// Encoded tracks are kept in a cache so that stepping back to a recently used
+// cylinder only switches a pointer, like on a real drive, instead of stopping
+// the flux while the track is read from SD and encoded again. As many slots
+// are allocated as fit, up to one per cylinder, leaving some heap free.
+#if !defined(TRACK_CACHE_MAX_SLOTS)
+#define TRACK_CACHE_MAX_SLOTS (80)
+#endif
+#if !defined(TRACK_CACHE_HEAP_RESERVE)
+#define TRACK_CACHE_HEAP_RESERVE (32768)
+#endif
+
+struct track_cache_slot_t {
+  int cylinder;       // -1 if the slot holds no track
+  uint32_t image;     // image_id of the image the track was encoded from
+  uint32_t last_used; // for choosing which slot to evict
+  uint32_t *flux;     // both sides, each max_flux_count_long long
+  bool speculative;   // encoded ahead of time and not yet stepped to
+  bool dirty;         // written by the controller and not yet saved to SD
+};
+
+struct {
+  uint32_t hits, misses;
+  uint32_t speculative_hits;    // hits on a track encoded ahead of time
+  uint32_t speculative_encodes; // tracks encoded ahead of time
+} track_cache_stats;
+
+track_cache_slot_t track_cache[TRACK_CACHE_MAX_SLOTS];
+size_t track_cache_slots;
+// Identifies the current image, so tracks cached from a disk are used again
+// when it is inserted again
+uint32_t image_id;
+
 // Data shared between the two CPU cores
 volatile int fluxout; // side number 0/1 or -1 if no flux should be generated
 volatile size_t flux_count_long =
     max_flux_count_long; // in units of uint32_ts (longs)
-volatile uint32_t flux_data[2]
-                           [max_flux_count_long]; // one track of flux data for
-                                                  // both sides of the disk
+volatile uint32_t *volatile flux_data; // the cache slot to output next
+volatile uint32_t *volatile flux_active; // the cache slot being output now
+volatile size_t flux_pos; // the word of flux_active being output now
+
+static void allocate_track_cache() {
+  size_t slot_size = 2 * max_flux_count_long * sizeof(uint32_t);
+  while (track_cache_slots < TRACK_CACHE_MAX_SLOTS) {
+    uint32_t *flux = NULL;
+#if defined(RP2350_PSRAM_CS)
+    if (rp2040.getFreePSRAMHeap() >= slot_size) {
+      flux = (uint32_t *)pmalloc(slot_size);
+    }
+#endif
+    if (!flux &&
+        rp2040.getFreeHeap() >= slot_size + TRACK_CACHE_HEAP_RESERVE) {
+      flux = (uint32_t *)malloc(slot_size);
+    }
+    if (!flux) {
+      break;
+    }
+    track_cache[track_cache_slots++] = {-1, 0, 0, flux, false, false};
+  }
+  Serial.printf("Track cache has %zu slots\n", track_cache_slots);
+}
+
+static bool track_slot_busy(const track_cache_slot_t &slot) {
+  return slot.flux == flux_data || slot.flux == flux_active;
+}
+
+// Return the slot holding the cylinder, or NULL after choosing the least
+// recently used slot to encode it into. Slots that core 1 is outputting or
+// about to output are only chosen if there is no other slot, in which case
+// the output must be stopped before the slot is overwritten.
+static track_cache_slot_t *find_track(int cylinder,
+                                      track_cache_slot_t **victim) {
+  static uint32_t use_counter;
+  track_cache_slot_t *oldest = NULL;
+  for (size_t i = 0; i < track_cache_slots; i++) {
+    auto &slot = track_cache[i];
+    if (slot.cylinder == cylinder && slot.image == image_id) {
+      slot.last_used = ++use_counter;
+      return &slot;
+    }
+    if (!oldest) {
+      oldest = &slot;
+    } else if (track_slot_busy(*oldest) != track_slot_busy(slot)) {
+      if (track_slot_busy(*oldest))
+        oldest = &slot;
+    } else if (slot.cylinder < 0 ||
+               (oldest->cylinder >= 0 && slot.last_used < oldest->last_used)) {
+      oldest = &slot;
+    }
+  }
+  if (oldest) {
+    oldest->last_used = ++use_counter;
+  }
+  *victim = oldest;
+  return NULL;
+}
 
 ////////////////////////////////
 // Code & data for core 1
@@ -115,21 +212,108 @@ uint sm_index_pulse, offset_index_pulse;
 
 volatile bool early_setup_done;
 
+#if defined(USE_DMA_FLUXOUT)
+#include <hardware/dma.h>
+#include <hardware/irq.h>
+
+// Flux is queued in chunks so that a change of side takes effect promptly.
+// Each chunk is 1ms at 1us bitcells; the interrupt that queues the next one
+// has the 4 words in the PIO FIFO (128us) to run.
+enum { dma_fluxout_chunk_words = 32 };
+
+int dma_fluxout;
+volatile bool dma_fluxout_running;
+volatile size_t dma_fluxout_next_word; // where the next chunk starts
+volatile uint32_t *volatile dma_fluxout_base; // side being output
+
+static void __not_in_flash_func(dma_fluxout_queue)() {
+  int f = fluxout;
+  if (f < 0) {
+    dma_fluxout_running = false;
+    // terminate index pulse if ongoing
+    pio_sm_exec(pio, sm_index_pulse,
+                0 | offset_index_pulse); // JMP to the first instruction
+    return;
+  }
+  size_t pos = dma_fluxout_next_word;
+  if (pos >= flux_count_long) {
+    // A new revolution: pulse the index, and switch to a new track if one is
+    // ready, just like loop1() does
+    pos = 0;
+    flux_active = flux_data;
+    pio_sm_put(pio, sm_index_pulse,
+               4000); // ??? put index high for 4ms (out of 200ms)
+  }
+  size_t n = std::min<size_t>(dma_fluxout_chunk_words, flux_count_long - pos);
+  auto base = flux_active + f * max_flux_count_long;
+  dma_fluxout_base = base;
+  flux_pos = pos;
+  dma_fluxout_next_word = pos + n;
+  dma_channel_set_read_addr(dma_fluxout, base + pos, false);
+  dma_channel_set_trans_count(dma_fluxout, n, true);
+}
+
+static void __not_in_flash_func(dma_fluxout_irq)() {
+  if (dma_channel_get_irq1_status(dma_fluxout)) {
+    dma_channel_acknowledge_irq1(dma_fluxout);
+    dma_fluxout_queue();
+  }
+}
+
+// The word being fetched from flux_active, for placing writes
+static size_t fluxout_word() {
+  auto hw = dma_channel_hw_addr(dma_fluxout);
+  return (volatile uint32_t *)(uintptr_t)hw->read_addr - dma_fluxout_base;
+}
+#else
+static size_t fluxout_word() { return flux_pos; }
+#endif
+
 void setup1() {
   while (!early_setup_done) {
   }
+#if defined(USE_DMA_FLUXOUT)
+  // set up here so the interrupt is handled by core 1
+  dma_fluxout = dma_claim_unused_channel(true);
+  dma_channel_config c = dma_channel_get_default_config(dma_fluxout);
+  channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+  channel_config_set_read_increment(&c, true);
+  channel_config_set_write_increment(&c, false);
+  channel_config_set_bswap(&c, true); // the PIO shifts out the MSB first
+  channel_config_set_dreq(&c, pio_get_dreq(pio, sm_fluxout, true));
+  dma_channel_configure(dma_fluxout, &c, &pio->txf[sm_fluxout], NULL, 0,
+                        false);
+  dma_channel_set_irq1_enabled(dma_fluxout, true);
+  irq_add_shared_handler(DMA_IRQ_1, dma_fluxout_irq,
+                         PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+  irq_set_enabled(DMA_IRQ_1, true);
+#endif
 }
 
+#if defined(USE_DMA_FLUXOUT)
+void loop1() {
+  if (fluxout >= 0 && !dma_fluxout_running) {
+    dma_fluxout_running = true;
+    dma_fluxout_next_word = flux_count_long; // start with an index pulse
+    dma_fluxout_queue();
+  }
+}
+#else
 void __not_in_flash_func(loop1)() {
   static bool once;
   if (fluxout >= 0) {
+    // A new track only takes effect at the index pulse, so core 0 can fill
+    // another cache slot while this one is output without glitches
+    auto flux = flux_data;
+    flux_active = flux;
     pio_sm_put_blocking(pio, sm_index_pulse,
                         4000); // ??? put index high for 4ms (out of 200ms)
     for (size_t i = 0; i < flux_count_long; i++) {
       int f = fluxout;
       if (f < 0)
         break;
-      auto d = flux_data[fluxout][i];
+      auto d = flux[f * max_flux_count_long + i];
+      flux_pos = i;
       pio_sm_put_blocking(pio, sm_fluxout, __builtin_bswap32(d));
     }
     // terminate index pulse if ongoing
@@ -137,6 +321,7 @@ void __not_in_flash_func(loop1)() {
                 0 | offset_index_pulse); // JMP to the first instruction
   }
 }
+#endif
 
 ////////////////////////////////////////////////
 // Code & data for core 0
@@ -147,7 +332,7 @@ void __not_in_flash_func(loop1)() {
 volatile int trackno;
 
 enum {
-  max_sector_count = 18,
+  max_sector_count = max_flux_bits >= 400000 ? 36 : 18,
   mfm_io_block_size = 512,
   track_max_bytes = max_sector_count * mfm_io_block_size
 };
@@ -176,30 +361,63 @@ void onStep() {
 #if defined(PIN_CARD_CS)
 #define USE_SDFAT (1)
 #include "SdFat.h"
+#include "image_header.h"
 SdFat SD;
 FsFile dir;
 FsFile file;
 
+#if defined(WRGATE_PIN) && defined(WRDATA_PIN) && defined(PROT_PIN)
+#define USE_WRITE (1)
+bool image_writable; // the image is open read/write in a writable format
+#endif
+
 struct floppy_format_info_t {
+  const char *name;
   uint8_t cylinders, sectors, sides; // number of sides may be 1 or 2
   uint16_t bit_time_ns;
   size_t flux_count_bit;
   uint8_t n; // sector size is 128<<n
   bool is_fm;
+  const mfm_io_settings_t *settings; // gaps etc. used by the encoder
+  // sector layout, see mfm_io_sector_order()
+  uint8_t interleave = 1, cylinder_skew = 0, head_skew = 0;
+};
+
+// 2.88MB drives record perpendicularly, which needs a longer gap before the
+// data field
+static const mfm_io_settings_t extra_density_mfm = {
+    50, 41, {32, 54, 84, 116, 255, 255, 255, 255}, 80, 12, 0x4e, false,
 };
 
+// Raw sector images are recognized by their size. MFM tracks are skewed by
+// about 20ms per cylinder, so a controller reading a whole disk finds the
+// first sector of the next cylinder coming up just after stepping and
+// settling, instead of having just missed it (see host_src/interleave.c).
 const struct floppy_format_info_t format_info[] = {
-    {80, 18, 2, 1000, 200000, 2, false}, // 3.5" 1440kB, 300RPM
-    {80, 9, 2, 2000, 100000, 2, false},  // 3.5" 720kB, 300RPM
+    {"3.5\" 1440kB", 80, 18, 2, 1000, 200000, 2, false, &standard_mfm, 1, 2},
+    {"3.5\" 720kB", 80, 9, 2, 2000, 100000, 2, false, &standard_mfm, 1, 1},
+#if MAX_FLUX_BITS >= 400000
+    {"3.5\" 2880kB", 80, 36, 2, 500, 400000, 2, false, &extra_density_mfm, 1,
+     4},
+#endif
 
-    {80, 15, 2, 1000, 166667, 2, false}, // 5.25" 1200kB, 360RPM
-    {40, 9, 2, 2000, 100000, 2, false},  // 5.25" 360kB, 300RPM
+    {"5.25\" 1200kB", 80, 15, 2, 1000, 166667, 2, false, &standard_mfm, 1, 2},
+    {"5.25\" 360kB", 40, 9, 2, 2000, 100000, 2, false, &standard_mfm, 1, 1},
 
-    {77, 26, 1, 2000, 80000, 0, true}, // 8" 256kB, 360RPM
+    {"8\" 256kB", 77, 26, 1, 2000, 80000, 0, true, &standard_fm},
 };
 
+// Images with a header describing the disk: ImageDisk (.IMD) holds the
+// sectors of each track, HxC (.HFE) holds the bitstream of each track
+enum image_kind_t { IMAGE_RAW, IMAGE_IMD, IMAGE_HFE };
+image_kind_t image_kind;
+floppy_format_info_t image_format; // the geometry read from the header
+image_geometry_t image_geometry;   // and where each track is
+
 const floppy_format_info_t *cur_format = &format_info[0];
 
+static uint8_t imd_sector_map[256];
+
 void pio_sm_set_clk_ns(PIO pio, uint sm, uint time_ns) {
   Serial.printf("set_clk_ns %u\n", time_ns);
   float f = clock_get_hz(clk_sys) * 1e-9 * time_ns;
@@ -207,30 +425,111 @@ void pio_sm_set_clk_ns(PIO pio, uint sm, uint time_ns) {
   pio_sm_set_clkdiv_int_frac(pio, sm, scaled_clkdiv / 256, scaled_clkdiv % 256);
 }
 
-bool setFormat(size_t size) {
-  cur_format = NULL;
+static void applyFormat(const floppy_format_info_t *format) {
+  cur_format = format;
+  if (format->is_fm) {
+    pio_sm_set_wrap(pio, sm_fluxout, offset_fluxout, offset_fluxout + 1);
+    pio_sm_set_clk_ns(pio, sm_fluxout, format->bit_time_ns / 4);
+    gpio_set_outover(FLUX_OUT_PIN, GPIO_OVERRIDE_INVERT);
+  } else {
+    pio_sm_set_wrap(pio, sm_fluxout, offset_fluxout, offset_fluxout + 0);
+    pio_sm_set_clk_ns(pio, sm_fluxout, format->bit_time_ns);
+    gpio_set_outover(FLUX_OUT_PIN, GPIO_OVERRIDE_NORMAL);
+  }
+  flux_count_long = (format->flux_count_bit + 31) / 32;
+  Serial.printf("%s, %d cylinders, %d sides\n", format->name,
+                format->cylinders, format->sides);
+}
+
+static const floppy_format_info_t *findRawFormat(size_t size) {
   for (const auto &i : format_info) {
     auto img_size = (size_t)i.sectors * i.cylinders * i.sides * (128 << i.n);
-    if (size != img_size)
-      continue;
-    cur_format = &i;
-    if (cur_format->is_fm) {
-      pio_sm_set_wrap(pio, sm_fluxout, offset_fluxout, offset_fluxout + 1);
-      pio_sm_set_clk_ns(pio, sm_fluxout, i.bit_time_ns / 4);
-      gpio_set_outover(FLUX_OUT_PIN, GPIO_OVERRIDE_INVERT);
-    } else {
-      pio_sm_set_wrap(pio, sm_fluxout, offset_fluxout, offset_fluxout + 0);
-      pio_sm_set_clk_ns(pio, sm_fluxout, i.bit_time_ns);
-      gpio_set_outover(FLUX_OUT_PIN, GPIO_OVERRIDE_NORMAL);
-    }
-    flux_count_long = (i.flux_count_bit + 31) / 32;
-    return true;
+    if (size == img_size)
+      return &i;
   }
-  return false;
+  return NULL;
+}
+
+// Read the open image for image_header.h
+static size_t read_image_file(void *context, uint32_t pos, uint8_t *buf,
+                              size_t len) {
+  auto f = (FsFile *)context;
+  int n = f->seek(pos) ? f->read(buf, len) : 0;
+  return std::max(n, 0);
+}
+
+// Read the IMD track headers, checking that every track has the same layout
+static bool openIMD() {
+  image_file_t f = {read_image_file, &file};
+  if (!image_open_imd(&f, &image_geometry, track_max_bytes)) {
+    Serial.printf(": %s\n", image_geometry.error);
+    return false;
+  }
+  const image_geometry_t &g = image_geometry;
+  image_format = {"IMD image",
+                  g.cylinders,
+                  g.sectors,
+                  g.sides,
+                  g.bit_time_ns,
+                  0,
+                  g.n,
+                  g.is_fm,
+                  g.is_fm ? &standard_fm : &standard_mfm,
+                  g.interleave,
+                  g.cylinder_skew,
+                  g.head_skew};
+  Serial.printf(": Interleave %d, skew %d/%d", image_format.interleave,
+                image_format.cylinder_skew, image_format.head_skew);
+
+  // The header doesn't say how fast the disk spins. Assume 360RPM if the
+  // track fits, as is the case on 8" and 5.25" HD drives.
+  size_t track_bytes = image_format.sectors * ((128 << image_format.n) + 100);
+  size_t bits_360rpm = 166667000 / image_format.bit_time_ns;
+  image_format.flux_count_bit = track_bytes * 16 <= bits_360rpm
+                                    ? bits_360rpm
+                                    : 200000000 / image_format.bit_time_ns;
+  if (image_format.flux_count_bit > max_flux_bits) {
+    Serial.println(": IMD tracks too long");
+    return false;
+  }
+  return true;
+}
+
+// Read the HFE (version 1) header and track list
+static bool openHFE() {
+  image_file_t f = {read_image_file, &file};
+  if (!image_open_hfe(&f, &image_geometry)) {
+    Serial.printf(": %s\n", image_geometry.error);
+    return false;
+  }
+  const image_geometry_t &g = image_geometry;
+  image_format = {"HFE image",
+                  g.cylinders,
+                  0,
+                  g.sides,
+                  g.bit_time_ns,
+                  std::min<size_t>(g.track_len[0] / 2 * 8, max_flux_bits),
+                  0,
+                  false,
+                  &standard_mfm,
+                  1,
+                  0,
+                  0};
+  return image_format.flux_count_bit != 0;
+}
+
+// A number that is likely to change when a different image is inserted
+static uint32_t make_image_id(const char *name, size_t size) {
+  uint32_t h = 2166136261u ^ size; // FNV-1a
+  while (*name) {
+    h = (h ^ (uint8_t)*name++) * 16777619u;
+  }
+  return h;
 }
 
 void openNextImage() {
   bool rewound = false;
+  cur_format = NULL;
   while (true) {
     auto res = file.openNext(&dir, O_RDONLY);
     if (!res) {
@@ -252,12 +551,227 @@ void openNextImage() {
       Serial.println("/");
       continue;
     }
-    if (setFormat(file.fileSize())) {
-      Serial.printf(": Valid floppy image\n");
-      return;
+    char signature[8] = {};
+    file.read(signature, sizeof(signature));
+    const floppy_format_info_t *format = NULL;
+    if (!memcmp(signature, "IMD ", 4)) {
+      image_kind = IMAGE_IMD;
+      format = openIMD() ? &image_format : NULL;
+    } else if (!memcmp(signature, "HXCPICFE", 8)) {
+      image_kind = IMAGE_HFE;
+      format = openHFE() ? &image_format : NULL;
+    } else {
+      image_kind = IMAGE_RAW;
+      format = findRawFormat(file.fileSize());
+      if (!format) {
+        Serial.println(": Unrecognized file length\n");
+      }
+    }
+    if (!format) {
+      continue;
+    }
+    Serial.printf(": Valid floppy image\n");
+    applyFormat(format);
+    char name[256];
+    file.getName(name, sizeof(name));
+    image_id = make_image_id(name, file.fileSize());
+#if USE_WRITE
+    // only raw MFM images can be written; reopen for writing if possible
+    file.close();
+    image_writable = image_kind == IMAGE_RAW && !cur_format->is_fm &&
+                     file.open(&dir, name, O_RDWR);
+    if (!image_writable) {
+      file.open(&dir, name, O_RDONLY);
+    }
+    Serial.printf("Image is %s\n", image_writable ? "writable" : "read-only");
+    digitalWrite(PROT_PIN, image_writable); // active LOW
+#endif
+    return;
+  }
+}
+#endif
+
+#if USE_WRITE
+////////////////////////////////////////////////
+// Write support
+// The controller's flux is written over the cached track, in place, just like
+// a real drive head. Changed sectors are saved to the image later, when the
+// controller stops writing for a while or the slot is reused.
+////////////////////////////////////////////////
+
+#include "flux_capture.h"
+#include <hardware/dma.h>
+
+// WDATA flux is captured by PIO and moved into this ring by DMA. 32kB holds
+// over 60ms of flux at 500kbps, so loop() can be busy (e.g., encoding a track)
+// for that long when a write starts without any being lost.
+enum { capture_ring_bits = 15 };
+enum { capture_ring_words = (1 << capture_ring_bits) / sizeof(uint32_t) };
+uint32_t capture_ring[capture_ring_words]
+    __attribute__((aligned(1 << capture_ring_bits)));
+// The transfer count the DMA channel starts from, far more words than a write
+// ever takes. On the RP2350 the top 4 bits of the count select the mode, and
+// all 1s there would never count down.
+static const uint32_t capture_dma_count = 0x0fffffff;
+
+// How many words are queued in the PIO (TX FIFO and output shift register)
+// ahead of the word being fetched for output, i.e., how far ahead of the
+// "head" the fetched word is
+enum { fluxout_queued_words = 5 };
+
+// How long the controller must stop writing before changes are saved
+enum { write_flush_delay_ms = 500 };
+
+uint sm_fluxin, offset_fluxin;
+int dma_fluxin;
+dma_channel_config dma_fluxin_config;
+uint32_t last_write_ms;
+
+// Set by onWriteGate()
+volatile bool write_gate, write_started;
+volatile uint32_t *volatile write_slot_flux; // the slot being written
+volatile int write_side;
+volatile size_t write_start_bit;
+
+void onWriteGate() {
+  bool gate = !digitalRead(WRGATE_PIN); // active LOW
+  if (!gate) {
+    pio_sm_set_enabled(pio, sm_fluxin, false);
+    write_gate = false;
+    return;
+  }
+  int side = fluxout;
+  if (!image_writable || side < 0 || write_gate) {
+    return;
+  }
+  size_t n_words = flux_count_long;
+  write_slot_flux = flux_active;
+  write_side = side;
+  write_start_bit =
+      (fluxout_word() + n_words - fluxout_queued_words) % n_words * 32;
+
+  pio_sm_set_enabled(pio, sm_fluxin, false);
+  pio_sm_clear_fifos(pio, sm_fluxin);
+  pio_sm_restart(pio, sm_fluxin);
+  pio_sm_exec(pio, sm_fluxin, pio_encode_jmp(offset_fluxin));
+  dma_channel_abort(dma_fluxin);
+  dma_channel_configure(dma_fluxin, &dma_fluxin_config, capture_ring,
+                        &pio->rxf[sm_fluxin], capture_dma_count, true);
+  pio_sm_set_enabled(pio, sm_fluxin, true);
+  write_gate = write_started = true;
+}
+
+// Number of capture counts per bitcell, times 256
+static uint32_t capture_cell_q8() {
+  // the PIO program counts once every 3 system clocks
+  return (uint64_t)cur_format->bit_time_ns * clock_get_hz(clk_sys) * 256 /
+         3000000000u;
+}
+
+// Convert the captured flux into the track until the write gate turns off
+static void capture_write() {
+  write_started = false;
+  flux_capture_t fc;
+  auto flux = (uint8_t *)(write_slot_flux + write_side * max_flux_count_long);
+  flux_capture_start(&fc, flux, flux_count_long * 32, write_start_bit,
+                     capture_cell_q8());
+
+  auto hw = dma_channel_hw_addr(dma_fluxin);
+  uint32_t read = 0;
+  while (true) {
+    bool gate = write_gate;
+    uint32_t written =
+        capture_dma_count - (hw->transfer_count & capture_dma_count);
+    if (written - read > capture_ring_words) {
+      Serial.println("Write capture overrun -- flux lost");
+      break;
+    }
+    if (written == read) {
+      if (!gate) {
+        break;
+      }
+      continue;
+    }
+    while (read != written) {
+      uint32_t w = capture_ring[read++ % capture_ring_words];
+      uint16_t samples[2] = {(uint16_t)w, (uint16_t)(w >> 16)};
+      flux_capture_samples(&fc, samples, 2);
+    }
+  }
+  dma_channel_abort(dma_fluxin);
+
+  for (size_t i = 0; i < track_cache_slots; i++) {
+    if (track_cache[i].flux == write_slot_flux) {
+      track_cache[i].dirty = true;
+    }
+  }
+  last_write_ms = millis();
+  Serial.printf("Wrote %zu bitcells at %zu\n", fc.written, write_start_bit);
+}
+
+// Decode the slot's flux and save each sector that differs from the image
+static void flush_track_slot(track_cache_slot_t *slot) {
+  if (!slot->dirty || slot->cylinder < 0) {
+    return;
+  }
+  slot->dirty = false;
+
+  static uint8_t sector_buf[mfm_io_block_size];
+  uint8_t validity[max_sector_count];
+  int sector_count = cur_format->sectors;
+  int side_count = cur_format->sides;
+  int sector_size = 128 << cur_format->n;
+  size_t saved = 0, unreadable = 0;
+
+  for (auto side = 0; side < side_count; side++) {
+    mfm_io_t io = {
+        .decode_compact = true,
+        .T2_max = 5,
+        .T3_max = 7,
+        .T1_nom = 2,
+        .pulses = (uint8_t *)(slot->flux + side * max_flux_count_long),
+        .n_pulses = flux_count_long * 32,
+        .sectors = track_data,
+        .n_sectors = (size_t)sector_count,
+        .sector_validity = validity,
+        .n = cur_format->n,
+    };
+    memset(validity, 0, sizeof(validity));
+    if (io.n == 2) {
+      decode_track_mfm_compact_512(&io);
     } else {
-      Serial.println(": Unrecognized file length\n");
+      decode_track_mfm(&io);
     }
+
+    for (auto i = 0; i < sector_count; i++) {
+      if (!validity[i]) {
+        unreadable++;
+        continue;
+      }
+      size_t offset =
+          (((size_t)slot->cylinder * side_count + side) * sector_count + i) *
+          sector_size;
+      const uint8_t *data = track_data + i * sector_size;
+      file.seek(offset);
+      if (file.read(sector_buf, sector_size) == sector_size &&
+          !memcmp(sector_buf, data, sector_size)) {
+        continue;
+      }
+      file.seek(offset);
+      if (file.write(data, sector_size) != (size_t)sector_size) {
+        Serial.println("Image write failed");
+      }
+      saved++;
+    }
+  }
+  file.sync();
+  Serial.printf("Track %d: saved %zu sectors, %zu unreadable\n",
+                slot->cylinder, saved, unreadable);
+}
+
+static void flush_track_cache() {
+  for (size_t i = 0; i < track_cache_slots; i++) {
+    flush_track_slot(&track_cache[i]);
   }
 }
 #endif
@@ -293,7 +807,25 @@ void setup() {
   digitalWrite(READY_PIN, HIGH); // active low
 #if defined(PROT_PIN)
   pinMode(PROT_PIN, OUTPUT);
-  digitalWrite(PROT_PIN, LOW); // always write-protected, no write support
+  digitalWrite(PROT_PIN, LOW); // write-protected until a writable image opens
+#endif
+#if USE_WRITE
+  offset_fluxin = pio_add_program(pio, &fluxin_program);
+  sm_fluxin = pio_claim_unused_sm(pio, true);
+  pinMode(WRDATA_PIN, INPUT_PULLUP);
+  pinMode(WRGATE_PIN, INPUT_PULLUP);
+  fluxin_program_init(pio, sm_fluxin, offset_fluxin, WRDATA_PIN);
+
+  dma_fluxin = dma_claim_unused_channel(true);
+  dma_fluxin_config = dma_channel_get_default_config(dma_fluxin);
+  channel_config_set_transfer_data_size(&dma_fluxin_config, DMA_SIZE_32);
+  channel_config_set_read_increment(&dma_fluxin_config, false);
+  channel_config_set_write_increment(&dma_fluxin_config, true);
+  channel_config_set_ring(&dma_fluxin_config, true, capture_ring_bits);
+  channel_config_set_dreq(&dma_fluxin_config,
+                          pio_get_dreq(pio, sm_fluxin, false));
+
+  attachInterrupt(digitalPinToInterrupt(WRGATE_PIN), onWriteGate, CHANGE);
 #endif
 #if defined(DISKCHANGE_PIN)
   pinMode(DISKCHANGE_PIN, INPUT_PULLUP);
@@ -315,6 +847,8 @@ void setup() {
   Serial.println("Configured for Xerox 820 8\" floppy emulation");
 #endif
 
+  allocate_track_cache();
+
   attachInterrupt(digitalPinToInterrupt(STEP_PIN), onStep, FALLING);
 
 #if defined(NEOPIXEL_PIN)
@@ -337,21 +871,32 @@ void setup() {
 #endif
 }
 
-static void encode_track(uint8_t head, uint8_t cylinder) {
+static void encode_track(uint32_t *flux, uint8_t head, uint8_t cylinder) {
 
   mfm_io_t io = {
       .encode_compact = true,
-      .pulses = (uint8_t *)flux_data[head],
+      .pulses = (uint8_t *)(flux + head * max_flux_count_long),
       .n_pulses = flux_count_long * sizeof(long),
       .sectors = track_data,
       .n_sectors = cur_format->sectors,
       .head = head,
       .cylinder = cylinder,
       .n = cur_format->n,
-      .settings = cur_format->is_fm ? &standard_fm : &standard_mfm,
+      .interleave = cur_format->interleave,
+      .cylinder_skew = cur_format->cylinder_skew,
+      .head_skew = cur_format->head_skew,
+      .settings = cur_format->settings,
   };
 
-  size_t pos = encode_track_mfm(&io);
+  // the common formats have encoders specialized for them
+  size_t pos;
+  if (!io.settings->is_fm && io.n == 2) {
+    pos = encode_track_mfm_compact_512(&io);
+  } else if (io.settings->is_fm && io.n == 0) {
+    pos = encode_track_fm_compact_128(&io);
+  } else {
+    pos = encode_track_mfm(&io);
+  }
   Serial.printf("Encoded to %zu flux\n", pos);
 }
 
@@ -371,8 +916,148 @@ static void make_dummy_data(uint8_t head, uint8_t cylinder, size_t n_bytes) {
   }
 }
 
+#if USE_SDFAT
+// Gather the sectors of an IMD track into track_data, in sector number order
+static bool read_imd_track(int cylinder, int side) {
+  uint32_t offset = image_geometry.track_offset[cylinder * 2 + side];
+  if (!offset) {
+    return false;
+  }
+  uint8_t hdr[5];
+  file.seek(offset);
+  if (file.read(hdr, sizeof(hdr)) != sizeof(hdr) ||
+      file.read(imd_sector_map, hdr[3]) != hdr[3]) {
+    return false;
+  }
+  uint8_t head = hdr[2], n_sectors = hdr[3];
+  size_t sector_size = 128 << hdr[4];
+  file.seek(file.curPosition() +
+            n_sectors * (!!(head & 0x80) + !!(head & 0x40)));
+  memset(track_data, 0, sector_size * cur_format->sectors);
+  for (auto i = 0; i < n_sectors; i++) {
+    int c = file.read();
+    int id = imd_sector_map[i];
+    uint8_t *data = NULL;
+    if (id >= 1 && id <= cur_format->sectors) {
+      data = track_data + (id - 1) * sector_size;
+    } else {
+      Serial.printf("Skipping sector %d.%d.%d\n", cylinder, side, id);
+    }
+    if (c <= 0) { // no data
+      continue;
+    }
+    if (c & 1) {
+      if (!data) {
+        file.seek(file.curPosition() + sector_size);
+      } else if (file.read(data, sector_size) != (int)sector_size) {
+        return false;
+      }
+    } else {
+      c = file.read();
+      if (data) {
+        memset(data, c, sector_size);
+      }
+    }
+  }
+  return true;
+}
+
+static uint8_t reverse_bits(uint8_t b) {
+  b = (b & 0xf0) >> 4 | (b & 0x0f) << 4;
+  b = (b & 0xcc) >> 2 | (b & 0x33) << 2;
+  return (b & 0xaa) >> 1 | (b & 0x55) << 1;
+}
+
+// Copy the bitstream of an HFE track straight into the slot. The sides are
+// interleaved in 512 byte blocks, and the first bitcell of each byte is its
+// least significant bit.
+static bool load_hfe_track(uint32_t *flux, int cylinder) {
+  uint32_t offset = image_geometry.track_offset[cylinder * 2];
+  size_t max_bytes = flux_count_long * sizeof(uint32_t);
+  size_t len = std::min<size_t>(image_geometry.track_len[cylinder * 2] / 2, max_bytes);
+  if (!offset) {
+    return false;
+  }
+  file.seek(offset);
+  for (size_t pos = 0; pos < len; pos += 256) {
+    if (file.read(track_data, 512) != 512) {
+      return false;
+    }
+    size_t n = std::min<size_t>(256, len - pos);
+    for (auto side = 0; side < 2; side++) {
+      auto dst = (uint8_t *)(flux + side * max_flux_count_long) + pos;
+      for (size_t i = 0; i < n; i++) {
+        dst[i] = reverse_bits(track_data[side * 256 + i]);
+      }
+    }
+  }
+  // a track shorter than the revolution is padded with MFM 0x4e gap bytes
+  for (auto side = 0; side < 2; side++) {
+    auto dst = (uint8_t *)(flux + side * max_flux_count_long);
+    for (size_t i = len; i < max_bytes; i++) {
+      dst[i] = (i & 1) ? 0x54 : 0x92;
+    }
+  }
+  return true;
+}
+#endif
+
+// Read a cylinder from the image and encode both its sides into the slot
+static void fill_track_slot(track_cache_slot_t *slot, int cylinder) {
+#if USE_WRITE
+  flush_track_slot(slot);
+#endif
+  slot->cylinder = -1;
+  slot->speculative = false;
+  int sector_count = cur_format->sectors;
+  int side_count = cur_format->sides;
+  int sector_size = 128 << cur_format->n;
+  size_t count = sector_size * sector_count;
+#if USE_SDFAT
+  if (image_kind == IMAGE_HFE) {
+    if (!load_hfe_track(slot->flux, cylinder)) {
+      Serial.println("Read failed -- track left unformatted");
+      memset(slot->flux, 0, 2 * max_flux_count_long * sizeof(uint32_t));
+    }
+  } else {
+    for (auto side = 0; side < side_count; side++) {
+      bool ok;
+      if (image_kind == IMAGE_IMD) {
+        ok = read_imd_track(cylinder, side);
+      } else {
+        file.seek(((size_t)cylinder * side_count + side) * count);
+        ok = file.read(track_data, count) == (int)count;
+      }
+      if (!ok) {
+        Serial.println("Read failed -- using dummy data");
+        make_dummy_data(side, cylinder, count);
+      }
+      encode_track(slot->flux, side, cylinder);
+    }
+  }
+#else
+  Serial.println("No filesystem - using dummy data");
+  for (auto side = 0; side < side_count; side++) {
+    make_dummy_data(side, cylinder, count);
+    encode_track(slot->flux, side, cylinder);
+  }
+#endif
+  slot->cylinder = cylinder;
+  slot->image = image_id;
+}
+
 void loop() {
   static int cached_trackno = -1;
+  track_cache_slot_t *slot, *victim = NULL;
+#if USE_WRITE
+  if (write_started) {
+    capture_write();
+    return;
+  }
+  if (!write_gate && millis() - last_write_ms > write_flush_delay_ms) {
+    flush_track_cache();
+  }
+#endif
   auto new_trackno = trackno;
   int motor_pin = !digitalRead(MOTOR_PIN);
   int select_pin = !digitalRead(SELECT_PIN);
@@ -413,40 +1098,60 @@ void loop() {
     }
     fluxout = -1;
     cached_trackno = -1;
+#if USE_WRITE
+    flush_track_cache();
+#endif
     openNextImage();
   }
 #endif
 
-  if (cur_format && new_trackno != cached_trackno) {
-    STATUS_RGB(0, 255, 255);
-    fluxout = -1;
-    Serial.printf("Preparing flux data for track %d\n", new_trackno);
-    int sector_count = cur_format->sectors;
-    int side_count = cur_format->sides;
-    int sector_size = 128 << cur_format->n;
-    size_t offset = sector_size * sector_count * side_count * new_trackno;
-    size_t count = sector_size * sector_count;
-    int dummy_byte = new_trackno * side_count;
-#if USE_SDFAT
-    file.seek(offset);
-    for (auto side = 0; side < side_count; side++) {
-      int n = file.read(track_data, count);
-      if (n != count) {
-        Serial.println("Read failed -- using dummy data");
-        make_dummy_data(side, new_trackno, count);
-      }
-      encode_track(side, new_trackno);
+  if (cur_format && new_trackno != cached_trackno &&
+      (slot = find_track(new_trackno, &victim)) != NULL) {
+    flux_data = slot->flux;
+    cached_trackno = new_trackno;
+    if (slot->speculative) {
+      slot->speculative = false;
+      track_cache_stats.speculative_hits++;
     }
-#else
-    Serial.println("No filesystem - using dummy data");
-    for (auto side = 0; side < side_count; side++) {
-      make_dummy_data(side, new_trackno, count);
-      encode_track(side, new_trackno);
+    track_cache_stats.hits++;
+    Serial.printf("Track %d cached (%u hits, %u from speculation, %u misses, "
+                  "%u speculative encodes)\n",
+                  new_trackno, track_cache_stats.hits,
+                  track_cache_stats.speculative_hits, track_cache_stats.misses,
+                  track_cache_stats.speculative_encodes);
+  } else if (cur_format && new_trackno != cached_trackno && victim) {
+    STATUS_RGB(0, 255, 255);
+    if (track_slot_busy(*victim)) {
+      // not enough slots to keep the current track going
+      fluxout = -1;
+      flux_data = flux_active = NULL;
     }
-#endif
-
+    track_cache_stats.misses++;
+    Serial.printf("Preparing flux data for track %d\n", new_trackno);
+    fill_track_slot(victim, new_trackno);
     Serial.println("flux data prepared");
+    flux_data = victim->flux;
     cached_trackno = new_trackno;
+  } else if (cur_format && cached_trackno >= 0) {
+    // Controllers mostly step to the next or previous track, so while nothing
+    // else is happening encode those into spare slots. With too few slots for
+    // both, one neighbour is never evicted to encode the other, or the two
+    // would take turns being encoded for as long as the head stays put.
+    for (int cylinder : {cached_trackno + 1, cached_trackno - 1}) {
+      if (cylinder < 0 || cylinder >= cur_format->cylinders) {
+        continue;
+      }
+      if (find_track(cylinder, &victim) || !victim ||
+          track_slot_busy(*victim) ||
+          (victim->speculative && victim->image == image_id &&
+           abs(victim->cylinder - cached_trackno) == 1)) {
+        continue;
+      }
+      fill_track_slot(victim, cylinder);
+      victim->speculative = true;
+      track_cache_stats.speculative_encodes++;
+      break; // one track per loop, so steps are noticed promptly
+    }
   }
   fluxout =
       (cur_format != NULL && enabled && cached_trackno == trackno) ? side : -1;
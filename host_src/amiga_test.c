@@ -0,0 +1,214 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mfm_impl.h"
+
+// Check the Amiga trackdisk codec: whole tracks round tripped in both flux
+// forms, damaged and partial tracks, and the time taken to encode and decode
+// a track.
+
+enum { sector_count = 11 };
+enum { track_cells = 100000 }; // 300RPM, 2us bitcells
+enum { repeat = 100 };
+
+uint8_t flux[track_cells / 2];
+uint8_t expected[sector_count * mfm_io_amiga_sector_size];
+uint8_t track_buf[sector_count * mfm_io_amiga_sector_size];
+uint8_t validity[sector_count];
+uint8_t cylinder_read;
+
+static int failures;
+
+static void check(bool ok, const char *what) {
+  printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok) {
+    failures++;
+  }
+}
+
+static void init_io(mfm_io_t *io, bool compact) {
+  *io = (mfm_io_t){
+      .encode_compact = compact,
+      .decode_compact = compact,
+      .T2_max = compact ? 5 : 5 * 24 / 2,
+      .T3_max = compact ? 7 : 7 * 24 / 2,
+      .T1_nom = compact ? 2 : 24,
+      .pulses = flux,
+      // every pulse is at least 2 bitcells long
+      .n_pulses = compact ? track_cells / 8 : track_cells / 2,
+      .sectors = track_buf,
+      .n_sectors = sector_count,
+      .sector_validity = validity,
+      .cylinder_ptr = &cylinder_read,
+      .head = 1,
+      .cylinder = 39,
+  };
+}
+
+// Encode the expected sectors, returning the size of the whole flux in pulses,
+// or in bits for compact flux
+static size_t encode(mfm_io_t *io) {
+  memcpy(track_buf, expected, sizeof(expected));
+  encode_track_amiga(io);
+  return io->encode_compact ? io->pos * 8 : io->pos;
+}
+
+// decode the flux, returning the number of good sectors that match the
+// expected data
+static size_t decode(mfm_io_t *io, size_t n_flux) {
+  io->n_pulses = n_flux;
+  memset(track_buf, 0, sizeof(track_buf));
+  memset(validity, 0, sizeof(validity));
+  decode_track_amiga(io);
+  size_t good = 0;
+  for (size_t i = 0; i < sector_count; i++) {
+    good += validity[i] && !memcmp(track_buf + i * mfm_io_amiga_sector_size,
+                                   expected + i * mfm_io_amiga_sector_size,
+                                   mfm_io_amiga_sector_size);
+  }
+  return good;
+}
+
+// The bit offset of sector i in compact flux
+static size_t sector_start(size_t i) {
+  return (mfm_io_amiga_gap + i * mfm_io_amiga_sector_bytes) * 16;
+}
+
+static void check_layout(void) {
+  mfm_io_t io;
+  init_io(&io, true);
+  encode(&io);
+  // the first byte's first clock depends on the bit before it
+  static const uint8_t sync[] = {0xaa, 0xaa, 0xaa, 0x44, 0x89, 0x44, 0x89};
+  bool ok = true;
+  for (size_t i = 0; i < sector_count; i++) {
+    ok = ok && !memcmp(flux + sector_start(i) / 8 + 1, sync, sizeof(sync));
+  }
+  check(ok, "each sector starts with 0000 and two 4489 sync words");
+
+  // the info long of sector 0 is ff 4f 00 0b. Its odd bits are 1111 0011
+  // 0000 0011, which with clocks are 55 25 2a a5.
+  size_t info = sector_start(0) / 8 + 1 + sizeof(sync);
+  check(flux[info] == 0x55 && flux[info + 1] == 0x25 &&
+            flux[info + 2] == 0x2a && flux[info + 3] == 0xa5,
+        "info long odd bits");
+
+  size_t cells = sector_start(sector_count);
+  char buf[80];
+  snprintf(buf, sizeof(buf), "%zd bitcells of sectors fit in a %d bitcell track",
+           cells, track_cells);
+  check(cells <= track_cells * 99 / 100, buf);
+}
+
+static void check_round_trip(bool compact, const char *what) {
+  mfm_io_t io;
+  init_io(&io, compact);
+  size_t n = encode(&io);
+  init_io(&io, compact);
+  cylinder_read = 0;
+  size_t good = decode(&io, n);
+  char buf[80];
+  snprintf(buf, sizeof(buf), "%s: %zd good sectors", what, good);
+  check(good == sector_count && cylinder_read == 39, buf);
+}
+
+// Pulses with random jitter, to a decoder whose bitcell is 24 flux units long
+static void check_jitter(void) {
+  mfm_io_t io;
+  init_io(&io, false);
+  size_t n = encode(&io);
+  for (size_t i = 0; i < n; i++) {
+    flux[i] += rand() % 11 - 5;
+  }
+  init_io(&io, false);
+  check(decode(&io, n) == sector_count, "pulses with jitter");
+}
+
+static void flip_bit(size_t bit) { flux[bit / 8] ^= 0x80 >> (bit % 8); }
+
+static void check_damage(void) {
+  mfm_io_t io;
+  init_io(&io, true);
+  size_t n = encode(&io);
+  // a data bit in the middle of sector 5's data; data bits are the odd
+  // bitcells
+  flip_bit(sector_start(5) + (mfm_io_amiga_sector_bytes - 100) * 16 + 1);
+  // a bit of sector 8's label
+  flip_bit(sector_start(8) + (4 + 4 + 5) * 16 + 3);
+  init_io(&io, true);
+  size_t good = decode(&io, n);
+  check(good == sector_count - 2 && !validity[5] && !validity[8],
+        "damaged data and header are rejected");
+
+  // a second pass over good flux picks up just the missing sectors
+  init_io(&io, true);
+  encode(&io);
+  validity[5] = validity[8] = 0;
+  init_io(&io, true);
+  io.n_pulses = n;
+  size_t total = decode_track_amiga(&io);
+  check(total == sector_count && io.n_valid == sector_count,
+        "second pass fills in the missing sectors");
+}
+
+// Capture starts partway into sector 0, as it does when it doesn't wait for
+// the index
+static void check_partial(void) {
+  mfm_io_t io;
+  init_io(&io, true);
+  size_t n = encode(&io);
+  size_t skip = sector_start(0) / 8 + 100;
+  memmove(flux, flux + skip, n / 8 - skip);
+  init_io(&io, true);
+  size_t good = decode(&io, n - skip * 8);
+  check(good == sector_count - 1 && !validity[0],
+        "flux starting in the middle of a sector");
+}
+
+static double seconds_since(clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC / repeat;
+}
+
+static void bench(bool compact, const char *what) {
+  mfm_io_t io;
+  clock_t start = clock();
+  size_t n = 0;
+  for (int i = 0; i < repeat; i++) {
+    init_io(&io, compact);
+    n = encode(&io);
+  }
+  double t_encode = seconds_since(start);
+
+  start = clock();
+  for (int i = 0; i < repeat; i++) {
+    init_io(&io, compact);
+    io.n_pulses = n;
+    memset(validity, 0, sizeof(validity));
+    decode_track_amiga(&io);
+  }
+  double t_decode = seconds_since(start);
+  printf("%-20s encode %6.0fus, decode %6.0fus per track\n", what,
+         t_encode * 1e6, t_decode * 1e6);
+  check(io.n_valid == sector_count, "benchmarked track decoded");
+}
+
+int main() {
+  for (size_t i = 0; i < sizeof(expected); i++) {
+    expected[i] = rand();
+  }
+
+  check_layout();
+  check_round_trip(false, "pulses");
+  check_round_trip(true, "compact");
+  check_jitter();
+  check_damage();
+  check_partial();
+
+  bench(false, "Amiga 11x512");
+  bench(true, "Amiga 11x512 compact");
+
+  printf("%d Amiga failures\n", failures);
+  return failures != 0;
+}
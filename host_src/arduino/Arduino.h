@@ -0,0 +1,40 @@
+#pragma once
+// Just enough of the Arduino API to build the library's drive independent
+// code on the host, for the tests
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HIGH 1
+#define LOW 0
+
+static inline uint32_t millis(void) { return 0; }
+static inline uint32_t micros(void) { return 0; }
+static inline void delay(uint32_t) {}
+static inline void yield(void) {}
+static inline void noInterrupts(void) {}
+static inline void interrupts(void) {}
+
+class Print {
+public:
+  size_t printf(const char *fmt, ...) {
+    if (!verbose) {
+      return 0;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vprintf(fmt, ap);
+    va_end(ap);
+    return n;
+  }
+  size_t println(const char *s = "") { return printf("%s\n", s); }
+  bool verbose = false;
+};
+
+class Stream : public Print {};
+
+extern Stream Serial;
@@ -0,0 +1,15 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+class FsBlockDeviceInterface {
+public:
+  virtual ~FsBlockDeviceInterface() {}
+  virtual bool isBusy() = 0;
+  virtual uint32_t sectorCount() = 0;
+  virtual bool syncDevice() = 0;
+  virtual bool readSector(uint32_t block, uint8_t *dst) = 0;
+  virtual bool readSectors(uint32_t block, uint8_t *dst, size_t ns) = 0;
+  virtual bool writeSector(uint32_t block, const uint8_t *src) = 0;
+  virtual bool writeSectors(uint32_t block, const uint8_t *src, size_t ns) = 0;
+};
@@ -0,0 +1,136 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mfm_impl.h"
+
+// Compare the generic encoder and decoder, which check the encoding, flux form
+// and sector size as they go, with the versions specialized for one of each.
+// Both must produce the same flux and decode the same data; the time each
+// takes per track is printed.
+
+enum { max_sectors = 26 };
+enum { max_flux = 200000 };
+enum { repeat = 100 };
+
+uint8_t sectors[max_sectors * 512], decoded[max_sectors * 512];
+uint8_t validity[max_sectors];
+uint8_t flux_generic[max_flux], flux_special[max_flux];
+
+typedef struct {
+  const char *name;
+  const mfm_io_settings_t *settings;
+  size_t n_sectors;
+  uint8_t n;
+  bool compact;
+  size_t (*encode_track)(mfm_io_t *io);
+  size_t (*decode_track)(mfm_io_t *io);
+} codec_case_t;
+
+static const codec_case_t cases[] = {
+    {"MFM 18x512", &standard_mfm, 18, 2, false, encode_track_mfm_512,
+     decode_track_mfm_512},
+    {"MFM 18x512 compact", &standard_mfm, 18, 2, true,
+     encode_track_mfm_compact_512, decode_track_mfm_compact_512},
+    {"FM 26x128", &standard_fm, 26, 0, false, encode_track_fm_128,
+     decode_track_fm_128},
+    {"FM 26x128 compact", &standard_fm, 26, 0, true, encode_track_fm_compact_128,
+     decode_track_fm_compact_128},
+};
+
+static void init_io(mfm_io_t *io, const codec_case_t *c, uint8_t *flux) {
+  *io = (mfm_io_t){
+      .encode_compact = c->compact,
+      .decode_compact = c->compact,
+      .T2_max = c->compact ? 5 : 5 * 24 / 2,
+      .T3_max = c->compact ? 7 : 7 * 24 / 2,
+      .T1_nom = c->compact ? 2 : 24,
+      .pulses = flux,
+      .n_pulses = c->compact ? max_flux / 8 : max_flux,
+      .sectors = sectors,
+      .n_sectors = c->n_sectors,
+      .sector_validity = validity,
+      .n = c->n,
+      .settings = c->settings,
+  };
+}
+
+static double seconds_since(clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC / repeat;
+}
+
+static double time_encode(const codec_case_t *c,
+                          size_t (*encode)(mfm_io_t *io), uint8_t *flux) {
+  clock_t start = clock();
+  for (int i = 0; i < repeat; i++) {
+    mfm_io_t io;
+    init_io(&io, c, flux);
+    encode(&io);
+  }
+  return seconds_since(start);
+}
+
+// Decode the flux, returning the time taken or a negative number if the
+// data doesn't match
+static double time_decode(const codec_case_t *c,
+                          size_t (*decode)(mfm_io_t *io), uint8_t *flux,
+                          size_t n_flux) {
+  clock_t start = clock();
+  for (int i = 0; i < repeat; i++) {
+    mfm_io_t io;
+    init_io(&io, c, flux);
+    io.n_pulses = c->compact ? n_flux * 8 : n_flux;
+    io.sectors = decoded;
+    memset(validity, 0, sizeof(validity));
+    decode(&io);
+  }
+  double t = seconds_since(start);
+  size_t n_bytes = c->n_sectors * (128 << c->n);
+  for (size_t i = 0; i < c->n_sectors; i++) {
+    if (!validity[i]) {
+      return -1;
+    }
+  }
+  return memcmp(decoded, sectors, n_bytes) ? -1 : t;
+}
+
+int main() {
+  int failures = 0;
+  for (size_t i = 0; i < sizeof(sectors); i++) {
+    sectors[i] = rand();
+  }
+
+  for (size_t ci = 0; ci < sizeof(cases) / sizeof(cases[0]); ci++) {
+    const codec_case_t *c = &cases[ci];
+    mfm_io_t generic, special;
+    init_io(&generic, c, flux_generic);
+    init_io(&special, c, flux_special);
+    size_t n_generic = encode_track_mfm(&generic);
+    size_t n_special = c->encode_track(&special);
+    if (n_generic != n_special ||
+        memcmp(flux_generic, flux_special, generic.n_pulses)) {
+      printf("%s: specialized encoder output differs\n", c->name);
+      failures++;
+    }
+
+    double t_generic = time_encode(c, encode_track_mfm, flux_generic);
+    double t_special = time_encode(c, c->encode_track, flux_special);
+    printf("%-20s encode %6.0fus generic, %6.0fus specialized (%.1fx)\n",
+           c->name, t_generic * 1e6, t_special * 1e6, t_generic / t_special);
+
+    size_t n_flux = c->compact ? generic.n_pulses : n_generic;
+    t_generic = time_decode(c, decode_track_mfm, flux_generic, n_flux);
+    t_special = time_decode(c, c->decode_track, flux_special, n_flux);
+    if (t_generic < 0 || t_special < 0) {
+      printf("%s: decode failed\n", c->name);
+      failures++;
+      continue;
+    }
+    printf("%-20s decode %6.0fus generic, %6.0fus specialized (%.1fx)\n",
+           c->name, t_generic * 1e6, t_special * 1e6, t_generic / t_special);
+  }
+
+  printf("%d codec mismatches\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "flux_capture.h"
+#include "mfm_impl.h"
+
+// Write to the track of an emulated drive the way mfm_emu does: flux from the
+// encoder is turned into the capture counter values the PIO program would
+// latch, converted back into compact flux over the existing track, and then
+// the track is decoded again.
+
+enum { sector_count = 18 };
+enum { block_size = 512 };
+enum { track_bits = 200000 }; // 300RPM, 1us bitcells
+// the capture counter runs at 125MHz / 3; 1us bitcells are 41.67 counts
+static const double cell_counts = 125. / 3;
+
+uint8_t track[track_bits / 8];
+uint8_t flux[track_bits];
+uint8_t expected[sector_count * block_size];
+uint8_t track_buf[sector_count * block_size];
+uint8_t validity[sector_count];
+size_t sector_pos[sector_count];
+
+static void init_io(mfm_io_t *io) {
+  *io = (mfm_io_t){
+      .T1_nom = 1,
+      .T2_max = 2,
+      .T3_max = 3,
+      .pulses = flux,
+      .n_pulses = sizeof(flux),
+      .sectors = track_buf,
+      .sector_validity = validity,
+      .n_sectors = sector_count,
+      .n = 2,
+      .settings = &standard_mfm,
+  };
+}
+
+// decode the compact track, returning the number of good sectors that match
+// the expected data
+static size_t decode_track(void) {
+  mfm_io_t io;
+  init_io(&io);
+  io.decode_compact = true;
+  io.pulses = track;
+  io.n_pulses = track_bits;
+  io.T1_nom = 2;
+  io.T2_max = 5;
+  io.T3_max = 7;
+  io.sector_pos = sector_pos;
+  memset(validity, 0, sizeof(validity));
+  decode_track_mfm(&io);
+  size_t good = 0;
+  for (size_t i = 0; i < sector_count; i++) {
+    good += validity[i] && !memcmp(track_buf + i * block_size,
+                                   expected + i * block_size, block_size);
+  }
+  return good;
+}
+
+// Play `n` flux intervals (in bitcells) to the capture code as a controller
+// whose clock is off by `ppm` and whose flux has some random jitter. Samples
+// are delivered in small batches, as they are when draining the DMA ring.
+static size_t write_flux(size_t start_bit, size_t n, int ppm) {
+  flux_capture_t fc;
+  flux_capture_start(&fc, track, track_bits, start_bit,
+                     (uint32_t)(cell_counts * 256 + .5));
+  uint16_t samples[64];
+  size_t n_samples = 0;
+  double t = 0;
+  uint16_t counter0 = rand();
+  for (size_t i = 0; i <= n; i++) {
+    if (i > 0) {
+      double jitter = (rand() % 1001 - 500) / 10000.; // up to 5%
+      t += flux[i - 1] * cell_counts * (1 + ppm * 1e-6) + jitter * cell_counts;
+    }
+    samples[n_samples++] = counter0 - (uint16_t)(uint32_t)(t + .5);
+    if (n_samples == sizeof(samples) / sizeof(samples[0]) || i == n) {
+      flux_capture_samples(&fc, samples, n_samples);
+      n_samples = 0;
+    }
+  }
+  return fc.written;
+}
+
+static void fill_random(uint8_t *buf, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    buf[i] = rand();
+  }
+}
+
+int main() {
+  int failures = 0;
+  static const int ppms[] = {-10000, -1000, 0, 1000, 10000};
+
+  for (size_t p = 0; p < sizeof(ppms) / sizeof(ppms[0]); p++) {
+    int ppm = ppms[p];
+    mfm_io_t io;
+
+    // the emulator starts out with a track of its own
+    fill_random(track_buf, sizeof(track_buf));
+    init_io(&io);
+    io.encode_compact = true;
+    io.pulses = track;
+    io.n_pulses = sizeof(track);
+    encode_track_mfm(&io);
+
+    // the controller formats the whole track, starting at the index
+    fill_random(expected, sizeof(expected));
+    memcpy(track_buf, expected, sizeof(expected));
+    init_io(&io);
+    size_t n = encode_track_mfm(&io);
+    size_t written = write_flux(0, n, ppm);
+    size_t good = decode_track();
+    printf("%+6dppm: track write of %zd bitcells, %zd good sectors\n", ppm,
+           written, good);
+    if (good != sector_count) {
+      failures++;
+    }
+
+    // then rewrites each sector's data field in place
+    for (size_t i = 0; i < sector_count; i++) {
+      if (decode_track() != sector_count) {
+        break;
+      }
+      size_t pos = sector_pos[i];
+      fill_random(expected + i * block_size, block_size);
+      memcpy(track_buf, expected, sizeof(expected));
+      init_io(&io);
+      n = encode_sector_mfm(&io, i);
+      write_flux(pos - mfm_io_splice_lead(&io), n, ppm);
+    }
+    good = decode_track();
+    printf("%+6dppm: after rewriting each sector, %zd good sectors\n", ppm,
+           good);
+    if (good != sector_count) {
+      failures++;
+    }
+  }
+
+  printf("%d write failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,10 @@
+// The encoder as it is without lookup tables, for encode_check.c to compare
+// against
+#define MFM_IO_TABLE_ENCODE (0)
+#include "mfm_impl.h"
+
+size_t encode_track_bitwise(mfm_io_t *io) { return encode_track_mfm(io); }
+
+size_t encode_sector_bitwise(mfm_io_t *io, size_t sector) {
+  return encode_sector_mfm(io, sector);
+}
@@ -0,0 +1,115 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MFM_IO_TABLE_ENCODE (1)
+#include "mfm_impl.h"
+
+// Check that the table driven encoder produces exactly the same flux as the
+// bit by bit one in encode_bitwise.c, and time them both.
+
+size_t encode_track_bitwise(mfm_io_t *io);
+size_t encode_sector_bitwise(mfm_io_t *io, size_t sector);
+
+enum { max_sectors = 26 };
+enum { max_flux = 200000 };
+
+uint8_t sectors[max_sectors * 512];
+uint8_t flux_bitwise[max_flux], flux_table[max_flux];
+
+typedef struct {
+  const char *name;
+  const mfm_io_settings_t *settings;
+  size_t n_sectors;
+  uint8_t n;
+  bool compact;
+  uint16_t T1;
+  uint8_t interleave;
+} encode_case_t;
+
+static const encode_case_t cases[] = {
+    {"MFM 18x512", &standard_mfm, 18, 2, false, 1, 1},
+    {"MFM 18x512 at 24MHz", &standard_mfm, 18, 2, false, 24, 1},
+    {"MFM 18x512 compact", &standard_mfm, 18, 2, true, 1, 1},
+    {"MFM 9x512 interleave 3", &standard_mfm, 9, 2, false, 48, 3},
+    {"MFM 16x256", &standard_mfm, 16, 1, false, 24, 1},
+    {"FM 26x128", &standard_fm, 26, 0, false, 2, 1},
+    {"FM 26x128 compact", &standard_fm, 26, 0, true, 1, 1},
+};
+
+static void init_io(mfm_io_t *io, const encode_case_t *c, uint8_t *flux) {
+  *io = (mfm_io_t){
+      .encode_compact = c->compact,
+      .T1_nom = c->T1,
+      .pulses = flux,
+      .n_pulses = c->compact ? max_flux / 8 : max_flux,
+      .sectors = sectors,
+      .n_sectors = c->n_sectors,
+      .head = 1,
+      .cylinder = 17,
+      .n = c->n,
+      .interleave = c->interleave,
+      .settings = c->settings,
+  };
+}
+
+static bool same(const encode_case_t *c, const char *what,
+                 const mfm_io_t *bitwise, size_t n_bitwise,
+                 const mfm_io_t *table, size_t n_table) {
+  if (n_bitwise != n_table || bitwise->time != table->time ||
+      memcmp(flux_bitwise, flux_table, bitwise->n_pulses)) {
+    printf("%s: %s differs (%zd/%zd flux, time %zd/%zd)\n", c->name, what,
+           n_bitwise, n_table, bitwise->time, table->time);
+    return false;
+  }
+  return true;
+}
+
+static double time_encoder(const encode_case_t *c,
+                           size_t (*encode)(mfm_io_t *), uint8_t *flux) {
+  enum { repeat = 100 };
+  clock_t start = clock();
+  for (int i = 0; i < repeat; i++) {
+    mfm_io_t io;
+    init_io(&io, c, flux);
+    encode(&io);
+  }
+  return (double)(clock() - start) / CLOCKS_PER_SEC / repeat;
+}
+
+static size_t encode_track_table(mfm_io_t *io) { return encode_track_mfm(io); }
+
+int main() {
+  int failures = 0;
+  for (size_t i = 0; i < sizeof(sectors); i++) {
+    sectors[i] = rand();
+  }
+
+  for (size_t ci = 0; ci < sizeof(cases) / sizeof(cases[0]); ci++) {
+    const encode_case_t *c = &cases[ci];
+    mfm_io_t bitwise, table;
+    memset(flux_bitwise, 0xaa, sizeof(flux_bitwise));
+    memset(flux_table, 0xaa, sizeof(flux_table));
+
+    init_io(&bitwise, c, flux_bitwise);
+    init_io(&table, c, flux_table);
+    size_t n_bitwise = encode_track_bitwise(&bitwise);
+    size_t n_table = encode_track_mfm(&table);
+    failures += !same(c, "track", &bitwise, n_bitwise, &table, n_table);
+
+    init_io(&bitwise, c, flux_bitwise);
+    init_io(&table, c, flux_table);
+    n_bitwise = encode_sector_bitwise(&bitwise, 3);
+    n_table = encode_sector_mfm(&table, 3);
+    failures += !same(c, "sector", &bitwise, n_bitwise, &table, n_table);
+
+    double t_bitwise = time_encoder(c, encode_track_bitwise, flux_bitwise);
+    double t_table = time_encoder(c, encode_track_table, flux_table);
+    printf("%-24s %6.0fus bit by bit, %6.0fus with tables (%.1fx)\n", c->name,
+           t_bitwise * 1e6, t_table * 1e6, t_bitwise / t_table);
+  }
+
+  printf("%d encoder mismatches\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,194 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mfm_impl.h"
+
+// Check that sectors which fail their CRC check on each revolution are
+// rebuilt from several revolutions of noisy flux, by a bit search of two
+// copies or a vote of three, and compare how many revolutions it takes to
+// read a whole noisy track with and without them.
+
+enum { sector_count = 18 };
+enum { max_flux = 200000 };
+enum { T1 = 24 }; // flux units per half bitcell
+
+uint8_t clean_flux[max_flux], flux[max_flux];
+size_t n_flux;
+uint8_t expected[sector_count * 512];
+uint8_t track_buf[sector_count * 512];
+uint8_t validity[sector_count];
+uint8_t candidates[sector_count * (1 + mfm_io_n_candidates * (512 + 2))];
+size_t sector_pos[sector_count];
+
+static int failures;
+
+static void check(bool ok, const char *what) {
+  printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok) {
+    failures++;
+  }
+}
+
+static void init_io(mfm_io_t *io, uint8_t *pulses, size_t n_pulses) {
+  *io = (mfm_io_t){
+      .T2_max = 5 * T1 / 2,
+      .T3_max = 7 * T1 / 2,
+      .T1_nom = T1,
+      .pulses = pulses,
+      .n_pulses = n_pulses,
+      .sectors = track_buf,
+      .n_sectors = sector_count,
+      .sector_validity = validity,
+      .sector_pos = sector_pos,
+      .n = 2,
+      .cylinder = 17,
+      .settings = &standard_mfm,
+  };
+}
+
+static void encode(void) {
+  mfm_io_t io;
+  init_io(&io, clean_flux, max_flux);
+  memcpy(track_buf, expected, sizeof(expected));
+  n_flux = encode_track_mfm(&io);
+
+  // find where each sector's data is
+  init_io(&io, clean_flux, n_flux);
+  memset(validity, 0, sizeof(validity));
+  decode_track_mfm(&io);
+}
+
+// Move `count` flux transitions in sector r's data field by one half bitcell,
+// each of which reads as a bit or two wrong
+static void add_noise(size_t r, int count) {
+  size_t start = sector_pos[r] + 16, span = 2500;
+  while (count > 0) {
+    size_t i = start + rand() % span;
+    if (flux[i] <= 3 * T1 && flux[i + 1] >= 3 * T1) {
+      flux[i] += T1;
+      flux[i + 1] -= T1;
+      count--;
+    }
+  }
+}
+
+// Decode a noisy revolution, returning the number of sectors that are valid
+// and match the expected data. Sectors that are valid but wrong are failures.
+static size_t decode(bool fusion, bool clear) {
+  mfm_io_t io;
+  init_io(&io, flux, n_flux);
+  io.sector_pos = NULL;
+  if (fusion) {
+    io.candidates = candidates;
+  }
+  if (clear) {
+    memset(validity, 0, sizeof(validity));
+    memset(candidates, 0, sizeof(candidates));
+  }
+  decode_track_mfm(&io);
+  size_t good = 0;
+  for (size_t i = 0; i < sector_count; i++) {
+    if (!validity[i]) {
+      continue;
+    }
+    if (memcmp(track_buf + i * 512, expected + i * 512, 512)) {
+      printf("sector %zd marked %d but wrong\n", i, validity[i]);
+      failures++;
+    } else {
+      good++;
+    }
+  }
+  return good;
+}
+
+static void check_layout(void) {
+  check(sizeof(candidates) == mfm_io_candidates_size(sector_count, 2),
+        "candidate buffer size");
+  memcpy(flux, clean_flux, n_flux);
+  bool ok = decode(true, true) == sector_count;
+  for (size_t i = 0; i < sector_count; i++) {
+    ok = ok && validity[i] == mfm_io_sector_read;
+  }
+  check(ok, "clean track reads with every sector marked read");
+}
+
+static void check_search(void) {
+  memcpy(flux, clean_flux, n_flux);
+  add_noise(3, 1);
+  size_t good = decode(true, true);
+  check(good == sector_count - 1 && !validity[3], "one noisy copy is bad");
+
+  memcpy(flux, clean_flux, n_flux);
+  add_noise(3, 1);
+  good = decode(true, false);
+  check(good == sector_count && validity[3] == mfm_io_sector_search,
+        "two noisy copies rebuilt by a bit search");
+}
+
+static void check_vote(bool fusion, const char *what) {
+  size_t good = 0;
+  for (int rev = 0; rev < 3; rev++) {
+    memcpy(flux, clean_flux, n_flux);
+    // too many differences between any two copies to search
+    add_noise(5, 8);
+    good = decode(fusion, rev == 0);
+  }
+  check(fusion ? good == sector_count && validity[5] == mfm_io_sector_voted
+               : good == sector_count - 1,
+        what);
+}
+
+// Revolutions to read every sector of a track where each revolution has
+// several noisy sectors, or 0 if it wasn't read in max_revs
+static int revolutions(bool fusion, int max_revs, unsigned seed) {
+  srand(seed);
+  for (int rev = 0; rev < max_revs; rev++) {
+    memcpy(flux, clean_flux, n_flux);
+    // a few weak sectors that read badly most of the time
+    for (size_t r = 0; r < 6; r++) {
+      if (rand() % 8) {
+        add_noise(r * 3, 1 + rand() % 3);
+      }
+    }
+    if (decode(fusion, rev == 0) == sector_count) {
+      return rev + 1;
+    }
+  }
+  return 0;
+}
+
+static void check_noisy_track(void) {
+  enum { trials = 50, max_revs = 20 };
+  int blind = 0, fused = 0, blind_fail = 0, fused_fail = 0;
+  for (int i = 0; i < trials; i++) {
+    int n = revolutions(false, max_revs, i);
+    blind += n ? n : max_revs;
+    blind_fail += !n;
+    n = revolutions(true, max_revs, i);
+    fused += n ? n : max_revs;
+    fused_fail += !n;
+  }
+  printf("revolutions per track: retry %.1f (%d unread), fusion %.1f (%d "
+         "unread)\n",
+         (double)blind / trials, blind_fail, (double)fused / trials,
+         fused_fail);
+  check(fused < blind && fused_fail == 0,
+        "fusion reads noisy tracks in fewer revolutions");
+}
+
+int main() {
+  for (size_t i = 0; i < sizeof(expected); i++) {
+    expected[i] = rand();
+  }
+  encode();
+
+  check_layout();
+  check_search();
+  check_vote(false, "three noisy copies without fusion stay bad");
+  check_vote(true, "three noisy copies rebuilt by a vote");
+  check_noisy_track();
+
+  printf("%d fusion failures\n", failures);
+  return failures != 0;
+}
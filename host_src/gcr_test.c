@@ -0,0 +1,312 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gcr_impl.h"
+
+// Check the Apple II 6-and-2 GCR codec: its tables, a known data field, whole
+// tracks round tripped in both flux forms, and hand made nibble streams with
+// damaged fields and odd bit alignments.
+
+enum { sector_count = 16 };
+enum { track_bits = 51200 }; // 300RPM, 4us bitcells
+
+uint8_t flux[track_bits];
+uint8_t expected[sector_count * gcr_io_sector_size];
+uint8_t track_buf[sector_count * gcr_io_sector_size];
+uint8_t validity[sector_count];
+uint8_t track_read, volume_read;
+
+static int failures;
+
+static void check(bool ok, const char *what) {
+  printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok) {
+    failures++;
+  }
+}
+
+static void init_io(gcr_io_t *io, bool compact) {
+  *io = (gcr_io_t){
+      .encode_compact = compact,
+      .decode_compact = compact,
+      .T1_nom = 1,
+      .T1_max = 1,
+      .T2_max = 2,
+      .pulses = flux,
+      .n_pulses = compact ? track_bits : sizeof(flux),
+      .sectors = track_buf,
+      .n_sectors = sector_count,
+      .sector_validity = validity,
+      .volume = 254,
+      .track = 17,
+      .track_ptr = &track_read,
+      .volume_ptr = &volume_read,
+  };
+}
+
+// decode the flux in place, returning the number of good sectors that match
+// the expected data
+static size_t decode(gcr_io_t *io, size_t n_flux) {
+  io->n_pulses = n_flux;
+  io->sectors = track_buf;
+  memset(track_buf, 0, sizeof(track_buf));
+  memset(validity, 0, sizeof(validity));
+  decode_track_gcr(io);
+  size_t good = 0;
+  for (size_t i = 0; i < sector_count; i++) {
+    good += validity[i] && !memcmp(track_buf + i * gcr_io_sector_size,
+                                   expected + i * gcr_io_sector_size,
+                                   gcr_io_sector_size);
+  }
+  return good;
+}
+
+static void check_tables(void) {
+  bool ok = true;
+  for (int v = 0; v < 64; v++) {
+    uint8_t nibble = gcr_io_encode_62[v];
+    // the top bit is set, there are never more than two 0 bits in a row, and
+    // the reserved nibbles of the prologues & epilogues are not used
+    ok = ok && (nibble & 0x80);
+    for (int i = 0; i < 6; i++) {
+      ok = ok && ((nibble >> i) & 7) != 0;
+    }
+    ok = ok && nibble != 0xd5 && nibble != 0xaa;
+    ok = ok && gcr_io_decode_62[nibble & 0x7f] == v;
+  }
+  int n_data = 0;
+  for (int i = 0; i < 128; i++) {
+    n_data += gcr_io_decode_62[i] != 0xff;
+  }
+  check(ok && n_data == 64, "encode and decode tables are inverses");
+}
+
+// Encode one data field to compact flux and read its nibbles back. The
+// epilogue follows, because the last nibble isn't complete until the 1 bit
+// after it is read.
+static void data_field_nibbles(const uint8_t *sector, uint8_t *nibbles) {
+  gcr_io_t io;
+  init_io(&io, true);
+  gcr_io_put_data(&io, true, sector);
+  gcr_io_put_nibbles(&io, true, gcr_io_epilogue, sizeof(gcr_io_epilogue));
+  io.n_pulses = io.pos;
+  io.pos = 0;
+  io.latch = 0;
+  for (size_t i = 0; i <= gcr_io_data_nibbles; i++) {
+    nibbles[i] = gcr_io_read_nibble(&io, true);
+  }
+}
+
+static void check_data_field(void) {
+  uint8_t sector[gcr_io_sector_size] = {0};
+  uint8_t nibbles[gcr_io_data_nibbles + 1];
+
+  data_field_nibbles(sector, nibbles);
+  bool ok = true;
+  for (size_t i = 0; i <= gcr_io_data_nibbles; i++) {
+    ok = ok && nibbles[i] == 0x96;
+  }
+  check(ok, "empty sector is all 96 nibbles");
+
+  // The low bits of byte 0, swapped, are in the first nibble written, and the
+  // next nibble undoes the XOR
+  sector[0] = 0x01;
+  data_field_nibbles(sector, nibbles);
+  check(nibbles[0] == 0x9a && nibbles[1] == 0x9a && nibbles[2] == 0x96 &&
+            nibbles[gcr_io_data_nibbles] == 0x96,
+        "low bits of byte 0 are in the first nibble");
+
+  // byte 86 shares the first nibble, 2 bits up
+  sector[0] = 0;
+  sector[86] = 0x02;
+  data_field_nibbles(sector, nibbles);
+  check(nibbles[0] == gcr_io_encode_62[0x04], "byte 86 is in the first nibble");
+}
+
+// The sectors must fit in a track, leaving some room for drive speed variation
+static void check_track_length(void) {
+  gcr_io_t io;
+  init_io(&io, true);
+  memcpy(track_buf, expected, sizeof(expected));
+  size_t bits = encode_track_gcr(&io);
+  char buf[80];
+  snprintf(buf, sizeof(buf), "track of %zd bitcells fits in %d", bits,
+           track_bits);
+  check(bits <= track_bits * 99 / 100, buf);
+}
+
+static void check_round_trip(bool compact, const uint8_t *map,
+                             const char *what) {
+  gcr_io_t io;
+  init_io(&io, compact);
+  io.sector_map = map;
+  memcpy(track_buf, expected, sizeof(expected));
+  size_t n = encode_track_gcr(&io);
+  init_io(&io, compact);
+  io.sector_map = map;
+  track_read = volume_read = 0;
+  size_t good = decode(&io, n);
+  char buf[80];
+  snprintf(buf, sizeof(buf), "%s: %zd good sectors", what, good);
+  check(good == sector_count && track_read == 17 && volume_read == 254, buf);
+}
+
+// Pulses with random jitter of up to 30% of a bitcell, to a decoder whose
+// bitcell is 32 flux units long
+static void check_jitter(void) {
+  gcr_io_t io;
+  init_io(&io, false);
+  memcpy(track_buf, expected, sizeof(expected));
+  size_t n = encode_track_gcr(&io);
+  for (size_t i = 0; i < n; i++) {
+    flux[i] = flux[i] * 32 + rand() % 19 - 9;
+  }
+  init_io(&io, false);
+  io.T1_nom = 32;
+  io.T1_max = 48;
+  io.T2_max = 80;
+  check(decode(&io, n) == sector_count, "pulses with jitter");
+}
+
+// Pulses counted at 24MHz and clipped to 8 bits, with the timings
+// Adafruit_FloppyBase::decode_track_gcr uses
+static void check_clipped(void) {
+  gcr_io_t io;
+  init_io(&io, false);
+  memcpy(track_buf, expected, sizeof(expected));
+  size_t n = encode_track_gcr(&io);
+  for (size_t i = 0; i < n; i++) {
+    int counts = flux[i] * 96 + rand() % 41 - 20;
+    flux[i] = counts > 255 ? 255 : counts;
+  }
+  init_io(&io, false);
+  io.T1_nom = 96;
+  io.T1_max = 144;
+  io.T2_max = 240;
+  check(decode(&io, n) == sector_count, "24MHz pulses clipped to 8 bits");
+}
+
+// A hand made track, written one piece at a time in compact form
+static gcr_io_t stream;
+
+static void stream_start(size_t skip_bits) {
+  init_io(&stream, true);
+  memset(flux, 0, sizeof(flux));
+  stream.pos = skip_bits;
+  gcr_io_put_sync(&stream, true, 8);
+}
+
+static void stream_address(uint8_t sector, uint8_t checksum_error) {
+  gcr_io_put_nibbles(&stream, true, gcr_io_address_prologue, 3);
+  gcr_io_put_44(&stream, true, 254);
+  gcr_io_put_44(&stream, true, 17);
+  gcr_io_put_44(&stream, true, sector);
+  gcr_io_put_44(&stream, true, 254 ^ 17 ^ sector ^ checksum_error);
+  gcr_io_put_nibbles(&stream, true, gcr_io_epilogue, 3);
+  gcr_io_put_sync(&stream, true, 5);
+}
+
+static void stream_data(uint8_t sector) {
+  gcr_io_put_nibbles(&stream, true, gcr_io_data_prologue, 3);
+  gcr_io_put_data(&stream, true, expected + sector * gcr_io_sector_size);
+  gcr_io_put_nibbles(&stream, true, gcr_io_epilogue, 3);
+  gcr_io_put_sync(&stream, true, 12);
+}
+
+static size_t stream_decode(void) {
+  size_t n = stream.pos;
+  gcr_io_t io;
+  init_io(&io, true);
+  decode(&io, n);
+  size_t valid = 0;
+  for (size_t i = 0; i < sector_count; i++) {
+    valid += validity[i];
+  }
+  return valid;
+}
+
+static void check_streams(void) {
+  // the flux starts partway into a nibble
+  bool ok = true;
+  for (size_t skip = 0; skip < 10; skip++) {
+    stream_start(skip);
+    stream_address(3, 0);
+    stream_data(3);
+    ok = ok && stream_decode() == 1 && validity[3];
+  }
+  check(ok, "self-sync from every bit alignment");
+
+  stream_start(0);
+  stream_address(4, 1);
+  stream_data(4);
+  stream_address(5, 0);
+  stream_data(5);
+  check(stream_decode() == 1 && validity[5], "address field checksum error");
+
+  stream_start(0);
+  stream_address(6, 0);
+  size_t data_start = stream.pos;
+  stream_data(6);
+  // turn a nibble in the middle of the data into the reserved d5
+  stream.pos = data_start + 8 * 100;
+  gcr_io_put_nibble(&stream, true, 0xd5);
+  stream.pos = data_start + 8 * (3 + 343 + 3) + 10 * 12;
+  stream_address(7, 0);
+  stream_data(7);
+  check(stream_decode() == 1 && validity[7], "invalid nibble in data field");
+
+  stream_start(0);
+  stream_address(8, 0);
+  data_start = stream.pos;
+  stream_data(8);
+  // replace a data nibble with another valid one, breaking the checksum
+  stream.pos = data_start + 8 * 100;
+  gcr_io_put_nibble(&stream, true, 0xff);
+  stream.pos = data_start + 8 * (3 + 343 + 3) + 10 * 12;
+  check(stream_decode() == 0, "data field checksum error");
+
+  // an address field whose data field never comes
+  stream_start(0);
+  stream_address(9, 0);
+  gcr_io_put_sync(&stream, true, gcr_io_max_data_search);
+  stream_address(10, 0);
+  stream_data(10);
+  check(stream_decode() == 1 && validity[10], "missing data field");
+
+  // extra 0 bits between nibbles, as a drive running slow might give
+  stream_start(0);
+  for (size_t i = 0; i < 3; i++) {
+    gcr_io_put_nibble(&stream, true, gcr_io_address_prologue[i]);
+    gcr_io_put_bits(&stream, true, 0, 1);
+  }
+  gcr_io_put_44(&stream, true, 254);
+  gcr_io_put_bits(&stream, true, 0, 2);
+  gcr_io_put_44(&stream, true, 17);
+  gcr_io_put_bits(&stream, true, 0, 1);
+  gcr_io_put_44(&stream, true, 11);
+  gcr_io_put_44(&stream, true, 254 ^ 17 ^ 11);
+  gcr_io_put_sync(&stream, true, 5);
+  stream_data(11);
+  check(stream_decode() == 1 && validity[11], "0 bits between nibbles");
+}
+
+int main() {
+  for (size_t i = 0; i < sizeof(expected); i++) {
+    expected[i] = rand();
+  }
+
+  check_tables();
+  check_data_field();
+  check_track_length();
+  check_round_trip(false, NULL, "pulses");
+  check_round_trip(true, NULL, "compact");
+  check_round_trip(false, gcr_io_dos_order, "pulses, DOS 3.3 order");
+  check_round_trip(true, gcr_io_prodos_order, "compact, ProDOS order");
+  check_jitter();
+  check_clipped();
+  check_streams();
+
+  printf("%d GCR failures\n", failures);
+  return failures != 0;
+}
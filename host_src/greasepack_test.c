@@ -0,0 +1,315 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "greasepack.h"
+
+// Check the greaseweazle flux format converters: known encodings, bulk
+// converters giving the same results as one value at a time for random
+// flux, buffers that fill up and damaged streams, the per-pulse steps the
+// SAMD51 interrupts take, and the time they take.
+
+enum { n_values = 100000 };
+enum { max_stream = n_values * 6 + 1 };
+enum { repeat = 20 };
+
+uint16_t values[n_values], values_out[n_values], values_ref[n_values];
+uint8_t raw[n_values], raw_out[n_values];
+uint8_t stream[max_stream], stream_ref[max_stream];
+
+static int failures;
+
+static void check(bool ok, const char *what) {
+  printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok) {
+    failures++;
+  }
+}
+
+// Flux like MFM: nearly all short, a few long and very long, and now and then
+// any short value at all
+static unsigned random_value(void) {
+  int r = rand() % 1000;
+  if (r < 950) {
+    // 2, 3 or 4us at 24MHz, with jitter
+    return 48 * (2 + rand() % 3) / 2 + rand() % 13 - 6;
+  } else if (r < 990) {
+    return 1 + rand() % 249;
+  } else if (r < 998) {
+    return cutoff_1byte + rand() % (cutoff_2byte - cutoff_1byte);
+  }
+  return cutoff_2byte + rand() % 100000;
+}
+
+static void random_values(void) {
+  for (size_t i = 0; i < n_values; i++) {
+    unsigned value = random_value();
+    values[i] = value > 0xffff ? 0xffff : value;
+  }
+}
+
+static size_t pack_each(uint8_t *buf, uint8_t *end, const uint16_t *v,
+                        size_t n) {
+  uint8_t *p = buf;
+  for (size_t i = 0; i < n; i++) {
+    p = greasepack(p, end, v[i]);
+  }
+  return p - buf;
+}
+
+static void check_known(void) {
+  static const struct {
+    unsigned value;
+    uint8_t bytes[6];
+    size_t n;
+  } cases[] = {
+      {1, {1}, 1},
+      {249, {249}, 1},
+      {250, {250, 1}, 2},
+      {504, {250, 255}, 2},
+      {505, {251, 1}, 2},
+      {1524, {254, 255}, 2},
+      {1525, {255, 2, 1 | (1525 << 1 & 255), 1 | (1525 >> 6 & 255), 1, 1}, 6},
+      {cutoff_6byte, {255, 2, 255, 255, 255, 255}, 6},
+  };
+  bool ok = true;
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    uint8_t buf[8];
+    uint8_t *end = greasepack(buf, buf + sizeof(buf), cases[i].value);
+    ok = ok && (size_t)(end - buf) == cases[i].n &&
+         !memcmp(buf, cases[i].bytes, cases[i].n);
+    uint8_t *p = buf;
+    ok = ok && greaseunpack(&p, end, true) == cases[i].value && p == end;
+  }
+  check(ok, "known values pack and unpack");
+
+  // an Index op is skipped
+  uint8_t ops[] = {255, 1, 1, 1, 1, 1, 17};
+  uint8_t *p = ops;
+  check(greaseunpack(&p, ops + sizeof(ops), true) == 17, "index op skipped");
+}
+
+static void check_round_trip(void) {
+  bool ok = true;
+  for (int trial = 0; trial < 20; trial++) {
+    random_values();
+    size_t n_bulk =
+        greasepack_u16(stream, stream + max_stream, values, n_values) - stream;
+    size_t n_each = pack_each(stream_ref, stream_ref + max_stream, values,
+                              n_values);
+    ok = ok && n_bulk == n_each && !memcmp(stream, stream_ref, n_bulk);
+
+    uint8_t *p = stream;
+    size_t n = greaseunpack_u16(values_out, n_values, &p, stream + n_bulk,
+                                true);
+    ok = ok && n == n_values && p == stream + n_bulk &&
+         !memcmp(values, values_out, sizeof(values));
+  }
+  check(ok, "16-bit values: bulk pack matches, round trip");
+
+  ok = true;
+  for (int trial = 0; trial < 20; trial++) {
+    random_values();
+    for (size_t i = 0; i < n_values; i++) {
+      raw[i] = values[i] > 255 ? 255 : values[i];
+      values_ref[i] = raw[i];
+    }
+    size_t n_bulk =
+        greasepack_u8(stream, stream + max_stream, raw, n_values) - stream;
+    size_t n_each = pack_each(stream_ref, stream_ref + max_stream, values_ref,
+                              n_values);
+    ok = ok && n_bulk == n_each && !memcmp(stream, stream_ref, n_bulk);
+
+    uint8_t *p = stream;
+    size_t n = greaseunpack_u8(raw_out, n_values, &p, stream + n_bulk);
+    ok = ok && n == n_values && !memcmp(raw, raw_out, sizeof(raw));
+
+    // raw bytes unpack as they are
+    p = raw;
+    n = greaseunpack_u16(values_out, n_values, &p, raw + n_values, false);
+    ok = ok && n == n_values && !memcmp(values_ref, values_out, sizeof(values));
+  }
+  check(ok, "8-bit values: bulk pack matches, round trip");
+}
+
+// Buffers too small for the whole flux fill up just as one value at a time
+static void check_full(void) {
+  bool ok = true;
+  random_values();
+  for (int trial = 0; trial < 2000; trial++) {
+    size_t size = rand() % 200;
+    size_t n = rand() % 200;
+    memset(stream, 0xaa, 256);
+    memset(stream_ref, 0xaa, 256);
+    size_t n_bulk = greasepack_u16(stream, stream + size, values, n) - stream;
+    size_t n_each = pack_each(stream_ref, stream_ref + size, values, n);
+    ok = ok && n_bulk == n_each && !memcmp(stream, stream_ref, 256);
+
+    for (size_t i = 0; i < n; i++) {
+      raw[i] = values[i] > 255 ? 255 : values[i];
+      values_ref[i] = raw[i];
+    }
+    memset(stream, 0xaa, 256);
+    memset(stream_ref, 0xaa, 256);
+    n_bulk = greasepack_u8(stream, stream + size, raw, n) - stream;
+    n_each = pack_each(stream_ref, stream_ref + size, values_ref, n);
+    ok = ok && n_bulk == n_each && !memcmp(stream, stream_ref, 256);
+  }
+  check(ok, "full buffers");
+}
+
+// Random bytes, as from a damaged or truncated stream, unpack the same in
+// bulk as one value at a time, and never read past the end
+static void check_fuzz(void) {
+  bool ok = true;
+  for (int trial = 0; trial < 2000; trial++) {
+    size_t size = rand() % 300;
+    for (size_t i = 0; i < size; i++) {
+      // plenty of long value and op bytes
+      stream[i] = rand() % 4 ? rand() : 248 + rand() % 8;
+    }
+    uint8_t *end = stream + size;
+
+    size_t n_each = 0;
+    uint8_t *p = stream;
+    uint32_t value;
+    while (greaseunpack_one(&p, end, &value)) {
+      values_ref[n_each++] = value > 0xffff ? 0xffff : value;
+    }
+    ok = ok && p == end;
+
+    // in pieces of random sizes
+    size_t n_bulk = 0;
+    p = stream;
+    while (true) {
+      size_t n = greaseunpack_u16(values_out + n_bulk, 1 + rand() % 16, &p,
+                                  end, true);
+      if (!n) {
+        break;
+      }
+      n_bulk += n;
+    }
+    ok = ok && p == end && n_bulk == n_each &&
+         !memcmp(values_out, values_ref, n_each * sizeof(values_ref[0]));
+
+    p = stream;
+    n_bulk = greaseunpack_u8(raw_out, n_values, &p, end);
+    ok = ok && p == end && n_bulk == n_each;
+    for (size_t i = 0; i < n_bulk; i++) {
+      ok = ok && raw_out[i] == (values_ref[i] > 255 ? 255 : values_ref[i]);
+    }
+  }
+  check(ok, "damaged streams");
+}
+
+// The SAMD51 capture interrupt stores what the RP2040 capture loop does, and
+// its write interrupt plays it back, in both formats
+static void check_isr(bool store_greaseweazle, const char *what) {
+  enum { n = 5000, size = 8000 };
+  random_values();
+  bool ok = true;
+
+  // the RP2040 way
+  uint8_t *ptr = stream_ref, *end = stream_ref + size;
+  for (size_t i = 0; i < n; i++) {
+    if (store_greaseweazle) {
+      ptr = greasepack(ptr, end, values[i]);
+    } else if (ptr != end) {
+      *ptr++ = values[i] > 255 ? 255 : values[i];
+    }
+  }
+
+  uint32_t n_pulses = 0;
+  for (size_t i = 0; i < n; i++) {
+    greasepack_capture(stream, size, &n_pulses, values[i], store_greaseweazle);
+  }
+  ok = ok && n_pulses == (size_t)(ptr - stream_ref) &&
+       !memcmp(stream, stream_ref, n_pulses);
+
+  // write back what was captured: the first pulse is set up before the
+  // interrupt starts, and the interrupt runs once after the last pulse
+  uint32_t max_pulses = n_pulses;
+  size_t n_out = 0, n_extra = 0;
+  n_pulses = 0;
+  values_out[n_out++] =
+      greaseunpack_write(stream, max_pulses, &n_pulses, store_greaseweazle);
+  while (true) {
+    if (n_pulses < max_pulses) {
+      values_out[n_out++] = greaseunpack_write(stream, max_pulses, &n_pulses,
+                                               store_greaseweazle);
+    } else if (n_pulses > max_pulses) {
+      break;
+    } else {
+      n_pulses++;
+      n_extra++;
+    }
+  }
+  bool same = n_out <= n;
+  for (size_t i = 0; same && i < n_out; i++) {
+    unsigned v = values[i];
+    if (!store_greaseweazle && v > 255) {
+      v = 255;
+    }
+    same = values_out[i] == v;
+  }
+  ok = ok && same && n_extra == 1 &&
+       n_out == (store_greaseweazle ? n : max_pulses);
+  check(ok, what);
+}
+
+static double seconds_since(clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC / repeat;
+}
+
+static void bench(void) {
+  random_values();
+  size_t n_stream =
+      greasepack_u16(stream, stream + max_stream, values, n_values) - stream;
+
+  clock_t start = clock();
+  for (int i = 0; i < repeat; i++) {
+    pack_each(stream_ref, stream_ref + max_stream, values, n_values);
+  }
+  double t_pack_each = seconds_since(start);
+  start = clock();
+  for (int i = 0; i < repeat; i++) {
+    greasepack_u16(stream_ref, stream_ref + max_stream, values, n_values);
+  }
+  double t_pack = seconds_since(start);
+
+  start = clock();
+  for (int i = 0; i < repeat; i++) {
+    uint8_t *p = stream;
+    for (size_t j = 0; j < n_values; j++) {
+      values_out[j] = greaseunpack(&p, stream + n_stream, true);
+    }
+  }
+  double t_unpack_each = seconds_since(start);
+  start = clock();
+  for (int i = 0; i < repeat; i++) {
+    uint8_t *p = stream;
+    greaseunpack_u16(values_out, n_values, &p, stream + n_stream, true);
+  }
+  double t_unpack = seconds_since(start);
+
+  printf("pack   %6.0fus each, %6.0fus bulk per %d values\n",
+         t_pack_each * 1e6, t_pack * 1e6, n_values);
+  printf("unpack %6.0fus each, %6.0fus bulk per %d values\n",
+         t_unpack_each * 1e6, t_unpack * 1e6, n_values);
+  check(!memcmp(values, values_out, sizeof(values)),
+        "benchmarked flux unpacked");
+}
+
+int main() {
+  check_known();
+  check_round_trip();
+  check_full();
+  check_fuzz();
+  check_isr(true, "capture and write interrupts, greaseweazle format");
+  check_isr(false, "capture and write interrupts, raw bytes");
+  bench();
+
+  printf("%d greasepack failures\n", failures);
+  return failures != 0;
+}
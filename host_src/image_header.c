@@ -0,0 +1,184 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "image_header.h"
+
+// Read the headers of small IMD and HFE images built in memory, checking the
+// geometry found and that broken images are refused.
+
+static int failures;
+
+static void check(bool ok, const char *what) {
+  printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok) {
+    failures++;
+  }
+}
+
+static uint8_t image[16384];
+static size_t image_size;
+
+static size_t read_memory(void *context, uint32_t pos, uint8_t *buf,
+                          size_t len) {
+  if (pos >= image_size) {
+    return 0;
+  }
+  if (len > image_size - pos) {
+    len = image_size - pos;
+  }
+  memcpy(buf, image + pos, len);
+  return len;
+}
+
+static void put(const void *data, size_t len) {
+  memcpy(image + image_size, data, len);
+  image_size += len;
+}
+
+static void put_byte(uint8_t b) { put(&b, 1); }
+
+static void put_le16(uint16_t v) {
+  put_byte(v & 0xff);
+  put_byte(v >> 8);
+}
+
+enum { imd_sectors = 8 };
+
+// Sectors 1-8 two apart, with sector 1 at `place1`
+static void put_imd_track(uint8_t mode, uint8_t cylinder, uint8_t head,
+                          uint8_t n, int place1) {
+  static const uint8_t interleaved[imd_sectors] = {1, 5, 2, 6, 3, 7, 4, 8};
+  uint8_t hdr[5] = {mode, cylinder, head, imd_sectors, n};
+  put(hdr, sizeof(hdr));
+  for (int i = 0; i < imd_sectors; i++) {
+    put_byte(interleaved[(i - place1 + imd_sectors) % imd_sectors]);
+  }
+  for (int i = 0; i < imd_sectors; i++) {
+    // sector data and fill bytes by turns
+    if (i & 1) {
+      put_byte(2);
+      put_byte(0xe5);
+    } else {
+      put_byte(1);
+      memset(image + image_size, i, 128 << n);
+      image_size += 128 << n;
+    }
+  }
+}
+
+static void start_imd(void) {
+  image_size = 0;
+  const char comment[] = "IMD 1.18: 18/10/2026 12:00:00\r\ntest\r\n\x1a";
+  put(comment, sizeof(comment) - 1);
+}
+
+static bool open_imd(image_geometry_t *g) {
+  image_file_t f = {read_memory, NULL, 0};
+  return image_open_imd(&f, g, 36 * 512);
+}
+
+static void check_imd(void) {
+  image_geometry_t g;
+
+  // 8" single density: FM at 500kbps, 128 byte sectors
+  start_imd();
+  put_imd_track(0, 0, 0, 0, 0);
+  uint32_t cylinder1 = image_size;
+  put_imd_track(0, 1, 0, 0, 1);
+  bool ok = open_imd(&g);
+  check(ok && g.is_fm && g.bit_time_ns == 2000 && g.n == 0 &&
+            g.sectors == imd_sectors && g.cylinders == 2 && g.sides == 1,
+        "IMD FM geometry");
+  check(ok && g.interleave == 2 && g.cylinder_skew == 1 && g.head_skew == 0,
+        "IMD interleave and skew");
+  check(ok && g.track_offset[2] == cylinder1 && g.track_offset[1] == 0,
+        "IMD track offsets");
+
+  // the same rates in MFM have bitcells half as long
+  static const struct {
+    uint8_t mode;
+    bool is_fm;
+    uint16_t bit_time_ns;
+  } modes[] = {{0, true, 2000},  {1, true, 3333},  {2, true, 4000},
+               {3, false, 1000}, {4, false, 1667}, {5, false, 2000}};
+  ok = true;
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+    start_imd();
+    put_imd_track(modes[i].mode, 0, 0, 2, 0);
+    put_imd_track(modes[i].mode, 0, 1, 2, 0);
+    ok = ok && open_imd(&g) && g.is_fm == modes[i].is_fm &&
+         g.bit_time_ns == modes[i].bit_time_ns && g.sides == 2;
+  }
+  check(ok, "IMD bit time of each mode");
+
+  start_imd();
+  put_imd_track(0, 0, 0, 0, 0);
+  put_imd_track(3, 1, 0, 0, 0);
+  check(!open_imd(&g) && strstr(g.error, "different layout"),
+        "IMD mixing FM and MFM tracks refused");
+
+  start_imd();
+  size_t comment_size = image_size;
+  put_imd_track(5, 0, 0, 2, 0);
+  image_size = comment_size + 5 + 3;
+  check(!open_imd(&g) && strstr(g.error, "Truncated"),
+        "IMD truncated sector map refused");
+
+  start_imd();
+  check(!open_imd(&g) && strstr(g.error, "Empty"), "empty IMD refused");
+}
+
+static void start_hfe(uint8_t revision, uint8_t n_tracks, uint8_t n_sides,
+                      uint16_t bit_rate) {
+  image_size = 0;
+  memset(image, 0xff, sizeof(image));
+  put("HXCPICFE", 8);
+  put_byte(revision);
+  put_byte(n_tracks);
+  put_byte(n_sides);
+  put_byte(0); // track encoding
+  put_le16(bit_rate);
+  put_le16(300); // RPM
+  put_byte(0);   // interface mode
+  put_byte(1);
+  put_le16(1); // track list in block 1
+  image_size = 512;
+  for (int i = 0; i < n_tracks; i++) {
+    put_le16(2 + i * 25); // track data block
+    put_le16(12500);      // bytes of both sides
+  }
+}
+
+static void check_hfe(void) {
+  image_geometry_t g;
+  image_file_t f = {read_memory, NULL, 0};
+
+  start_hfe(0, 80, 2, 250);
+  bool ok = image_open_hfe(&f, &g);
+  check(ok && g.cylinders == 80 && g.sides == 2 && g.bit_time_ns == 2000 &&
+            !g.is_fm,
+        "HFE geometry");
+  check(ok && g.track_offset[0] == 1024 && g.track_offset[1] == 1024 &&
+            g.track_offset[2] == 1024 + 25 * 512 && g.track_len[159] == 12500,
+        "HFE track list");
+
+  start_hfe(1, 80, 2, 250);
+  check(!image_open_hfe(&f, &g), "HFE of another revision refused");
+
+  start_hfe(0, 80, 3, 250);
+  check(!image_open_hfe(&f, &g), "HFE with 3 sides refused");
+
+  start_hfe(0, 80, 2, 250);
+  image_size = 512 + 4 * 40;
+  check(!image_open_hfe(&f, &g) && strstr(g.error, "Truncated"),
+        "HFE truncated track list refused");
+}
+
+int main() {
+  check_imd();
+  check_hfe();
+
+  printf("%d image header failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,230 @@
+#include <Adafruit_Floppy.h>
+
+#include "mfm_impl.h"
+
+// Check Adafruit_MFM_Floppy::imageDisk against a simulated drive and disk: a
+// clean disk, a head that slips a cylinder partway through, which must not
+// put another cylinder's sectors in the image, and a disk whose sector
+// headers are numbered differently, which must still image normally.
+
+Stream Serial;
+
+enum { T1 = 24 }; // flux units per half bitcell
+enum { sector_count = MFM_IBMPC1440K_SECTORS_PER_TRACK };
+enum { cylinders = FLOPPY_IBMPC_HD_TRACKS };
+enum {
+  image_size = cylinders * FLOPPY_HEADS * sector_count * MFM_BYTES_PER_SECTOR
+};
+
+static uint8_t image[image_size], expected[image_size];
+static bool image_overrun;
+
+static int slip_at = -1;    // the cylinder where the head slips one further
+static int slip = 0;        // how far the head is from where it's thought to be
+static int numbering = 0;   // added to the cylinder in every sector header
+static int recalibrations;
+
+static int failures;
+
+static void check(bool ok, const char *what) {
+  printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok) {
+    failures++;
+  }
+}
+
+// The simulated drive. Only what Adafruit_MFM_Floppy uses does anything.
+
+Adafruit_FloppyBase::Adafruit_FloppyBase(int indexpin, int wrdatapin,
+                                         int wrgatepin, int rddatapin,
+                                         bool is_apple2) {}
+bool Adafruit_FloppyBase::begin(void) { return true; }
+void Adafruit_FloppyBase::end(void) {}
+void Adafruit_FloppyBase::soft_reset(void) {}
+uint32_t Adafruit_FloppyBase::getSampleFrequency(void) { return 24000000; }
+
+size_t Adafruit_FloppyBase::decode_track_mfm(
+    uint8_t *sectors, size_t n_sectors, uint8_t *sector_validity,
+    const uint8_t *pulses, size_t n_pulses, float nominal_bit_time_us,
+    bool clear_validity, uint8_t *logical_track, size_t *sector_positions,
+    uint8_t *candidates) {
+  if (clear_validity) {
+    memset(sector_validity, 0, n_sectors);
+  }
+  mfm_io_t io = {};
+  io.T2_max = 5 * T1 / 2;
+  io.T3_max = 7 * T1 / 2;
+  io.T1_nom = T1;
+  io.pulses = const_cast<uint8_t *>(pulses);
+  io.n_pulses = n_pulses;
+  io.sectors = sectors;
+  io.n_sectors = n_sectors;
+  io.n = 2;
+  io.head = get_side();
+  io.cylinder_ptr = logical_track;
+  io.sector_pos = sector_positions;
+  io.sector_validity = sector_validity;
+  return ::decode_track_mfm(&io);
+}
+
+size_t Adafruit_FloppyBase::encode_track_mfm(
+    const uint8_t *sectors, size_t n_sectors, uint8_t *pulses,
+    size_t max_pulses, float nominal_bit_time_us, uint8_t logical_track,
+    uint8_t interleave, uint8_t cylinder_skew, uint8_t head_skew) {
+  return 0;
+}
+
+size_t Adafruit_FloppyBase::encode_sector_mfm(const uint8_t *sector,
+                                              uint8_t *pulses,
+                                              size_t max_pulses,
+                                              float nominal_bit_time_us,
+                                              uint32_t *lead_counts) {
+  return 0;
+}
+
+void Adafruit_FloppyBase::sector_times(const uint8_t *pulses, size_t n_pulses,
+                                       const size_t *sector_positions,
+                                       size_t n_sectors, uint32_t *times) {}
+
+bool Adafruit_FloppyBase::write_track(uint8_t *pulses, size_t n_pulses,
+                                      bool store_greaseweazle, bool use_index,
+                                      uint32_t index_delay_us) {
+  return false;
+}
+
+// One revolution of the cylinder the head is really on
+size_t Adafruit_FloppyBase::capture_track(volatile uint8_t *pulses,
+                                          size_t max_pulses,
+                                          int32_t *falling_index_offset,
+                                          bool store_greaseweazle,
+                                          uint32_t capture_ms,
+                                          uint32_t index_wait_ms) {
+  int cylinder = track() + slip;
+  int head = get_side();
+  mfm_io_t io = {};
+  io.T2_max = 5 * T1 / 2;
+  io.T3_max = 7 * T1 / 2;
+  io.T1_nom = T1;
+  io.pulses = (uint8_t *)pulses;
+  io.n_pulses = max_pulses;
+  io.sectors = expected + (cylinder * FLOPPY_HEADS + head) * sector_count *
+                              MFM_BYTES_PER_SECTOR;
+  io.n_sectors = sector_count;
+  io.n = 2;
+  io.head = head;
+  io.cylinder = cylinder + numbering;
+  io.settings = &standard_mfm;
+  *falling_index_offset = 0;
+  return ::encode_track_mfm(&io);
+}
+
+Adafruit_Floppy::Adafruit_Floppy(int8_t densitypin, int8_t indexpin,
+                                 int8_t selectpin, int8_t motorpin,
+                                 int8_t directionpin, int8_t steppin,
+                                 int8_t wrdatapin, int8_t wrgatepin,
+                                 int8_t track0pin, int8_t protectpin,
+                                 int8_t rddatapin, int8_t sidepin,
+                                 int8_t readypin)
+    : Adafruit_FloppyBase(indexpin, wrdatapin, wrgatepin, rddatapin) {}
+void Adafruit_Floppy::end(void) {}
+void Adafruit_Floppy::soft_reset(void) {}
+void Adafruit_Floppy::select(bool selected) {}
+bool Adafruit_Floppy::spin_motor(bool motor_on) { return true; }
+bool Adafruit_Floppy::side(int head) {
+  _side = head;
+  return true;
+}
+int Adafruit_Floppy::track(void) { return _track; }
+int Adafruit_Floppy::get_side(void) { return _side; }
+bool Adafruit_Floppy::set_density(bool high_density) { return true; }
+bool Adafruit_Floppy::get_write_protect(void) { return false; }
+bool Adafruit_Floppy::get_track0_sense(void) { return _track + slip == 0; }
+bool Adafruit_Floppy::get_ready_sense(void) { return true; }
+seek_io_profile_t Adafruit_Floppy::get_seek_profile(void) const {
+  return seek_io_profile_35;
+}
+
+void Adafruit_Floppy::position_lost(void) {
+  seek_stats.position_errors++;
+  _track = -1;
+}
+
+bool Adafruit_Floppy::start_goto_track(int track_num) {
+  if (_track < 0) {
+    // found track 0 with the sensor, wherever the head was
+    recalibrations++;
+    slip = 0;
+    _track = 0;
+  }
+  if (track_num == slip_at && track_num != _track) {
+    slip_at = -1;
+    slip = 1;
+  }
+  _track = track_num;
+  return true;
+}
+
+bool Adafruit_Floppy::seek_done(void) { return true; }
+
+bool Adafruit_Floppy::goto_track(int track_num) {
+  return start_goto_track(track_num) && _track >= 0;
+}
+
+static bool image_sink(void *context, uint32_t offset, const uint8_t *data,
+                       size_t len) {
+  if (offset + len > sizeof(image)) {
+    image_overrun = true;
+    return false;
+  }
+  memcpy(image + offset, data, len);
+  return true;
+}
+
+static Adafruit_Floppy drive(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                             -1);
+static Adafruit_MFM_Floppy disk(&drive, IBMPC1440K);
+
+// Image the disk, returning the number of bad sectors or -1
+static int32_t image_disk(int slip_cylinder, int header_numbering) {
+  slip_at = slip_cylinder;
+  slip = 0;
+  numbering = header_numbering;
+  recalibrations = 0;
+  image_overrun = false;
+  memset(image, 0, sizeof(image));
+  drive.position_lost();
+  drive.seek_stats = {};
+  return disk.imageDisk(image_sink, nullptr, 0);
+}
+
+static bool image_good(int32_t bad) {
+  bool no_bad_sectors = true;
+  for (size_t i = 0; i < sizeof(disk.bad_sectors); i++) {
+    no_bad_sectors = no_bad_sectors && !disk.bad_sectors[i] &&
+                     !disk.repaired_sectors[i];
+  }
+  return bad == 0 && no_bad_sectors && !image_overrun &&
+         !memcmp(image, expected, sizeof(image));
+}
+
+int main() {
+  for (size_t i = 0; i < sizeof(expected); i++) {
+    expected[i] = rand();
+  }
+  disk.begin();
+
+  int32_t bad = image_disk(-1, 0);
+  check(image_good(bad) && drive.seek_stats.position_errors == 0,
+        "clean disk images in full");
+
+  bad = image_disk(40, 0);
+  check(image_good(bad) && drive.seek_stats.position_errors == 1 &&
+            recalibrations == 2,
+        "head slipping a cylinder is found and the track reread");
+
+  bad = image_disk(-1, 1);
+  check(image_good(bad), "disk with other cylinder numbers images in full");
+
+  printf("%d image failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,181 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mfm_impl.h"
+
+// A simulated controller reads a whole 1.44MB disk in order, with tracks laid
+// out using various interleaves and skews, and the time taken is reported in
+// revolutions per track. Each track is encoded and decoded again, which also
+// checks that every layout reads back correctly.
+
+enum { sector_count = 18 };
+enum { block_size = 512 };
+enum { cylinders = 80, heads = 2 };
+enum { track_bits = 200000 }; // 300RPM, 1us bitcells, so times are in us
+
+uint8_t flux[track_bits];
+uint8_t expected[sector_count * block_size];
+uint8_t track_buf[sector_count * block_size];
+uint8_t validity[sector_count];
+size_t sector_pos[sector_count];
+uint32_t sector_time[sector_count];
+
+typedef struct {
+  const char *name;
+  uint32_t sector_overhead; // from the end of a sector until the controller
+                            // is ready for the next one
+  uint32_t head_switch;     // extra time to switch to the other head
+  uint32_t step;            // extra time to step to the next cylinder & settle
+} controller_t;
+
+typedef struct {
+  uint8_t interleave, cylinder_skew, head_skew;
+} layout_t;
+
+// Where each sector's ID field starts and its data field ends, in bitcells
+// since the index
+typedef struct {
+  uint32_t id_start[sector_count], data_end[sector_count];
+} track_times_t;
+
+static void init_io(mfm_io_t *io, const layout_t *layout, int cylinder,
+                    int head) {
+  *io = (mfm_io_t){
+      .T1_nom = 1,
+      .T2_max = 2,
+      .T3_max = 3,
+      .pulses = flux,
+      .n_pulses = sizeof(flux),
+      .sectors = track_buf,
+      .n_sectors = sector_count,
+      .sector_validity = validity,
+      .sector_pos = sector_pos,
+      .head = head,
+      .cylinder = cylinder,
+      .n = 2,
+      .interleave = layout->interleave,
+      .cylinder_skew = layout->cylinder_skew,
+      .head_skew = layout->head_skew,
+      .settings = &standard_mfm,
+  };
+}
+
+// Encode the track and find its sectors by decoding it again. Returns false if
+// any sector does not read back.
+static bool locate_sectors(const layout_t *layout, int cylinder, int head,
+                           track_times_t *times) {
+  mfm_io_t io;
+  init_io(&io, layout, cylinder, head);
+  memcpy(track_buf, expected, sizeof(expected));
+  size_t n = encode_track_mfm(&io);
+
+  init_io(&io, layout, cylinder, head);
+  io.n_pulses = n;
+  memset(track_buf, 0, sizeof(track_buf));
+  memset(validity, 0, sizeof(validity));
+  memset(sector_pos, 0, sizeof(sector_pos));
+  if (decode_track_mfm(&io) != sector_count ||
+      memcmp(track_buf, expected, sizeof(expected))) {
+    return false;
+  }
+  mfm_io_sector_times(&io, sector_pos, sector_time);
+
+  // sector_pos is just after the data sync mark. Going back from there: the
+  // sync mark, gap 2, the ID field's CRC, header, address mark and sync mark,
+  // then the presync bytes the controller's PLL locks on to.
+  const mfm_io_settings_t *s = io.settings;
+  uint32_t id_lead = (3 + s->gap_2 + 2 + 4 + 1 + 3 + s->gap_presync) * 16;
+  uint32_t data_len = (1 + block_size + 2) * 16;
+  for (size_t i = 0; i < sector_count; i++) {
+    times->id_start[i] = sector_time[i] - id_lead;
+    times->data_end[i] = sector_time[i] + data_len;
+  }
+  return true;
+}
+
+track_times_t disk_times[cylinders * heads];
+
+// Read every sector of the disk in order, returning the revolutions taken per
+// track
+static double read_disk(const controller_t *c) {
+  uint64_t t = 0;
+  for (int cylinder = 0; cylinder < cylinders; cylinder++) {
+    for (int head = 0; head < heads; head++) {
+      const track_times_t *times = &disk_times[cylinder * heads + head];
+      for (size_t i = 0; i < sector_count; i++) {
+        // wait for the sector's ID field to come around, then read it
+        uint32_t angle = t % track_bits;
+        t += (times->id_start[i] + track_bits - angle) % track_bits;
+        t += times->data_end[i] - times->id_start[i];
+        t += c->sector_overhead;
+      }
+      t += head + 1 < heads ? c->head_switch : c->step;
+    }
+  }
+  return (double)t / track_bits / (cylinders * heads);
+}
+
+static const controller_t controllers[] = {
+    // reads a track per command, the next command is ready before the gap
+    // after the last sector is over; steps at 3ms with 15ms head settling
+    {"track at a time", 0, 200, 18000},
+    // reads a sector per command and can't keep up with adjacent sectors
+    {"sector at a time", 2500, 0, 18000},
+};
+enum { n_controllers = sizeof(controllers) / sizeof(controllers[0]) };
+// The best layout must do at least this well, i.e., read a track per
+// revolution or per interleave revolutions, plus a little
+static const double max_revs[n_controllers] = {1.25, 2.25};
+
+static const layout_t layouts[] = {
+    {1, 0, 0}, {1, 1, 0}, {1, 2, 0}, {1, 3, 0}, {1, 3, 1},
+    {2, 0, 0}, {2, 2, 0}, {2, 4, 0}, {2, 4, 2},
+};
+enum { n_layouts = sizeof(layouts) / sizeof(layouts[0]) };
+
+int main() {
+  int failures = 0;
+  double revs[n_controllers][n_layouts];
+  for (size_t i = 0; i < sizeof(expected); i++) {
+    expected[i] = rand();
+  }
+
+  for (size_t li = 0; li < n_layouts; li++) {
+    bool ok = true;
+    for (int track = 0; track < cylinders * heads; track++) {
+      ok = ok && locate_sectors(&layouts[li], track / heads, track % heads,
+                                &disk_times[track]);
+    }
+    for (size_t ci = 0; ci < n_controllers; ci++) {
+      revs[ci][li] = ok ? read_disk(&controllers[ci]) : -1;
+    }
+  }
+
+  for (size_t ci = 0; ci < n_controllers; ci++) {
+    double best = 0;
+    printf("%s controller:\n", controllers[ci].name);
+    for (size_t li = 0; li < n_layouts; li++) {
+      const layout_t *l = &layouts[li];
+      printf("  interleave %d skew %d/%d: ", l->interleave, l->cylinder_skew,
+             l->head_skew);
+      if (revs[ci][li] < 0) {
+        printf("decode failed\n");
+        failures++;
+        continue;
+      }
+      printf("%5.2f revolutions per track\n", revs[ci][li]);
+      if (best == 0 || revs[ci][li] < best) {
+        best = revs[ci][li];
+      }
+    }
+    printf("  best layout is %.1fx faster than the standard layout\n",
+           revs[ci][0] / best);
+    if (best > max_revs[ci]) {
+      failures++;
+    }
+  }
+
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
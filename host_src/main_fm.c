@@ -10,6 +10,7 @@ enum { block_size = 128 };
 
 uint8_t flux[10000];
 uint8_t track_buf[sector_count * block_size];
+uint8_t expected[sector_count * block_size];
 uint8_t validity[sector_count];
 
 mfm_io_t io = {
@@ -42,12 +43,33 @@ static void dump_flux_compact(const char *filename, mfm_io_t *io) {
   fclose(f);
 }
 
+// Decode the track just written back into track_buf, returning the number of
+// good sectors that match what was encoded
+static size_t decode_fm(void) {
+  memset(track_buf, 0, sizeof(track_buf));
+  memset(validity, 0, sizeof(validity));
+  io.decode_compact = true;
+  io.n_pulses = sizeof(flux) * 8;
+  decode_track_mfm(&io);
+  size_t good = 0;
+  for (size_t i = 0; i < sector_count; i++) {
+    good += validity[i] && !memcmp(track_buf + i * block_size,
+                                   expected + i * block_size, block_size);
+  }
+  return good;
+}
+
 int main() {
   for (size_t i = 0; i < sector_count; i++) {
-    memset(track_buf + i * block_size, block_size, 'A' + i);
+    memset(track_buf + i * block_size, 'A' + i, block_size);
   }
+  memcpy(expected, track_buf, sizeof(expected));
 
   size_t r = encode_track_mfm(&io);
   printf("Used flux %zd\n", r);
   dump_flux_compact("fluxfm", &io);
+
+  size_t good = decode_fm();
+  printf("Decoded %zd/%d sectors\n", good, sector_count);
+  return good != sector_count;
 }
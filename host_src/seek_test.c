@@ -0,0 +1,285 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "seek_impl.h"
+
+// Run the head stepping state machine against a fake clock, checking the
+// time of every action it asks for.
+
+static int failures;
+
+static void check(bool ok, const char *what) {
+  printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok) {
+    failures++;
+  }
+}
+
+typedef struct {
+  seek_io_action_t action;
+  uint32_t time;
+  int32_t position;
+} event_t;
+
+enum { max_events = 256 };
+static event_t events[max_events];
+static size_t n_events;
+
+static void init_seek(seek_io_t *s, int32_t position) {
+  *s = (seek_io_t){
+      .profile = seek_io_profile_uniform(3000, 15000),
+      .pulse_us = 10,
+      .dir_us = 10,
+      .settle = true,
+      .position = position,
+      .target = position,
+  };
+}
+
+// Carry out every action due at `now`
+static void poll_all(seek_io_t *s, uint32_t now) {
+  seek_io_action_t a;
+  while ((a = seek_io_poll(s, now)) != seek_io_none) {
+    if (n_events < max_events) {
+      events[n_events++] = (event_t){a, now, s->position};
+    }
+  }
+}
+
+// Run the seek to its end, as a timer would: waking exactly when the next
+// action is due, plus `lateness` microseconds. Returns the time it finished.
+static uint32_t run(seek_io_t *s, uint32_t now, uint32_t lateness) {
+  while (seek_io_busy(s)) {
+    poll_all(s, now);
+    if (seek_io_busy(s)) {
+      now += seek_io_wait(s, now) + lateness;
+    }
+  }
+  return now;
+}
+
+static size_t count(seek_io_action_t action) {
+  size_t n = 0;
+  for (size_t i = 0; i < n_events; i++) {
+    n += events[i].action == action;
+  }
+  return n;
+}
+
+// The step starts, in order
+static size_t steps(uint32_t *times, size_t max) {
+  size_t n = 0;
+  for (size_t i = 0; i < n_events && n < max; i++) {
+    if (events[i].action == seek_io_step_start) {
+      times[n++] = events[i].time;
+    }
+  }
+  return n;
+}
+
+static void check_exact(uint32_t t0, const char *what) {
+  seek_io_t s;
+  init_seek(&s, 0);
+  n_events = 0;
+  seek_io_start(&s, 5, t0);
+  uint32_t end = run(&s, t0, 0);
+
+  uint32_t times[8];
+  size_t n = steps(times, 8);
+  bool ok = n == 5 && count(seek_io_set_direction) == 1 &&
+            count(seek_io_step_end) == 5 && count(seek_io_done) == 1 &&
+            s.position == 5 && s.dir_in;
+  for (size_t i = 0; ok && i < n; i++) {
+    ok = times[i] == t0 + 10 + 3000 * i;
+  }
+  for (size_t i = 0; ok && i < n_events; i++) {
+    if (events[i].action == seek_io_step_end) {
+      ok = events[i].time == events[i - 1].time + 10;
+    }
+  }
+  ok = ok && end == t0 + 10 + 3000 * 5 + 15000;
+  check(ok, what);
+}
+
+static void check_late(void) {
+  seek_io_t s;
+  init_seek(&s, 10);
+  n_events = 0;
+  seek_io_start(&s, 4, 0);
+  run(&s, 0, 700);
+  uint32_t times[8];
+  size_t n = steps(times, 8);
+  bool ok = n == 6 && s.position == 4 && !s.dir_in;
+  for (size_t i = 1; ok && i < n; i++) {
+    ok = times[i] - times[i - 1] >= 3000;
+  }
+  check(ok, "late polls never make steps closer than step_us");
+}
+
+static void check_nothing_to_do(void) {
+  seek_io_t s;
+  init_seek(&s, 7);
+  seek_io_start(&s, 7, 1000);
+  check(!seek_io_busy(&s) && seek_io_poll(&s, 1000) == seek_io_none,
+        "seek to the current position does nothing");
+}
+
+// The target changes to the other side of the head partway through a seek
+static void check_retarget(void) {
+  seek_io_t s;
+  init_seek(&s, 0);
+  n_events = 0;
+  seek_io_start(&s, 10, 0);
+  uint32_t now = 0;
+  while (s.position < 3) {
+    poll_all(&s, now);
+    now += seek_io_wait(&s, now);
+  }
+  seek_io_start(&s, 1, now);
+  run(&s, now, 0);
+  uint32_t times[16];
+  size_t n = steps(times, 16);
+  // 3 steps in, the direction changes after the third step's step_us, then 2
+  // steps out
+  bool ok = n == 5 && s.position == 1 && count(seek_io_set_direction) == 2 &&
+            times[3] == times[2] + 3000 + 10 && times[4] == times[3] + 3000;
+  check(ok, "changing target reverses after a whole step");
+
+  // a new target during the settle time starts stepping at once
+  init_seek(&s, 0);
+  n_events = 0;
+  seek_io_start(&s, 1, 0);
+  now = 0;
+  while (s.state != seek_io_settle) {
+    poll_all(&s, now);
+    now += seek_io_wait(&s, now);
+  }
+  now += 1000;
+  seek_io_start(&s, 2, now);
+  poll_all(&s, now);
+  n = steps(times, 16);
+  check(n == 2 && times[1] == now && s.position == 2 && count(seek_io_done) == 0,
+        "new target while settling");
+}
+
+// A head starting from rest waits longer for its second step, and longer again
+// when it turns around
+static void check_profile(void) {
+  seek_io_t s;
+  init_seek(&s, 0);
+  s.profile.first_step_us = 5000;
+  s.profile.reverse_us = 8000;
+  n_events = 0;
+  seek_io_start(&s, 4, 0);
+  uint32_t now = 0;
+  while (s.position < 4) {
+    poll_all(&s, now);
+    now += seek_io_wait(&s, now);
+  }
+  seek_io_start(&s, 2, now);
+  run(&s, now, 0);
+  uint32_t times[8];
+  size_t n = steps(times, 8);
+  bool ok = n == 6 && times[0] == 10 && times[1] == 5010 &&
+            times[2] == 8010 && times[3] == 11010 && times[4] == 19010 &&
+            times[5] == 24010;
+  check(ok, "first step and reversal times");
+
+  // a step the other way right after a seek still waits reverse_us
+  init_seek(&s, 0);
+  s.profile.reverse_us = 8000;
+  s.settle = false;
+  seek_io_start(&s, 1, 0);
+  now = run(&s, 0, 0);
+  n_events = 0;
+  seek_io_start(&s, 0, now);
+  run(&s, now, 0);
+  n = steps(times, 8);
+  check(n == 1 && times[0] == 8010, "reversal between seeks");
+}
+
+static void check_settle_table(void) {
+  static const seek_io_profile_t profile = {
+      3000, 3000, 3000, {1000, 2000, 4000, 8000}};
+  static const struct {
+    int32_t distance;
+    uint32_t settle_us;
+  } cases[] = {{1, 1000},  {-2, 2000}, {3, 2000},
+               {4, 4000},  {15, 4000}, {16, 8000},
+               {-40, 8000}};
+  bool ok = true;
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    seek_io_t s;
+    init_seek(&s, 50);
+    s.profile = profile;
+    seek_io_start(&s, 50 + cases[i].distance, 0);
+    uint32_t end = run(&s, 0, 0);
+    uint32_t steps = abs(cases[i].distance);
+    ok = ok && end == 10 + 3000 * steps + cases[i].settle_us;
+  }
+  check(ok, "settle time by seek length");
+
+  seek_io_t s;
+  init_seek(&s, 0);
+  s.settle = false;
+  seek_io_start(&s, 3, 0);
+  check(run(&s, 0, 0) == 10 + 3000 * 3, "no settle time when not asked");
+}
+
+// Seek to `cylinder` the way Adafruit_Floppy does, with a track 0 sensor that
+// is stuck on or works, and a head that is `slip` steps out from where it's
+// thought to be. Returns the seeks made before it arrived or failed, or 0 if
+// it never stopped.
+static int seek_with_sensor(int32_t cylinder, bool stuck, int32_t slip,
+                            seek_io_arrival_t *result) {
+  seek_io_t s;
+  init_seek(&s, 0);
+  bool reseeked = false;
+  for (int seeks = 1; seeks <= 10; seeks++) {
+    seek_io_start(&s, cylinder, 0);
+    run(&s, 0, 0);
+    bool at_track0 = stuck || s.position + slip == 0;
+    *result = seek_io_check_arrival(at_track0, cylinder, reseeked);
+    if (*result != seek_io_reseek) {
+      return seeks;
+    }
+    // find track 0 with the sensor, then go again
+    reseeked = true;
+    slip = 0;
+    s.position = 0;
+  }
+  return 0;
+}
+
+static void check_arrival(void) {
+  seek_io_arrival_t result;
+  int seeks = seek_with_sensor(5, false, 0, &result);
+  check(seeks == 1 && result == seek_io_arrived, "seek arrives");
+
+  seeks = seek_with_sensor(0, true, 0, &result);
+  check(seeks == 1 && result == seek_io_arrived,
+        "stuck sensor agrees at track 0");
+
+  seeks = seek_with_sensor(1, false, -1, &result);
+  check(seeks == 2 && result == seek_io_arrived,
+        "head found at track 0 instead is reseeked");
+
+  seeks = seek_with_sensor(5, true, 0, &result);
+  check(seeks == 2 && result == seek_io_failed,
+        "stuck track 0 sensor fails after one reseek");
+}
+
+int main() {
+  check_exact(0, "steps are exactly step_us apart");
+  check_exact(0xffffd000, "the same across the clock wrapping");
+  check_late();
+  check_nothing_to_do();
+  check_retarget();
+  check_profile();
+  check_settle_table();
+  check_arrival();
+
+  printf("%d seek failures\n", failures);
+  return failures != 0;
+}
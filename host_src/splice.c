@@ -0,0 +1,172 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mfm_impl.h"
+
+// Rewrite single sectors in place on a simulated drive, the same way
+// Adafruit_MFM_Floppy::syncDevice() does when splice_writes is set, and check
+// that each spliced sector reads back without disturbing its neighbours.
+//
+// The simulated disk is a list of flux intervals starting at the index pulse,
+// in units of a 24MHz sample clock, just like capture_track() produces.
+
+enum { sector_count = 18 };
+enum { block_size = 512 };
+enum { T1 = 24 }; // 1us bitcells at 24MHz
+enum { max_flux = 100000 };
+
+uint8_t disk[max_flux], new_disk[max_flux];
+size_t n_disk;
+uint8_t splice_flux[4096];
+
+uint8_t original[sector_count * block_size];
+uint8_t track_buf[sector_count * block_size];
+uint8_t validity[sector_count];
+size_t sector_pos[sector_count];
+uint32_t sector_time[sector_count];
+
+static void init_io(mfm_io_t *io, uint8_t *pulses, size_t n_pulses) {
+  *io = (mfm_io_t){
+      .T1_nom = T1,
+      .T2_max = T1 * 5 / 2,
+      .T3_max = T1 * 7 / 2,
+      .pulses = pulses,
+      .n_pulses = n_pulses,
+      .sectors = track_buf,
+      .sector_validity = validity,
+      .n_sectors = sector_count,
+      .n = 2,
+      .settings = &standard_mfm,
+  };
+}
+
+static size_t decode(uint8_t *pulses, size_t n_pulses) {
+  mfm_io_t io;
+  init_io(&io, pulses, n_pulses);
+  io.sector_pos = sector_pos;
+  memset(validity, 0, sizeof(validity));
+  memset(sector_pos, 0, sizeof(sector_pos));
+  memset(track_buf, 0, sizeof(track_buf));
+  return decode_track_mfm(&io);
+}
+
+static void put_interval(size_t *n, uint64_t interval) {
+  if (*n < max_flux) {
+    new_disk[(*n)++] = interval > 255 ? 255 : interval;
+  }
+}
+
+// Write `n_splice` flux intervals starting `start` ticks after the index.
+// `ppm` models the drive turning at a slightly different speed than when the
+// sector times were measured.
+static void simulate_write(uint32_t start, size_t n_splice, int ppm) {
+  size_t n = 0, i = 0;
+  uint64_t t = 0, last = 0;
+
+  start = (uint64_t)start * (1000000 + ppm) / 1000000;
+
+  // flux before the write gate turns on is untouched
+  while (i < n_disk && t + disk[i] < start) {
+    t += disk[i];
+    put_interval(&n, t - last);
+    last = t;
+    i++;
+  }
+
+  // new flux; anything old in this window is erased
+  uint64_t w = 0;
+  for (size_t j = 0; j < n_splice; j++) {
+    w += splice_flux[j];
+    uint64_t now = start + w * (1000000 + ppm) / 1000000;
+    put_interval(&n, now - last);
+    last = now;
+  }
+  uint64_t end = last + T1;
+
+  // flux after the write gate turns off is untouched
+  for (; i < n_disk; i++) {
+    t += disk[i];
+    if (t > end) {
+      put_interval(&n, t - last);
+      last = t;
+    }
+  }
+
+  memcpy(disk, new_disk, n);
+  n_disk = n;
+}
+
+static bool splice_sector(size_t sector, int ppm) {
+  mfm_io_t io;
+  init_io(&io, splice_flux, sizeof(splice_flux));
+
+  for (size_t i = 0; i < block_size; i++) {
+    track_buf[sector * block_size + i] = rand();
+  }
+  memcpy(original + sector * block_size, track_buf + sector * block_size,
+         block_size);
+
+  size_t n = encode_sector_mfm(&io, sector);
+  uint32_t lead = mfm_io_splice_lead(&io) * T1;
+  simulate_write(sector_time[sector] - lead, n, ppm);
+
+  size_t decoded = decode(disk, n_disk);
+  if (decoded != sector_count) {
+    return false;
+  }
+  return memcmp(track_buf, original, sizeof(original)) == 0;
+}
+
+// format a fresh track and measure where its sectors are, as readTrack() does
+static void format_track(void) {
+  mfm_io_t io;
+  for (size_t i = 0; i < sizeof(original); i++) {
+    original[i] = rand();
+  }
+  memcpy(track_buf, original, sizeof(original));
+  init_io(&io, disk, max_flux);
+  n_disk = encode_track_mfm(&io);
+
+  if (decode(disk, n_disk) != sector_count) {
+    printf("Freshly formatted track did not decode\n");
+    exit(1);
+  }
+  init_io(&io, disk, n_disk);
+  mfm_io_sector_times(&io, sector_pos, sector_time);
+}
+
+int main() {
+  static const int ppms[] = {-500, 0, 500};
+  int failures = 0;
+
+  for (size_t p = 0; p < sizeof(ppms) / sizeof(ppms[0]); p++) {
+    format_track();
+    for (size_t i = 0; i < sector_count; i++) {
+      if (!splice_sector(i, ppms[p])) {
+        printf("Splice of sector %zd at %+dppm failed\n", i, ppms[p]);
+        failures++;
+      }
+    }
+  }
+
+  // Report how much speed error the splice of the last sector, the one
+  // furthest from the index, can tolerate
+  int lo = 0, hi = 0;
+  for (int ppm = 0; ppm > -20000; ppm -= 100) {
+    format_track();
+    if (!splice_sector(sector_count - 1, ppm))
+      break;
+    lo = ppm;
+  }
+  for (int ppm = 0; ppm < 20000; ppm += 100) {
+    format_track();
+    if (!splice_sector(sector_count - 1, ppm))
+      break;
+    hi = ppm;
+  }
+  printf("Last sector splice tolerates %+dppm..%+dppm speed error\n", lo, hi);
+
+  printf("%d splice failures\n", failures);
+  return failures != 0;
+}
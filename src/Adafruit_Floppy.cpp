@@ -13,6 +13,8 @@
 #define clr_write() (*writePort &= ~writeMask)
 #elif defined(ARDUINO_ARCH_RP2040)
 #include "arch_rp2.h"
+#elif defined(__SAMD51__)
+#include "arch_samd51.h"
 #endif
 
 #if !DEBUG_FLOPPY
@@ -22,6 +24,7 @@
 #define clr_debug_led() ((void)0)
 #endif
 
+#include "gcr_impl.h"
 #include "mfm_impl.h"
 
 #if defined(__SAMD51__)
@@ -196,6 +199,8 @@ void Adafruit_Floppy::soft_reset(void) {
   // set motor direction (low is in, high is out)
   pinMode(_directionpin, OUTPUT);
   digitalWrite(_directionpin, LOW); // move inwards to start
+  _seek.dir_in = true;
+  _seek.dir_valid = true;
 
   // step track pin, pulse low for 3us min, 3ms max per pulse
   pinMode(_steppin, OUTPUT);
@@ -335,52 +340,115 @@ bool Adafruit_Floppy::spin_motor(bool motor_on) {
 
 /**************************************************************************/
 /*!
-    @brief  Seek to the desired track, requires the motor to be spun up!
-    @param  track_num The track to step to
-    @return True If we were able to get to the track location
+    @brief  Find track 0 with the sensor, by stepping out until it is seen
+    @return True if track 0 was found
 */
 /**************************************************************************/
-bool Adafruit_Floppy::goto_track(int track_num) {
-  // track 0 is a very special case because its the only one we actually know we
-  // got to. if we dont know where we are, or we're going to track zero, step
-  // back till we get there.
-  if ((_track < 0) || track_num == 0) {
-    if (debug_serial)
-      debug_serial->println("Going to track 0");
-
-    // step back a lil more than expected just in case we really seeked out
-    uint8_t max_steps = 100;
+bool Adafruit_Floppy::recalibrate(void) {
+  if (debug_serial)
+    debug_serial->println("Going to track 0");
+  seek_stats.recalibrations++;
+  _steps_since_recalibrate = 0;
+  _check_track0 = false;
+
+  // step back a lil more than expected just in case we really seeked out
+  uint8_t max_steps = 100;
+  while (max_steps--) {
+    if (!digitalRead(_track0pin)) {
+      _track = 0;
+      break;
+    }
+    step(STEP_OUT, 1);
+  }
+
+  if (digitalRead(_track0pin)) {
+    // we never got a track 0 indicator :(
+    // what if we try stepping in a bit??
+
+    max_steps = 20;
     while (max_steps--) {
       if (!digitalRead(_track0pin)) {
         _track = 0;
         break;
       }
-      step(STEP_OUT, 1);
+      step(STEP_IN, 1);
     }
 
     if (digitalRead(_track0pin)) {
-      // we never got a track 0 indicator :(
-      // what if we try stepping in a bit??
-
-      max_steps = 20;
-      while (max_steps--) {
-        if (!digitalRead(_track0pin)) {
-          _track = 0;
-          break;
-        }
-        step(STEP_IN, 1);
-      }
-
-      if (digitalRead(_track0pin)) {
-        // STILL not found!
-        _track = -1; // We don't know where we really are
-        if (debug_serial)
-          debug_serial->println("Could not find track 0");
-        return false; // we 'timed' out, were not able to locate track 0
-      }
+      // STILL not found!
+      _track = -1; // We don't know where we really are
+      if (debug_serial)
+        debug_serial->println("Could not find track 0");
+      return false; // we 'timed' out, were not able to locate track 0
     }
   }
   delay(settle_delay_ms);
+  return true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Tell the drive that the head is not where it was thought to be,
+   for example because the cylinder number read from the disk is wrong. The
+   next seek finds track 0 with the sensor first.
+*/
+/**************************************************************************/
+void Adafruit_Floppy::position_lost(void) {
+  seek_stats.position_errors++;
+  _track = -1;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Seek to the desired track, requires the motor to be spun up!
+    @param  track_num The track to step to
+    @return True If we were able to get to the track location, false if track 0
+   could not be found, including when the track 0 sensor disagreed with the
+   head position on arrival and finding track 0 again failed
+*/
+/**************************************************************************/
+bool Adafruit_Floppy::goto_track(int track_num) {
+  if (!start_goto_track(track_num)) {
+    return false;
+  }
+  wait_seek();
+  return _track >= 0;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Start seeking to the desired track, without waiting for the head to
+   get there. Poll seek_done() until it returns true before reading or
+   writing; in the meantime, for example, the previous track can be decoded.
+   Finding track 0, when the head position isn't known yet or track 0 is the
+   target, is done before returning.
+    @param  track_num The track to step to
+    @return True If the seek was started
+*/
+/**************************************************************************/
+bool Adafruit_Floppy::start_goto_track(int track_num) {
+  _reseeked = false;
+  return start_track_seek(track_num);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Start seeking to the desired track, as start_goto_track does, but
+   without starting over the count of reseeks
+    @param  track_num The track to step to
+    @return True If the seek was started
+*/
+/**************************************************************************/
+bool Adafruit_Floppy::start_track_seek(int track_num) {
+  // The head position is trusted for relative seeks, even back to track 0.
+  // Track 0 is only found with the sensor again when the position isn't known,
+  // or after recalibrate_after_steps steps on the way to track 0.
+  if (_track < 0 ||
+      (track_num == 0 && _steps_since_recalibrate >= recalibrate_after_steps)) {
+    if (!recalibrate()) {
+      return false;
+    }
+  }
 
   // ok its a non-track 0 step, first, we cant go past 79 ok?
   track_num = min(track_num, FLOPPY_IBMPC_HD_TRACKS - 1);
@@ -391,23 +459,134 @@ bool Adafruit_Floppy::goto_track(int track_num) {
     return true;
   }
 
-  int8_t steps = (int8_t)track_num - (int8_t)_track;
-  if (steps > 0) {
-    if (debug_serial)
-      debug_serial->printf("Step in %d times\n\r", steps);
-    step(STEP_IN, steps);
-  } else {
-    steps = abs(steps);
-    if (debug_serial)
-      debug_serial->printf("Step out %d times\n\r", steps);
-    step(STEP_OUT, steps);
-  }
-  delay(settle_delay_ms);
+  int steps = track_num - _track;
+  if (debug_serial)
+    debug_serial->printf("Step %s %d times\n\r", steps > 0 ? "in" : "out",
+                         abs(steps));
+  seek_stats.seeks++;
+  seek_stats.steps += abs(steps);
+  _steps_since_recalibrate += abs(steps);
+  start_seek(_seek.target + steps, true);
   _track = track_num;
+  _check_track0 = true;
 
   return true;
 }
 
+/**************************************************************************/
+/*!
+    @brief  Check whether a seek started by start_goto_track has finished,
+   stepping the head along if no timer is doing it. When the head arrives, the
+   track 0 sensor is checked against where it should be; if they disagree,
+   track 0 is found again and the seek restarted, once. If they still disagree
+   after that, the sensor is stuck or the head isn't moving, and the seek fails.
+    @return True if the head has reached the track and settled, or if the seek
+   failed, in which case track() is -1
+*/
+/**************************************************************************/
+bool Adafruit_Floppy::seek_done(void) {
+  if (!poll_seek()) {
+    return false;
+  }
+  if (_check_track0) {
+    _check_track0 = false;
+    bool at_track0 = !digitalRead(_track0pin);
+    int track_num = _track;
+    switch (seek_io_check_arrival(at_track0, track_num, _reseeked)) {
+    case seek_io_arrived:
+      break;
+    case seek_io_reseek:
+      position_lost();
+      _reseeked = true;
+      return !start_track_seek(track_num) || seek_done();
+    case seek_io_failed:
+      position_lost();
+      if (debug_serial)
+        debug_serial->println("Track 0 sensor disagrees after reseeking");
+      break;
+    }
+  }
+  return true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Step the head along as the seek state machine asks, unless a timer
+   is doing it
+    @return True if no seek is in progress
+*/
+/**************************************************************************/
+bool Adafruit_Floppy::poll_seek(void) {
+  if (_seek_timer) {
+    return *(volatile seek_io_state_t *)&_seek.state == seek_io_idle;
+  }
+  seek_io_action_t action;
+  while ((action = seek_io_poll(&_seek, micros())) != seek_io_none) {
+    switch (action) {
+    case seek_io_set_direction:
+      digitalWrite(_directionpin, _seek.dir_in ? STEP_IN : STEP_OUT);
+      break;
+    case seek_io_step_start:
+      digitalWrite(_steppin, LOW);
+      break;
+    case seek_io_step_end:
+      digitalWrite(_steppin, HIGH);
+      break;
+    default:
+      break;
+    }
+  }
+  return !seek_io_busy(&_seek);
+}
+
+/**************************************************************************/
+/*!
+    @brief  The head step and settle times in use
+    @return seek_profile, or if it is NULL a profile made from step_delay_us
+   and settle_delay_ms
+*/
+/**************************************************************************/
+seek_io_profile_t Adafruit_Floppy::get_seek_profile(void) const {
+  if (seek_profile) {
+    return *seek_profile;
+  }
+  return seek_io_profile_uniform(step_delay_us, settle_delay_ms * 1000UL);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Start stepping the head to a position, or change where a seek in
+   progress is going. The steps are timed to the microsecond, by seek_profile.
+    @param  target The position to step to, in steps relative to _seek
+    @param  settle Whether to wait the settle time after the last step
+*/
+/**************************************************************************/
+void Adafruit_Floppy::start_seek(int32_t target, bool settle) {
+  seek_io_profile_t profile = get_seek_profile();
+  noInterrupts();
+  _seek.profile = profile;
+  _seek.pulse_us = 10; // 3us min, 3ms max
+  _seek.dir_us = 10;   // 1 microsecond, but we're generous
+  _seek.settle = settle;
+  seek_io_start(&_seek, target, micros());
+  interrupts();
+#if defined(ARDUINO_ARCH_RP2040)
+  _seek_timer = rp2040_seek_run(&_seek, _directionpin, _steppin);
+#endif
+  poll_seek();
+}
+
+/**************************************************************************/
+/*!
+    @brief  Wait for a seek to finish
+*/
+/**************************************************************************/
+void Adafruit_Floppy::wait_seek(void) {
+  while (!seek_done()) {
+    yield();
+  }
+}
+
 /**************************************************************************/
 /*!
     @brief  Step the track motor
@@ -416,19 +595,12 @@ bool Adafruit_Floppy::goto_track(int track_num) {
 */
 /**************************************************************************/
 void Adafruit_Floppy::step(bool dir, uint8_t times) {
-  digitalWrite(_directionpin, dir);
-  delayMicroseconds(10); // 1 microsecond, but we're generous
-
-  while (times--) {
-    digitalWrite(_steppin, HIGH);
-    delay((step_delay_us / 1000UL) + 1); // round up to at least 1ms
-    digitalWrite(_steppin, LOW);
-    delay((step_delay_us / 1000UL) + 1);
-    digitalWrite(_steppin, HIGH); // end high
+  // one more step time after the last for good measure (5.25" drives seemed
+  // to like this)
+  start_seek(_seek.target + (dir == STEP_IN ? times : -times), false);
+  while (!poll_seek()) {
     yield();
   }
-  // one more for good measure (5.25" drives seemed to like this)
-  delay((step_delay_us / 1000UL) + 1);
 }
 
 /**************************************************************************/
@@ -498,17 +670,29 @@ static void set_timings(uint32_t sampleFrequency, mfm_io_t &io,
    re-reading a track with errors.
     @param  logical_track If not NULL, updated with the logical track number of
    the last sector read. (track & side numbers are not otherwise verified)
+    @param  sector_positions If not NULL, for each sector decoded by this call
+   the position in pulses just after its data sync mark is stored here
+    @param  candidates If not NULL, mfm_io_candidates_size(n_sectors, 2) bytes
+   in which copies of sectors that fail their CRC check are kept from one call
+   to the next, to rebuild them from several captures. Such sectors are marked
+   2 (rebuilt by a vote of three copies) or 3 (rebuilt from two copies by
+   searching the bits where they differ) in sector_validity. Cleared along
+   with sector_validity.
     @return Number of sectors we actually captured
 */
 /**************************************************************************/
 size_t Adafruit_FloppyBase::decode_track_mfm(
     uint8_t *sectors, size_t n_sectors, uint8_t *sector_validity,
     const uint8_t *pulses, size_t n_pulses, float nominal_bit_time_us,
-    bool clear_validity, uint8_t *logical_track) {
-  mfm_io_t io;
+    bool clear_validity, uint8_t *logical_track, size_t *sector_positions,
+    uint8_t *candidates) {
+  mfm_io_t io = {};
 
-  if (clear_validity)
+  if (clear_validity) {
     memset(sector_validity, 0, n_sectors);
+    if (candidates)
+      memset(candidates, 0, mfm_io_candidates_size(n_sectors, 2));
+  }
   set_timings(getSampleFrequency(), io, nominal_bit_time_us);
 
   io.pulses = const_cast<uint8_t *>(pulses);
@@ -518,9 +702,154 @@ size_t Adafruit_FloppyBase::decode_track_mfm(
   io.n = 2;
   io.head = get_side();
   io.cylinder_ptr = logical_track;
+  io.sector_pos = sector_positions;
+  io.sector_validity = sector_validity;
+  io.candidates = candidates;
+
+  return ::decode_track_mfm_512(&io);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Decode one track of previously captured FM (single density) data,
+   such as an 8" disk in the IBM 3740 format
+    @param  sectors A pointer to an array of memory we can use to store into,
+   128*n_sectors bytes
+    @param  n_sectors The number of sectors (e.g., 26 for a standard 8" disk)
+    @param  sector_validity An array of values set to 1 if the sector was
+   captured, 0 if not captured (no IDAM, CRC error, etc)
+    @param  pulses An array of pulses from capture_track
+    @param  n_pulses An array of pulses from capture_track
+    @param  nominal_bit_time_us The nominal time of one FM bitcell, half a data
+   bit: usually 2.0f (8") or 4.0f (5.25" and 3.5")
+    @param  clear_validity Whether to clear the validity flag. Set to false if
+   re-reading a track with errors.
+    @param  logical_track If not NULL, updated with the logical track number of
+   the last sector read. (track & side numbers are not otherwise verified)
+    @param  sector_positions If not NULL, for each sector decoded by this call
+   the position in pulses at the start of its data address mark is stored here
+    @param  candidates If not NULL, mfm_io_candidates_size(n_sectors, 0) bytes
+   used as in decode_track_mfm to rebuild sectors from several captures
+    @return Number of sectors we actually captured
+*/
+/**************************************************************************/
+size_t Adafruit_FloppyBase::decode_track_fm(
+    uint8_t *sectors, size_t n_sectors, uint8_t *sector_validity,
+    const uint8_t *pulses, size_t n_pulses, float nominal_bit_time_us,
+    bool clear_validity, uint8_t *logical_track, size_t *sector_positions,
+    uint8_t *candidates) {
+  mfm_io_t io = {};
+
+  if (clear_validity) {
+    memset(sector_validity, 0, n_sectors);
+    if (candidates)
+      memset(candidates, 0, mfm_io_candidates_size(n_sectors, 0));
+  }
+  set_timings(getSampleFrequency(), io, nominal_bit_time_us);
+
+  io.pulses = const_cast<uint8_t *>(pulses);
+  io.n_pulses = n_pulses;
+  io.sectors = sectors;
+  io.n_sectors = n_sectors;
+  io.n = 0;
+  io.head = get_side();
+  io.cylinder_ptr = logical_track;
+  io.sector_pos = sector_positions;
   io.sector_validity = sector_validity;
+  io.candidates = candidates;
+  io.settings = &standard_fm;
 
-  return ::decode_track_mfm(&io);
+  return ::decode_track_fm_128(&io);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Decode one track of previously captured Amiga "trackdisk" MFM data
+    @param  sectors A pointer to an array of memory we can use to store into,
+   512*n_sectors bytes
+    @param  n_sectors The number of sectors, 11 for a standard 880K disk
+    @param  sector_validity An array of values set to 1 if the sector was
+   captured, 0 if not captured (no sync, checksum error, etc)
+    @param  pulses An array of pulses from capture_track
+    @param  n_pulses An array of pulses from capture_track
+    @param  nominal_bit_time_us The nominal time of one MFM bit, as for
+   decode_track_mfm
+    @param  clear_validity Whether to clear the validity flag. Set to false if
+   re-reading a track with errors.
+    @param  logical_track If not NULL, updated with the cylinder number of the
+   last sector read, which is half the Amiga track number
+    @return Number of sectors we actually captured
+*/
+/**************************************************************************/
+size_t Adafruit_FloppyBase::decode_track_amiga(
+    uint8_t *sectors, size_t n_sectors, uint8_t *sector_validity,
+    const uint8_t *pulses, size_t n_pulses, float nominal_bit_time_us,
+    bool clear_validity, uint8_t *logical_track) {
+  mfm_io_t io = {};
+
+  if (clear_validity)
+    memset(sector_validity, 0, n_sectors);
+  set_timings(getSampleFrequency(), io, nominal_bit_time_us);
+
+  io.pulses = const_cast<uint8_t *>(pulses);
+  io.n_pulses = n_pulses;
+  io.sectors = sectors;
+  io.n_sectors = n_sectors;
+  io.cylinder_ptr = logical_track;
+  io.sector_validity = sector_validity;
+
+  return ::decode_track_amiga(&io);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Decode one track of previously captured Apple II 16-sector GCR
+   data. The bitcells are always 4us long.
+    @param  sectors A pointer to an array of memory we can use to store into,
+   256*n_sectors bytes
+    @param  n_sectors The number of sectors, 16 for DOS 3.3 and ProDOS disks
+    @param  sector_validity An array of values set to 1 if the sector was
+   captured, 0 if not captured (no address field, checksum error, etc)
+    @param  pulses An array of pulses from capture_track
+    @param  n_pulses An array of pulses from capture_track
+    @param  order Where each physical sector's data is stored in sectors
+    @param  clear_validity Whether to clear the validity flag. Set to false if
+   re-reading a track with errors.
+    @param  logical_track If not NULL, updated with the track number of the
+   last sector read. (it is not otherwise verified)
+    @return Number of sectors we actually captured
+*/
+/**************************************************************************/
+size_t Adafruit_FloppyBase::decode_track_gcr(
+    uint8_t *sectors, size_t n_sectors, uint8_t *sector_validity,
+    const uint8_t *pulses, size_t n_pulses,
+    adafruit_apple2_sector_order_t order, bool clear_validity,
+    uint8_t *logical_track) {
+  gcr_io_t io = {};
+
+  if (clear_validity)
+    memset(sector_validity, 0, n_sectors);
+  // pulses longer than 255 counts are clipped, but they only need to be
+  // recognized as longer than T2_max
+  uint32_t sample_freq = getSampleFrequency();
+  uint32_t t2_max = round(sample_freq * 10e-6);
+  io.T1_nom = round(sample_freq * 4e-6);
+  io.T1_max = round(sample_freq * 6e-6);
+  io.T2_max = t2_max > 254 ? 254 : t2_max;
+
+  io.pulses = const_cast<uint8_t *>(pulses);
+  io.n_pulses = n_pulses;
+  io.sectors = sectors;
+  io.n_sectors = n_sectors;
+  io.sector_validity = sector_validity;
+  io.track_ptr = logical_track;
+  if (order == APPLE2_DOS_ORDER) {
+    io.sector_map = gcr_io_dos_order;
+  } else if (order == APPLE2_PRODOS_ORDER) {
+    io.sector_map = gcr_io_prodos_order;
+  }
+
+  return ::decode_track_gcr(&io);
 }
 
 /**************************************************************************/
@@ -535,15 +864,20 @@ size_t Adafruit_FloppyBase::decode_track_mfm(
     @param  nominal_bit_time_us The nominal time of one MFM bit, usually 1.0f
    (double density) or 2.0f (high density)
     @param  logical_track The logical track number, or -1 to use track()
+    @param  interleave The spacing of consecutively numbered sectors around
+   the track, 1 for adjacent
+    @param  cylinder_skew How many sector places the first sector moves along
+   by on each cylinder
+    @param  head_skew How many sector places the first sector moves along by
+   on head 1
     @return Number of pulses actually generated
 */
 /**************************************************************************/
-size_t Adafruit_FloppyBase::encode_track_mfm(const uint8_t *sectors,
-                                             size_t n_sectors, uint8_t *pulses,
-                                             size_t max_pulses,
-                                             float nominal_bit_time_us,
-                                             uint8_t logical_track) {
-  mfm_io_t io;
+size_t Adafruit_FloppyBase::encode_track_mfm(
+    const uint8_t *sectors, size_t n_sectors, uint8_t *pulses,
+    size_t max_pulses, float nominal_bit_time_us, uint8_t logical_track,
+    uint8_t interleave, uint8_t cylinder_skew, uint8_t head_skew) {
+  mfm_io_t io = {};
 
   set_timings(getSampleFrequency(), io, nominal_bit_time_us);
 
@@ -554,12 +888,109 @@ size_t Adafruit_FloppyBase::encode_track_mfm(const uint8_t *sectors,
   io.n = 2;
   io.head = get_side();
   io.cylinder = logical_track;
+  io.interleave = interleave;
+  io.cylinder_skew = cylinder_skew;
+  io.head_skew = head_skew;
   io.sector_validity = NULL;
+  io.settings = &standard_mfm;
 
-  ::encode_track_mfm(&io);
+  ::encode_track_mfm_512(&io);
   return io.pos;
 }
 
+/**************************************************************************/
+/*!
+    @brief  Encode one whole track in the Amiga "trackdisk" format, to be
+   written starting at the index
+    @param  sectors A pointer to the sector data, 512*n_sectors bytes
+    @param  n_sectors The number of sectors, 11 for a standard 880K disk
+    @param  pulses An array to store the flux pulses into
+    @param  max_pulses The maximum number of pulses that may be stored
+    @param  nominal_bit_time_us The nominal time of one MFM bit, as for
+   encode_track_mfm
+    @param  logical_track The cylinder number. The head is get_side().
+    @return Number of pulses actually generated
+*/
+/**************************************************************************/
+size_t Adafruit_FloppyBase::encode_track_amiga(const uint8_t *sectors,
+                                               size_t n_sectors,
+                                               uint8_t *pulses,
+                                               size_t max_pulses,
+                                               float nominal_bit_time_us,
+                                               uint8_t logical_track) {
+  mfm_io_t io = {};
+
+  set_timings(getSampleFrequency(), io, nominal_bit_time_us);
+
+  io.pulses = pulses;
+  io.n_pulses = max_pulses;
+  io.sectors = const_cast<uint8_t *>(sectors);
+  io.n_sectors = n_sectors;
+  io.head = get_side();
+  io.cylinder = logical_track;
+
+  ::encode_track_amiga(&io);
+  return io.pos;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Encode the data field of one sector, for writing in place of the
+   data field already on the disk
+    @param  sector A pointer to the 512 bytes of sector data
+    @param  pulses An array to store the flux pulses into
+    @param  max_pulses The maximum number of pulses that may be stored
+    @param  nominal_bit_time_us The nominal time of one MFM bit, usually 1.0f
+   (double density) or 2.0f (high density)
+    @param  lead_counts Set to the number of sample counts from the start of
+   the generated flux to the end of its data sync mark. Start writing this long
+   before the sector's sync mark passes the head.
+    @return Number of pulses actually generated
+*/
+/**************************************************************************/
+size_t Adafruit_FloppyBase::encode_sector_mfm(const uint8_t *sector,
+                                              uint8_t *pulses,
+                                              size_t max_pulses,
+                                              float nominal_bit_time_us,
+                                              uint32_t *lead_counts) {
+  mfm_io_t io = {};
+
+  set_timings(getSampleFrequency(), io, nominal_bit_time_us);
+
+  io.pulses = pulses;
+  io.n_pulses = max_pulses;
+  io.sectors = const_cast<uint8_t *>(sector);
+  io.n_sectors = 1;
+  io.n = 2;
+  io.settings = &standard_mfm;
+
+  size_t result = ::encode_sector_mfm_512(&io, 0);
+  *lead_counts = mfm_io_splice_lead(&io) * io.T1_nom;
+  return result;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Convert sector positions from decode_track_mfm into times
+    @param  pulses The flux that was decoded
+    @param  n_pulses The number of pulses in the flux
+    @param  sector_positions The positions stored by decode_track_mfm. Entries
+   that are 0 are skipped.
+    @param  n_sectors The number of entries in sector_positions and times
+    @param  times For each nonzero position, set to the number of sample
+   counts from the start of the flux to that position
+*/
+/**************************************************************************/
+void Adafruit_FloppyBase::sector_times(const uint8_t *pulses, size_t n_pulses,
+                                       const size_t *sector_positions,
+                                       size_t n_sectors, uint32_t *times) {
+  mfm_io_t io = {};
+  io.pulses = const_cast<uint8_t *>(pulses);
+  io.n_pulses = n_pulses;
+  io.n_sectors = n_sectors;
+  mfm_io_sector_times(&io, sector_positions, times);
+}
+
 /**************************************************************************/
 /*!
     @brief  Get the sample rate that we read and emit pulses at, platform and
@@ -622,8 +1053,11 @@ size_t Adafruit_FloppyBase::capture_track(
   g_max_pulses = max_pulses;
   g_n_pulses = 0;
   g_store_greaseweazle = store_greaseweazle;
-  // enable capture
-  enable_capture();
+  // enable capture, by DMA if there's a channel free, so the flux comes out of
+  // the DMA ring while we wait rather than an interrupt per transition
+  if (!samd51_dma_capture_start()) {
+    enable_capture();
+  }
   // meanwhile... wait for *second* low pulse
   if (index_wait_ms) {
     wait_for_index_pulse_low();
@@ -631,17 +1065,26 @@ size_t Adafruit_FloppyBase::capture_track(
     *falling_index_offset = g_n_pulses;
   }
 
+  uint32_t wait_ms = 0;
   if (!capture_ms) {
     // wait another 50ms which is about 1/4 of a track
-    delay(50);
+    wait_ms = 50;
   } else {
     int32_t remaining = capture_ms - (millis() - start_time);
     if (remaining > 0) {
       debug_serial->printf("Delaying another %d ms post-index\n\r", remaining);
-      delay(remaining);
+      wait_ms = remaining;
     }
   }
+  uint32_t wait_start = millis();
+  while (millis() - wait_start < wait_ms && samd51_dma_capture_poll()) {
+    yield();
+  }
   // ok we're done, clean up!
+  if (!samd51_dma_capture_stop() && debug_serial) {
+    debug_serial->printf("Capture fell behind, stopped after %d pulses\n\r",
+                         g_n_pulses);
+  }
   disable_capture();
   deinit_capture();
   return g_n_pulses;
@@ -737,16 +1180,20 @@ size_t Adafruit_FloppyBase::capture_track(
     @param  n_pulses How many bytes are in the pulse array
     @param  store_greaseweazle If true, long pulses are 'packed' in gw format
     @param  use_index If true, write starts at the index pulse.
+    @param  index_delay_us If not zero, the write gate is turned on this long
+   after the index pulse instead of right at it. Writing stops when the pulses
+   run out, so this can rewrite part of a track in place.
     @returns False if the data could not be written (samd51 cannot write apple
    flux format)
 */
 /**************************************************************************/
 bool Adafruit_FloppyBase::write_track(uint8_t *pulses, size_t n_pulses,
-                                      bool store_greaseweazle, bool use_index) {
+                                      bool store_greaseweazle, bool use_index,
+                                      uint32_t index_delay_us) {
 #if defined(ARDUINO_ARCH_RP2040)
   return rp2040_flux_write(_indexpin, _wrgatepin, _wrdatapin, pulses,
                            pulses + n_pulses, store_greaseweazle, _is_apple2,
-                           use_index);
+                           use_index, index_delay_us);
 #elif defined(__SAMD51__)
   if (_is_apple2) {
     return false;
@@ -764,11 +1211,14 @@ bool Adafruit_FloppyBase::write_track(uint8_t *pulses, size_t n_pulses,
   // init global interrupt data
   g_flux_pulses = pulses;
   g_max_pulses = n_pulses;
-  g_n_pulses = 1; // Pulse 0 is config'd below...this is NEXT pulse index
+  g_n_pulses = 0; // enable_generate() sets up the first pulse
   g_store_greaseweazle = store_greaseweazle;
   g_writing_pulses = true;
 
   wait_for_index_pulse_low();
+  if (index_delay_us) {
+    delayMicroseconds(index_delay_us);
+  }
   // start teh writin'
   digitalWrite(_wrgatepin, LOW);
   enable_generate();
@@ -815,6 +1265,9 @@ bool Adafruit_FloppyBase::write_track(uint8_t *pulses, size_t n_pulses,
 
   noInterrupts();
   wait_for_index_pulse_low();
+  if (index_delay_us) {
+    delayMicroseconds(index_delay_us);
+  }
   digitalWrite(_wrgatepin, LOW);
 
   // write track data
@@ -858,9 +1311,16 @@ void Adafruit_FloppyBase::wait_for_index_pulse_low(void) {
   while (true) {
     index_state = read_index();
     if (last_index_state && !index_state) {
+#if defined(__SAMD51__)
+      // the flux up to the index pulse
+      samd51_dma_capture_poll();
+#endif
       return;
     }
     last_index_state = index_state;
+#if defined(__SAMD51__)
+    samd51_dma_capture_poll();
+#endif
   }
 }
 
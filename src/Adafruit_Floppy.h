@@ -22,6 +22,7 @@
 #define DISABLE_FS_H_WARNING
 #include "SdFat.h"
 #include "SdFatConfig.h"
+#include "seek_impl.h"
 
 #define FLOPPY_IBMPC_HD_TRACKS 80
 #define FLOPPY_IBMPC_DD_TRACKS 40
@@ -32,6 +33,14 @@
 #define MFM_IBMPC360K_SECTORS_PER_TRACK 9
 #define MFM_IBMPC720K_SECTORS_PER_TRACK 9
 #define MFM_BYTES_PER_SECTOR 512UL
+/** Room to keep 3 copies of each sector of a track that fail their CRC check,
+ * see Adafruit_MFM_Floppy::fusion_buffer */
+#define MFM_FUSION_BUFFER_SIZE                                                 \
+  (MFM_IBMPC1440K_SECTORS_PER_TRACK * (1 + 3 * (MFM_BYTES_PER_SECTOR + 2)))
+
+#define FLOPPY_APPLE2_TRACKS 35
+#define GCR_APPLE2_SECTORS_PER_TRACK 16
+#define GCR_APPLE2_BYTES_PER_SECTOR 256UL
 
 #define STEP_OUT HIGH
 #define STEP_IN LOW
@@ -52,6 +61,45 @@ typedef enum {
   AUTODETECT,
 } adafruit_floppy_disk_t;
 
+/** Where the data of each sector of an Apple II disk goes in a track's worth
+ * of data, matching the common disk image files */
+typedef enum {
+  APPLE2_DOS_ORDER,      ///< DOS 3.3 order, as in .dsk and .do images
+  APPLE2_PRODOS_ORDER,   ///< ProDOS order, as in .po images
+  APPLE2_PHYSICAL_ORDER, ///< The sector numbers written on the disk
+} adafruit_apple2_sector_order_t;
+
+/** Statistics kept by Adafruit_MFM_Floppy when verify_writes is enabled */
+typedef struct {
+  uint32_t last_verify_us; ///< Time to write and verify the last track,
+                           ///< including any retries
+  uint8_t last_retries;    ///< How many times the last track was rewritten
+  uint32_t verified_tracks; ///< Tracks written and verified successfully
+  uint32_t total_retries;   ///< Rewrites caused by a failed verify
+  uint32_t failed_tracks;   ///< Tracks still failing after all retries
+} adafruit_floppy_verify_stats_t;
+
+/** Head positioning counts kept by Adafruit_Floppy */
+typedef struct {
+  uint32_t seeks;           ///< Seeks that moved the head
+  uint32_t steps;           ///< Steps taken by those seeks
+  uint32_t recalibrations;  ///< Times track 0 was found with the sensor
+  uint32_t position_errors; ///< Times the head turned out to be elsewhere
+} adafruit_floppy_seek_stats_t;
+
+/** Called by Adafruit_MFM_Floppy::readDisk with each track it reads. `data`
+ * holds the track's sectors in order and `validity` which of them were read
+ * correctly; `n_valid` is how many were. Return false to stop reading. */
+typedef bool (*adafruit_floppy_track_callback_t)(void *context, int track,
+                                                 bool head, const uint8_t *data,
+                                                 const uint8_t *validity,
+                                                 uint32_t n_valid);
+
+/** Called by Adafruit_MFM_Floppy::imageDisk with `len` bytes of the disk image
+ * that belong at byte `offset` in it. Return false to stop imaging. */
+typedef bool (*adafruit_floppy_sink_t)(void *context, uint32_t offset,
+                                       const uint8_t *data, size_t len);
+
 /**************************************************************************/
 /*!
     @brief An abstract base class for chattin with floppy drives
@@ -178,11 +226,46 @@ public:
                           uint8_t *sector_validity, const uint8_t *pulses,
                           size_t n_pulses, float nominal_bit_time_us,
                           bool clear_validity = false,
+                          uint8_t *logical_track = nullptr,
+                          size_t *sector_positions = nullptr,
+                          uint8_t *candidates = nullptr);
+  size_t decode_track_fm(uint8_t *sectors, size_t n_sectors,
+                         uint8_t *sector_validity, const uint8_t *pulses,
+                         size_t n_pulses, float nominal_bit_time_us,
+                         bool clear_validity = false,
+                         uint8_t *logical_track = nullptr,
+                         size_t *sector_positions = nullptr,
+                         uint8_t *candidates = nullptr);
+
+  size_t decode_track_amiga(uint8_t *sectors, size_t n_sectors,
+                            uint8_t *sector_validity, const uint8_t *pulses,
+                            size_t n_pulses, float nominal_bit_time_us,
+                            bool clear_validity = false,
+                            uint8_t *logical_track = nullptr);
+
+  size_t decode_track_gcr(uint8_t *sectors, size_t n_sectors,
+                          uint8_t *sector_validity, const uint8_t *pulses,
+                          size_t n_pulses,
+                          adafruit_apple2_sector_order_t order,
+                          bool clear_validity = false,
                           uint8_t *logical_track = nullptr);
 
   size_t encode_track_mfm(const uint8_t *sectors, size_t n_sectors,
                           uint8_t *pulses, size_t max_pulses,
-                          float nominal_bit_time_us, uint8_t logical_track);
+                          float nominal_bit_time_us, uint8_t logical_track,
+                          uint8_t interleave = 1, uint8_t cylinder_skew = 0,
+                          uint8_t head_skew = 0);
+
+  size_t encode_track_amiga(const uint8_t *sectors, size_t n_sectors,
+                            uint8_t *pulses, size_t max_pulses,
+                            float nominal_bit_time_us, uint8_t logical_track);
+
+  size_t encode_sector_mfm(const uint8_t *sector, uint8_t *pulses,
+                           size_t max_pulses, float nominal_bit_time_us,
+                           uint32_t *lead_counts);
+  void sector_times(const uint8_t *pulses, size_t n_pulses,
+                    const size_t *sector_positions, size_t n_sectors,
+                    uint32_t *times);
 
   size_t capture_track(volatile uint8_t *pulses, size_t max_pulses,
                        int32_t *falling_index_offset,
@@ -191,7 +274,8 @@ public:
       __attribute__((optimize("O3")));
 
   bool write_track(uint8_t *pulses, size_t n_pulses,
-                   bool store_greaseweazle = false, bool use_index = true)
+                   bool store_greaseweazle = false, bool use_index = true,
+                   uint32_t index_delay_us = 0)
       __attribute__((optimize("O3")));
   void print_pulse_bins(uint8_t *pulses, size_t n_pulses, uint8_t max_bins = 64,
                         bool is_gw_format = false, uint32_t min_bin_size = 100);
@@ -267,6 +351,10 @@ public:
   void select(bool selected) override;
   bool spin_motor(bool motor_on) override;
   bool goto_track(int track) override;
+  bool start_goto_track(int track);
+  bool seek_done(void);
+  void position_lost(void);
+  seek_io_profile_t get_seek_profile(void) const;
   bool side(int head) override;
   int track(void) override;
   int get_side(void) override;
@@ -276,12 +364,35 @@ public:
   bool get_track0_sense() override;
   bool get_ready_sense() override;
 
+  /**! Head step and settle times for this drive, for example
+   * &seek_io_profile_35 or a profile from
+   * Adafruit_MFM_Floppy::calibrate_seek(). When NULL, every step takes
+   * step_delay_us and every seek settles for settle_delay_ms */
+  const seek_io_profile_t *seek_profile = nullptr;
+
+  /**! After this many steps, the next seek to track 0 finds it with the sensor
+   * instead of trusting the head position. 0 finds it every time */
+  uint16_t recalibrate_after_steps = 2000;
+  /**! Seek, step and recalibration counts */
+  adafruit_floppy_seek_stats_t seek_stats = {};
+
 private:
   // theres a lot of GPIO!
   int8_t _densitypin, _selectpin, _motorpin, _directionpin, _steppin,
       _track0pin, _protectpin, _sidepin, _readypin;
 
   int _track = -1, _side = -1;
+
+  bool recalibrate(void);
+  bool start_track_seek(int track);
+  void start_seek(int32_t target, bool settle);
+  bool poll_seek(void);
+  void wait_seek(void);
+  seek_io_t _seek = {};     ///< head stepping state, positions in steps
+  bool _seek_timer = false; ///< whether a timer carries out the seek
+  bool _check_track0 = false; ///< check the track 0 sensor when a seek ends
+  bool _reseeked = false; ///< whether this seek was restarted from track 0
+  uint32_t _steps_since_recalibrate = 0;
 };
 
 /**************************************************************************/
@@ -352,6 +463,12 @@ public:
 
   uint32_t size(void) const;
   int32_t readTrack(int track, bool head);
+  bool readDisk(adafruit_floppy_track_callback_t callback,
+                void *context = nullptr, bool retry_errors = true);
+  int32_t imageDisk(adafruit_floppy_sink_t sink, void *context = nullptr,
+                    uint8_t retries = 2);
+  bool sectorBad(uint32_t block) const;
+  bool sectorRepaired(uint32_t block) const;
 
   /**! @brief The expected number of sectors per track in this format
        @returns The number of sectors per track */
@@ -373,6 +490,8 @@ public:
      autodetect */
   bool inserted(adafruit_floppy_disk_t format);
 
+  bool calibrate_seek(seek_io_profile_t *profile);
+
   //------------- SdFat v2 FsBlockDeviceInterface API -------------//
   virtual bool isBusy();
   virtual uint32_t sectorCount();
@@ -389,8 +508,59 @@ public:
   /**! Which tracks from the last track-read were valid MFM/CRC! */
   uint8_t track_validity[MFM_IBMPC1440K_SECTORS_PER_TRACK];
 
+  /**! When set to MFM_FUSION_BUFFER_SIZE bytes, readTrack keeps the copies of
+   * sectors that fail their CRC check on each revolution and rebuilds them by
+   * a majority vote or a search of the bits where copies differ. Rebuilt
+   * sectors are marked 2 (voted) or 3 (searched) in track_validity, rather
+   * than 1 */
+  uint8_t *fusion_buffer = nullptr;
+
+  /**! A bit for each sector that imageDisk could not read, see sectorBad() */
+  uint8_t bad_sectors[FLOPPY_IBMPC_HD_TRACKS * FLOPPY_HEADS *
+                      MFM_IBMPC1440K_SECTORS_PER_TRACK / 8] = {};
+  /**! A bit for each sector that imageDisk only read by a search of the bits
+   * where two bad copies differ (marked 3 in track_validity). About 1 in 250
+   * of these is still wrong, see sectorRepaired() */
+  uint8_t repaired_sectors[FLOPPY_IBMPC_HD_TRACKS * FLOPPY_HEADS *
+                           MFM_IBMPC1440K_SECTORS_PER_TRACK / 8] = {};
+
+  /**! When true, syncDevice() rewrites just the data field of a single changed
+   * sector (or of each changed sector, on a track with read errors) instead of
+   * the whole track */
+  bool splice_writes = false;
+
+  /**! Sector layout used when syncDevice() writes a whole track. The default
+   * is the standard PC layout: sectors in order, starting at the index on
+   * every track */
+  uint8_t interleave = 1;
+  /**! How many sector places the first sector moves along by on each
+   * cylinder, see interleave */
+  uint8_t cylinder_skew = 0;
+  /**! How many sector places the first sector moves along by on head 1, see
+   * interleave */
+  uint8_t head_skew = 0;
+
+  /**! When true, syncDevice() reads back each track it writes during the
+   * following revolution and rewrites it if any sector does not match */
+  bool verify_writes = false;
+  /**! How many times syncDevice() rewrites a track that fails to verify */
+  uint8_t write_retries = 2;
+  /**! Verify latency and retry counts, updated when verify_writes is true */
+  adafruit_floppy_verify_stats_t verify_stats = {};
+
 private:
   bool autodetect();
+  uint32_t decodeFlux(bool clear_validity, uint8_t *cylinder);
+  static bool imageTrack(void *context, int track, bool head,
+                         const uint8_t *data, const uint8_t *validity,
+                         uint32_t n_valid);
+  bool writeTrack(uint32_t dirty_sectors, bool has_errors, int logical_track,
+                  bool *full_track);
+  bool spliceSectors(uint32_t dirty_sectors);
+  bool verifyTrack(bool full_track);
+  bool seekCheck(const uint8_t *tracks, size_t n_tracks, bool all_sectors);
+  void calibrateTime(uint32_t *value, uint32_t min_value, const uint8_t *tracks,
+                     size_t n_tracks, bool all_sectors);
 #if defined(PICO_BOARD) || defined(__RP2040__) || defined(ARDUINO_ARCH_RP2040)
   uint16_t _last;
 #endif
@@ -401,7 +571,14 @@ private:
   uint16_t _bit_time_ns;
   bool _high_density = true;
   bool _dirty = false, _track_has_errors = false;
+  uint32_t _dirty_sectors = 0; // bitmask of sectors changed since last sync
+  /**! When each sector's data sync mark passes the head, in sample counts after
+   * the index pulse, or 0 if not known */
+  uint32_t _sector_time[MFM_IBMPC1440K_SECTORS_PER_TRACK];
   bool _double_step = false;
+  adafruit_floppy_sink_t _image_sink = nullptr;
+  void *_image_context = nullptr;
+  uint32_t _bad_sector_count = 0;
   Adafruit_Floppy *_floppy = nullptr;
   adafruit_floppy_disk_t _format = AUTODETECT;
 
@@ -410,4 +587,60 @@ private:
   size_t _n_flux;
 };
 
+/**************************************************************************/
+/*!
+    This class adds support for the BaseBlockDriver interface to an Apple II
+   16-sector GCR floppy disk, so that it can be used as a mass storage device.
+   The disk appears as a 140K disk image in DOS 3.3 or ProDOS sector order.
+   Writing is not supported.
+*/
+/**************************************************************************/
+class Adafruit_GCR_Floppy : public FsBlockDeviceInterface {
+public:
+  Adafruit_GCR_Floppy(Adafruit_Apple2Floppy *floppy,
+                      adafruit_apple2_sector_order_t order = APPLE2_DOS_ORDER);
+
+  bool begin(void);
+  void end(void);
+
+  uint32_t size(void) const;
+  int32_t readTrack(int track);
+
+  /**! @brief Call when the media has been removed */
+  void removed();
+  /**! @brief Call when media has been inserted
+       @returns True if track 0 could be read */
+  bool inserted();
+
+  //------------- SdFat v2 FsBlockDeviceInterface API -------------//
+  virtual bool isBusy();
+  virtual uint32_t sectorCount();
+  virtual bool syncDevice();
+
+  virtual bool readSector(uint32_t block, uint8_t *dst);
+  virtual bool readSectors(uint32_t block, uint8_t *dst, size_t ns);
+  virtual bool writeSector(uint32_t block, const uint8_t *src);
+  virtual bool writeSectors(uint32_t block, const uint8_t *src, size_t ns);
+
+  /**! The decoded data from the last track read, in the sector order given
+   * to the constructor */
+  uint8_t
+      track_data[GCR_APPLE2_SECTORS_PER_TRACK * GCR_APPLE2_BYTES_PER_SECTOR];
+
+  /**! Which sectors of track_data from the last track-read were valid */
+  uint8_t track_validity[GCR_APPLE2_SECTORS_PER_TRACK];
+
+private:
+  static constexpr uint8_t NO_TRACK = UINT8_MAX;
+  uint8_t _tracks = 0;
+  uint8_t _last_track_read = NO_TRACK; // last cached track
+  Adafruit_Apple2Floppy *_floppy = nullptr;
+  adafruit_apple2_sector_order_t _order;
+
+  /**! The raw flux data from the last track read, a little over one
+   * revolution */
+  uint8_t _flux[40000];
+  size_t _n_flux;
+};
+
 #endif
@@ -0,0 +1,232 @@
+#include <Adafruit_Floppy.h>
+
+/**************************************************************************/
+/*!
+    @brief  Instantiate an Apple II 16-sector GCR floppy
+    @param  floppy An Adafruit_Apple2Floppy object that has the pins defined
+    @param  order The sector order to present the disk in, to match the kind
+   of disk image it will be used as
+*/
+/**************************************************************************/
+Adafruit_GCR_Floppy::Adafruit_GCR_Floppy(Adafruit_Apple2Floppy *floppy,
+                                         adafruit_apple2_sector_order_t order) {
+  _floppy = floppy;
+  _order = order;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Initialize and spin up the floppy drive
+    @returns True if we were able to spin up and read track 0
+*/
+/**************************************************************************/
+bool Adafruit_GCR_Floppy::begin(void) {
+  if (!_floppy)
+    return false;
+  _floppy->begin();
+  // data tracks are two half-track steps apart
+  _floppy->step_mode(Adafruit_Apple2Floppy::STEP_MODE_HALF);
+
+  _floppy->select(true);
+
+  if (_floppy->spin_motor(true)) {
+    return inserted();
+  } else {
+    return false;
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Spin down and deselect the motor and drive
+*/
+/**************************************************************************/
+void Adafruit_GCR_Floppy::end(void) {
+  _floppy->spin_motor(false);
+  _floppy->select(false);
+}
+
+/**************************************************************************/
+/*!
+    @brief   Quick calculator for expected max capacity
+    @returns Size of the drive in bytes
+*/
+/**************************************************************************/
+uint32_t Adafruit_GCR_Floppy::size(void) const {
+  return (uint32_t)_tracks * GCR_APPLE2_SECTORS_PER_TRACK *
+         GCR_APPLE2_BYTES_PER_SECTOR;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Read one track's worth of data and GCR decode it. A capture of a
+   little over one revolution normally gets every sector, so a whole track is
+   cached at once.
+    @param  track the track number, 0 to 34
+    @returns Number of sectors captured, or -1 if we couldn't seek
+*/
+/**************************************************************************/
+int32_t Adafruit_GCR_Floppy::readTrack(int track) {
+  // in STEP_MODE_HALF, goto_track counts half tracks
+  if (!_floppy->goto_track(2 * track)) {
+    return -1;
+  }
+
+  uint32_t captured_sectors = 0;
+  for (int i = 0; i < 5 && captured_sectors < GCR_APPLE2_SECTORS_PER_TRACK;
+       i++) {
+    int32_t index_offset;
+    _n_flux =
+        _floppy->capture_track(_flux, sizeof(_flux), &index_offset, false, 220);
+    captured_sectors = _floppy->decode_track_gcr(
+        track_data, GCR_APPLE2_SECTORS_PER_TRACK, track_validity, _flux,
+        _n_flux, _order, i == 0);
+  }
+
+  if (captured_sectors != GCR_APPLE2_SECTORS_PER_TRACK) {
+    Serial.printf("Track %d has errors (%d != %d)\n", track, captured_sectors,
+                  GCR_APPLE2_SECTORS_PER_TRACK);
+  }
+  _last_track_read = track;
+  return captured_sectors;
+}
+
+//--------------------------------------------------------------------+
+// SdFat BaseBlockDriver API
+// A block is 512 bytes, two Apple II sectors
+//--------------------------------------------------------------------+
+
+/**************************************************************************/
+/*!
+    @brief   Max capacity in sector block
+    @returns Size of the drive in sector (512 bytes)
+*/
+/**************************************************************************/
+uint32_t Adafruit_GCR_Floppy::sectorCount() {
+  return size() / MFM_BYTES_PER_SECTOR;
+}
+
+/**************************************************************************/
+/*!
+    @brief   Check if device busy
+    @returns true if busy
+*/
+/**************************************************************************/
+bool Adafruit_GCR_Floppy::isBusy() { return false; }
+
+/**************************************************************************/
+/*!
+    @brief  Read a 512 byte block of data, may used cached data
+    @param  block Block number, the same as a ProDOS block number when the
+   sector order is APPLE2_PRODOS_ORDER
+    @param  dst Destination buffer
+    @returns True on success
+*/
+/**************************************************************************/
+bool Adafruit_GCR_Floppy::readSector(uint32_t block, uint8_t *dst) {
+  if (block >= sectorCount()) {
+    return false;
+  }
+
+  constexpr uint32_t sectors_per_block =
+      MFM_BYTES_PER_SECTOR / GCR_APPLE2_BYTES_PER_SECTOR;
+  constexpr uint32_t blocks_per_track =
+      GCR_APPLE2_SECTORS_PER_TRACK / sectors_per_block;
+  uint8_t track = block / blocks_per_track;
+  uint8_t subsector = (block % blocks_per_track) * sectors_per_block;
+
+  if (track != _last_track_read) {
+    // oof it is not cached!
+    if (readTrack(track) == -1) {
+      return false;
+    }
+  }
+
+  for (uint32_t i = 0; i < sectors_per_block; i++) {
+    if (!track_validity[subsector + i]) {
+      return false;
+    }
+  }
+  memcpy(dst, track_data + (subsector * GCR_APPLE2_BYTES_PER_SECTOR),
+         MFM_BYTES_PER_SECTOR);
+
+  return true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Read multiple 512 byte block of data, may used cached data
+    @param  block Starting block number
+    @param  dst Destination buffer
+    @param  nb Number of blocks to read
+    @returns True on success
+*/
+/**************************************************************************/
+bool Adafruit_GCR_Floppy::readSectors(uint32_t block, uint8_t *dst, size_t nb) {
+  // read each block one by one
+  for (size_t blocknum = 0; blocknum < nb; blocknum++) {
+    if (!readSector(block + blocknum, dst + (blocknum * MFM_BYTES_PER_SECTOR)))
+      return false;
+  }
+  return true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Write a 512 byte block of data NOT IMPLEMENTED
+    @param  block Block number
+    @param  src Source buffer
+    @returns False, as writing is unimplemented
+*/
+/**************************************************************************/
+bool Adafruit_GCR_Floppy::writeSector(uint32_t block, const uint8_t *src) {
+  (void)block;
+  (void)src;
+  return false;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Write multiple 512 byte blocks of data NOT IMPLEMENTED
+    @param  block Starting block number
+    @param  src Source buffer
+    @param  nb Number of consecutive blocks to write
+    @returns False, as writing is unimplemented
+*/
+/**************************************************************************/
+bool Adafruit_GCR_Floppy::writeSectors(uint32_t block, const uint8_t *src,
+                                       size_t nb) {
+  (void)block;
+  (void)src;
+  (void)nb;
+  return false;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Nothing to do, as writing is unimplemented
+    @returns True
+*/
+/**************************************************************************/
+bool Adafruit_GCR_Floppy::syncDevice() { return true; }
+
+void Adafruit_GCR_Floppy::removed() {
+  noInterrupts();
+  _tracks = 0;
+  _last_track_read = NO_TRACK;
+  interrupts();
+}
+
+bool Adafruit_GCR_Floppy::inserted() {
+  noInterrupts();
+  _tracks = FLOPPY_APPLE2_TRACKS;
+  _last_track_read = NO_TRACK;
+  interrupts();
+
+  if (readTrack(0) <= 0) {
+    Serial.printf("failed to read track 0\r\n");
+    removed();
+    return false;
+  }
+  return true;
+}
@@ -1,5 +1,7 @@
 #include <Adafruit_Floppy.h>
 
+#include "mfm_impl.h"
+
 /// @cond false
 static const uint16_t flux_rates[] = {2000, 1000, 867, 1667};
 
@@ -106,7 +108,10 @@ uint32_t Adafruit_MFM_Floppy::size(void) const {
 
 /**************************************************************************/
 /*!
-    @brief  Read one track's worth of data and MFM decode it
+    @brief  Read one track's worth of data and MFM decode it. If the sector
+   headers give another cylinder, track 0 is found again and the track read
+   once more; if they still do, the disk is taken to be numbered that way and
+   the sectors are kept.
     @param  logical_track the logical track number, 0 to whatever is the  max
    tracks for the given format during instantiation (e.g. 40 for DD, 80 for HD)
     @param  head which side to read, false for side 1, true for side 2
@@ -132,13 +137,32 @@ int32_t Adafruit_MFM_Floppy::readTrack(int logical_track, bool head) {
   // and change nominal bit time to 0.833 ~= 300/360
   // would be good to auto-detect!
   uint32_t captured_sectors = 0;
+  bool reseeked = false, reseek_done = false;
   for (int i = 0; i < 5 && captured_sectors < _sectors_per_track; i++) {
     int32_t index_offset;
+    uint8_t cylinder = NO_TRACK;
     _n_flux =
         _floppy->capture_track(_flux, sizeof(_flux), &index_offset, false, 220);
-    captured_sectors = _floppy->decode_track_mfm(track_data, _sectors_per_track,
-                                                 track_validity, _flux, _n_flux,
-                                                 _bit_time_ns / 1000.f, i == 0);
+    captured_sectors = decodeFlux(i == 0 || reseeked, &cylinder);
+    reseeked = false;
+    if (cylinder != NO_TRACK && cylinder != logical_track) {
+      Serial.printf("\t[readTrack] Found track %d instead of %d\r\n", cylinder,
+                    logical_track);
+      if (reseek_done) {
+        // still there after finding track 0 again, so the head is in the
+        // right place and the disk is numbered differently: keep the sectors
+        continue;
+      }
+      // the sectors may have come from the wrong track, so the head may not be
+      // where it was thought to be. Find track 0 again and retry.
+      memset(track_validity, 0, sizeof(track_validity));
+      captured_sectors = 0;
+      _floppy->position_lost();
+      if (!_floppy->goto_track(physical_track)) {
+        return -1;
+      }
+      reseeked = reseek_done = true;
+    }
   }
 
   _track_has_errors = (captured_sectors != _sectors_per_track);
@@ -150,6 +174,235 @@ int32_t Adafruit_MFM_Floppy::readTrack(int logical_track, bool head) {
   return captured_sectors;
 }
 
+/**************************************************************************/
+/*!
+    @brief  MFM decode the flux in _flux into track_data, and add the times of
+   the sectors found to _sector_time
+    @param  clear_validity Whether to start afresh, rather than keep the sectors
+   already marked valid in track_validity
+    @param  cylinder Updated with the cylinder number read from the sector
+   headers, if any sector was found
+    @returns Number of valid sectors in track_data
+*/
+/**************************************************************************/
+uint32_t Adafruit_MFM_Floppy::decodeFlux(bool clear_validity,
+                                         uint8_t *cylinder) {
+  if (clear_validity) {
+    memset(_sector_time, 0, sizeof(_sector_time));
+  }
+  size_t positions[MFM_IBMPC1440K_SECTORS_PER_TRACK] = {};
+  uint32_t captured_sectors = _floppy->decode_track_mfm(
+      track_data, _sectors_per_track, track_validity, _flux, _n_flux,
+      _bit_time_ns / 1000.f, clear_validity, cylinder, positions,
+      fusion_buffer);
+  // every capture starts at the index pulse, so times from different
+  // revolutions can be mixed
+  _floppy->sector_times(_flux, _n_flux, positions, _sectors_per_track,
+                        _sector_time);
+  return captured_sectors;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Read every track of the disk, in order from track 0 head 0,
+   handing each to a callback. As soon as the last side of a cylinder has been
+   captured the head starts stepping to the next, and the capture is decoded
+   while the head moves and settles, so that reading each cylinder takes little
+   more than a revolution per side and one step. The step only runs during
+   decoding where a timer steps the head (RP2040); elsewhere it waits for the
+   decode. A track with errors is read again with readTrack before going on,
+   unless retry_errors is false. A track whose sector headers give another
+   cylinder is always read again with readTrack, which finds track 0 first.
+    @param  callback Called with each track once it has been read. Return false
+   from it to stop reading.
+    @param  context Passed to the callback
+    @param  retry_errors Whether to read tracks with errors again before handing
+   them to the callback
+    @returns True if every track was read and passed to the callback, false if
+   a seek failed or the callback stopped the read
+*/
+/**************************************************************************/
+bool Adafruit_MFM_Floppy::readDisk(adafruit_floppy_track_callback_t callback,
+                                   void *context, bool retry_errors) {
+  syncDevice();
+  _last_track_read = NO_TRACK;
+  uint8_t track_step = _double_step ? 2 : 1;
+
+  if (!_floppy->start_goto_track(0)) {
+    return false;
+  }
+  for (int track = 0; track < _tracks_per_side; track++) {
+    bool last_track = track + 1 == _tracks_per_side;
+    for (int head = 0; head < FLOPPY_HEADS; head++) {
+      bool step_now = head == FLOPPY_HEADS - 1 && !last_track;
+      while (!_floppy->seek_done()) {
+        yield();
+      }
+      if (_floppy->track() < 0) {
+        return false;
+      }
+      _floppy->side(head);
+
+      int32_t index_offset;
+      _n_flux = _floppy->capture_track(_flux, sizeof(_flux), &index_offset,
+                                       false, 220);
+      if (step_now) {
+        _floppy->start_goto_track((track + 1) * track_step);
+      }
+      uint8_t cylinder = NO_TRACK;
+      int32_t captured_sectors = decodeFlux(true, &cylinder);
+      _last_track_read = track * FLOPPY_HEADS + head;
+      _track_has_errors = captured_sectors != _sectors_per_track;
+
+      // sectors from another cylinder may mean the head is out of place, in
+      // which case readTrack finds track 0 again. Passing them on as this
+      // track would put them at the wrong place in an image.
+      bool wrong_cylinder = cylinder != NO_TRACK && cylinder != track;
+      if (wrong_cylinder || (retry_errors && _track_has_errors)) {
+        // go back for it, then carry on from where we were going
+        captured_sectors = readTrack(track, head);
+        if (captured_sectors < 0) {
+          return false;
+        }
+        if (step_now && !_floppy->start_goto_track((track + 1) * track_step)) {
+          return false;
+        }
+      }
+
+      if (!callback(context, track, head, track_data, track_validity,
+                    captured_sectors)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Read the whole disk into a sink, such as a file or a USB endpoint,
+   as a raw sector image (an .img file). The disk is read with readDisk without
+   stopping for errors: each track's sectors go to the sink as soon as it is
+   read, with bad sectors as zeros, and are marked in bad_sectors. Then the
+   tracks with bad sectors are read again, up to `retries` times, and each
+   sector recovered goes to the sink a second time at its place in the image.
+   Sectors that were only rebuilt by a bit search, which are less certain to
+   be right, are marked in repaired_sectors.
+    @param  sink Called with each run of sectors and its byte offset in the
+   image. Offsets only go up during the first pass. Return false to stop.
+    @param  context Passed to the sink
+    @param  retries How many more times to read tracks that have bad sectors
+    @returns The number of bad sectors left, or -1 if the disk could not be read
+   or the sink stopped
+*/
+/**************************************************************************/
+int32_t Adafruit_MFM_Floppy::imageDisk(adafruit_floppy_sink_t sink,
+                                       void *context, uint8_t retries) {
+  memset(bad_sectors, 0, sizeof(bad_sectors));
+  memset(repaired_sectors, 0, sizeof(repaired_sectors));
+  _image_sink = sink;
+  _image_context = context;
+  _bad_sector_count = 0;
+  if (!readDisk(imageTrack, this, false)) {
+    return -1;
+  }
+
+  for (uint8_t pass = 0; pass < retries && _bad_sector_count; pass++) {
+    for (int t = 0; t < _tracks_per_side * FLOPPY_HEADS; t++) {
+      uint32_t block = t * _sectors_per_track;
+      bool track_bad = false;
+      for (uint8_t i = 0; i < _sectors_per_track; i++) {
+        track_bad = track_bad || sectorBad(block + i);
+      }
+      if (!track_bad) {
+        continue;
+      }
+      if (readTrack(t / FLOPPY_HEADS, t % FLOPPY_HEADS) < 0) {
+        return -1;
+      }
+      for (uint8_t i = 0; i < _sectors_per_track; i++) {
+        if (!sectorBad(block + i) || !track_validity[i]) {
+          continue;
+        }
+        if (!sink(context, (block + i) * MFM_BYTES_PER_SECTOR,
+                  track_data + i * MFM_BYTES_PER_SECTOR,
+                  MFM_BYTES_PER_SECTOR)) {
+          return -1;
+        }
+        bad_sectors[(block + i) / 8] &= ~(1 << ((block + i) % 8));
+        if (track_validity[i] == mfm_io_sector_search) {
+          repaired_sectors[(block + i) / 8] |= 1 << ((block + i) % 8);
+        }
+        _bad_sector_count--;
+      }
+    }
+  }
+  return _bad_sector_count;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Whether a sector could not be read by the last imageDisk
+    @param  block The sector number in the image
+    @returns True if the sector is bad
+*/
+/**************************************************************************/
+bool Adafruit_MFM_Floppy::sectorBad(uint32_t block) const {
+  return bad_sectors[block / 8] & (1 << (block % 8));
+}
+
+/**************************************************************************/
+/*!
+    @brief  Whether a sector was only read by the last imageDisk by searching
+   the bits where two bad copies of it differ for a combination that passes
+   the CRC check. There is about a 1 in 250 chance that such a sector is wrong.
+    @param  block The sector number in the image
+    @returns True if the sector was repaired by a search
+*/
+/**************************************************************************/
+bool Adafruit_MFM_Floppy::sectorRepaired(uint32_t block) const {
+  return repaired_sectors[block / 8] & (1 << (block % 8));
+}
+
+/**************************************************************************/
+/*!
+    @brief  Pass one track read by imageDisk on to the sink, marking its bad
+   and repaired sectors. The good sectors go in one piece when there are no bad ones.
+*/
+/**************************************************************************/
+bool Adafruit_MFM_Floppy::imageTrack(void *context, int track, bool head,
+                                     const uint8_t *data,
+                                     const uint8_t *validity,
+                                     uint32_t n_valid) {
+  static const uint8_t blank[MFM_BYTES_PER_SECTOR] = {};
+  Adafruit_MFM_Floppy *self = static_cast<Adafruit_MFM_Floppy *>(context);
+  uint8_t n_sectors = self->_sectors_per_track;
+  uint32_t block = (track * FLOPPY_HEADS + head) * n_sectors;
+
+  for (uint8_t i = 0; i < n_sectors; i++) {
+    if (validity[i] == mfm_io_sector_search) {
+      self->repaired_sectors[(block + i) / 8] |= 1 << ((block + i) % 8);
+    }
+  }
+  if (n_valid == n_sectors) {
+    return self->_image_sink(self->_image_context, block * MFM_BYTES_PER_SECTOR,
+                             data, n_sectors * MFM_BYTES_PER_SECTOR);
+  }
+  for (uint8_t i = 0; i < n_sectors; i++) {
+    if (!validity[i]) {
+      self->bad_sectors[(block + i) / 8] |= 1 << ((block + i) % 8);
+      self->_bad_sector_count++;
+    }
+    if (!self->_image_sink(self->_image_context,
+                           (block + i) * MFM_BYTES_PER_SECTOR,
+                           validity[i] ? data + i * MFM_BYTES_PER_SECTOR : blank,
+                           MFM_BYTES_PER_SECTOR)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 //--------------------------------------------------------------------+
 // SdFat BaseBlockDriver API
 // A block is 512 bytes
@@ -272,6 +525,7 @@ bool Adafruit_MFM_Floppy::writeSector(uint32_t block, const uint8_t *src) {
   memcpy(track_data + (subsector * MFM_BYTES_PER_SECTOR), src,
          MFM_BYTES_PER_SECTOR);
   _dirty = true;
+  _dirty_sectors |= 1u << subsector;
   return true;
 }
 
@@ -297,8 +551,10 @@ bool Adafruit_MFM_Floppy::writeSectors(uint32_t block, const uint8_t *src,
 
 /**************************************************************************/
 /*!
-    @brief  Sync written blocks NOT IMPLEMENTED YET
-    @returns True on success, false if failed or unimplemented
+    @brief  Write the cached track back to the disk if it was changed. When
+   verify_writes is true, the track is read back and rewritten up to
+   write_retries times until it matches.
+    @returns True on success, false if the write or the verify failed
 */
 /**************************************************************************/
 bool Adafruit_MFM_Floppy::syncDevice() {
@@ -306,6 +562,8 @@ bool Adafruit_MFM_Floppy::syncDevice() {
     return true;
   }
   _dirty = false;
+  uint32_t dirty_sectors = _dirty_sectors;
+  _dirty_sectors = 0;
 
   int logical_track = _last_track_read / FLOPPY_HEADS;
   int head = _last_track_read % FLOPPY_HEADS;
@@ -329,6 +587,57 @@ bool Adafruit_MFM_Floppy::syncDevice() {
     has_errors = !track_validity[i];
   }
 
+  uint32_t start_us = micros();
+  for (uint8_t retries = 0;; retries++) {
+    bool full_track;
+    if (!writeTrack(dirty_sectors, has_errors, logical_track, &full_track)) {
+      return false;
+    }
+    if (!verify_writes) {
+      return true;
+    }
+    bool verified = verifyTrack(full_track);
+    if (verified || retries == write_retries) {
+      verify_stats.last_verify_us = micros() - start_us;
+      verify_stats.last_retries = retries;
+      if (verified) {
+        verify_stats.verified_tracks++;
+      } else {
+        verify_stats.failed_tracks++;
+      }
+      Serial.printf("Track %d/%d %s in %dus with %d retries\r\n",
+                    logical_track, head, verified ? "verified" : "FAILED",
+                    verify_stats.last_verify_us, retries);
+      return verified;
+    }
+    verify_stats.total_retries++;
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Write the cached track to the disk, without verifying it
+    @param  dirty_sectors Bitmask of the sectors changed since the last sync
+    @param  has_errors True if some sectors of the track could not be read
+    @param  logical_track The logical track number, for the sector headers
+    @param  full_track Set to true if the whole track was written, or false if
+   only the changed sectors were spliced in
+    @returns True on success
+*/
+/**************************************************************************/
+bool Adafruit_MFM_Floppy::writeTrack(uint32_t dirty_sectors, bool has_errors,
+                                     int logical_track, bool *full_track) {
+  *full_track = false;
+  // Rewriting one sector in place costs one revolution, the same as a full
+  // track write, but can't damage the other sectors if the write is
+  // interrupted. With several changed sectors a full track write is faster.
+  if (splice_writes &&
+      (has_errors || __builtin_popcount(dirty_sectors) == 1)) {
+    if (spliceSectors(dirty_sectors)) {
+      return true;
+    }
+  }
+
   if (has_errors) {
     Serial.printf(
         "Can't do a non-full track write to track with read errors\n");
@@ -336,21 +645,117 @@ bool Adafruit_MFM_Floppy::syncDevice() {
   }
   _n_flux = _floppy->encode_track_mfm(track_data, _sectors_per_track, _flux,
                                       sizeof(_flux), _high_density ? 1.f : 2.f,
-                                      logical_track);
+                                      logical_track, interleave, cylinder_skew,
+                                      head_skew);
 
+  // the sectors move, so the times measured by readTrack no longer apply
+  memset(_sector_time, 0, sizeof(_sector_time));
   if (!_floppy->write_track(_flux, _n_flux, false)) {
     Serial.println("failed to write track");
     return false;
   }
 
+  *full_track = true;
   return true;
 }
 
+/**************************************************************************/
+/*!
+    @brief  Rewrite just the data field of each changed sector, leaving the
+   rest of the track as it is
+    @param  dirty_sectors Bitmask of the sectors to write
+    @returns False if nothing was written because the position of a sector is
+   not known
+*/
+/**************************************************************************/
+bool Adafruit_MFM_Floppy::spliceSectors(uint32_t dirty_sectors) {
+  uint32_t sample_freq = _floppy->getSampleFrequency();
+
+  for (size_t i = 0; i < _sectors_per_track; i++) {
+    if ((dirty_sectors & (1u << i)) && !_sector_time[i]) {
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < _sectors_per_track; i++) {
+    if (!(dirty_sectors & (1u << i))) {
+      continue;
+    }
+    uint32_t lead_counts;
+    _n_flux = _floppy->encode_sector_mfm(
+        track_data + i * MFM_BYTES_PER_SECTOR, _flux, sizeof(_flux),
+        _bit_time_ns / 1000.f, &lead_counts);
+    if (_sector_time[i] <= lead_counts) {
+      return false;
+    }
+    uint32_t delay_us =
+        (uint64_t)(_sector_time[i] - lead_counts) * 1000000 / sample_freq;
+    Serial.printf("Splicing sector %d at %dus after index\r\n", i, delay_us);
+    if (!_floppy->write_track(_flux, _n_flux, false, true, delay_us)) {
+      Serial.println("failed to write sector");
+      return false;
+    }
+  }
+  return true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Read back the track just written and compare it with track_data.
+   A full track write ends at the index pulse, so the capture starts at once
+   and the write and its verify take two revolutions. After splicing, the
+   capture waits for the next index pulse, as the splices end partway round.
+    @param  full_track True if the whole track was just written
+    @returns True if every sector in track_validity read back with the data in
+   track_data. The time of each sector that did not is forgotten, so that a
+   retry rewrites the whole track rather than splice by a stale position.
+*/
+/**************************************************************************/
+bool Adafruit_MFM_Floppy::verifyTrack(bool full_track) {
+  // decode into the end of the flux buffer rather than needing another track
+  // sized buffer; one revolution of flux still fits in the rest
+  const size_t data_size = _sectors_per_track * MFM_BYTES_PER_SECTOR;
+  uint8_t *data = _flux + sizeof(_flux) - data_size;
+  uint8_t validity[MFM_IBMPC1440K_SECTORS_PER_TRACK];
+  int32_t index_offset;
+
+  size_t positions[MFM_IBMPC1440K_SECTORS_PER_TRACK] = {};
+
+  // right after a full track write the capture starts close enough to the
+  // index to take the sector times from
+  _n_flux = _floppy->capture_track(_flux, sizeof(_flux) - data_size,
+                                   &index_offset, false, 220,
+                                   full_track ? 0 : 250);
+  _floppy->decode_track_mfm(data, _sectors_per_track, validity, _flux, _n_flux,
+                            _bit_time_ns / 1000.f, true, nullptr, positions);
+  // a full track write moved the sectors; this is where they are now
+  _floppy->sector_times(_flux, _n_flux, positions, _sectors_per_track,
+                        _sector_time);
+
+  bool ok = true;
+  for (size_t i = 0; i < _sectors_per_track; i++) {
+    if (!track_validity[i]) {
+      continue;
+    }
+    size_t offset = i * MFM_BYTES_PER_SECTOR;
+    if (!validity[i] ||
+        memcmp(data + offset, track_data + offset, MFM_BYTES_PER_SECTOR)) {
+      Serial.printf("Sector %d failed to verify\r\n", i);
+      // whatever was found there isn't this sector, so don't splice the retry
+      // by it
+      _sector_time[i] = 0;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
 void Adafruit_MFM_Floppy::removed() {
   noInterrupts();
   _tracks_per_side = 0;
   _last_track_read = NO_TRACK;
   _dirty = false;
+  _dirty_sectors = 0;
   interrupts();
 }
 
@@ -384,6 +789,7 @@ bool Adafruit_MFM_Floppy::autodetect() {
       _tracks_per_side = total_logical_sectors / heads / _sectors_per_track;
       _last_track_read = NO_TRACK;
       _dirty = false;
+      _dirty_sectors = 0;
 
       if (_tracks_per_side <= 40) {
         _floppy->goto_track(2);
@@ -430,8 +836,130 @@ bool Adafruit_MFM_Floppy::inserted(adafruit_floppy_disk_t floppy_type) {
   _bit_time_ns = info.bit_time_ns;
   _last_track_read = NO_TRACK;
   _dirty = false;
+  _dirty_sectors = 0;
   interrupts();
 
   return true;
   // TODO: set up double stepping on HD 5.25 drives with 360kB media inserted
 }
+
+/**************************************************************************/
+/*!
+    @brief  Seek to each track in turn, checking the cylinder number in the
+   sector headers read there
+    @param  tracks The logical tracks to visit
+    @param  n_tracks How many there are
+    @param  all_sectors Whether every sector must also read correctly the
+   first time, as it won't while the head is still settling
+    @returns True if every track was reached
+*/
+/**************************************************************************/
+bool Adafruit_MFM_Floppy::seekCheck(const uint8_t *tracks, size_t n_tracks,
+                                    bool all_sectors) {
+  for (size_t i = 0; i < n_tracks; i++) {
+    uint8_t logical_track = tracks[i];
+    if (!_floppy->goto_track(_double_step ? 2 * logical_track
+                                          : logical_track)) {
+      return false;
+    }
+    int32_t index_offset;
+    uint8_t cylinder = NO_TRACK;
+    _n_flux =
+        _floppy->capture_track(_flux, sizeof(_flux), &index_offset, false, 220);
+    size_t n = _floppy->decode_track_mfm(
+        track_data, _sectors_per_track, track_validity, _flux, _n_flux,
+        _bit_time_ns / 1000.f, true, &cylinder);
+    if (cylinder != logical_track ||
+        (all_sectors && n != _sectors_per_track)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Lower one of the seek times by a quarter at a time for as long as
+   seekCheck still passes, leaving it at the lowest time that did
+    @param  value The time in the profile being calibrated
+    @param  min_value The lowest time to try
+    @param  tracks The logical tracks to visit
+    @param  n_tracks How many there are
+    @param  all_sectors As for seekCheck
+*/
+/**************************************************************************/
+void Adafruit_MFM_Floppy::calibrateTime(uint32_t *value, uint32_t min_value,
+                                        const uint8_t *tracks, size_t n_tracks,
+                                        bool all_sectors) {
+  uint32_t good = *value;
+  while (good * 3 / 4 >= min_value) {
+    *value = good * 3 / 4;
+    if (!seekCheck(tracks, n_tracks, all_sectors)) {
+      break;
+    }
+    good = *value;
+  }
+  *value = good;
+  // a failed check may have lost track of the head
+  _floppy->goto_track(0);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Find the fastest head step and settle times that this drive still
+   seeks reliably with. The inserted disk is read all over to check that each
+   seek lands on the right cylinder and has settled, so it must be in this
+   object's format, and its cached track is thrown away. Calibration starts
+   from the drive's seek profile in use, and a quarter is added to the times
+   found as a safety margin. Save the result for the drive model, for example
+   as a constant in the sketch, and use it as Adafruit_Floppy::seek_profile.
+    @param  profile Set to the times found
+    @returns False if the disk can't be read with the times in use already
+*/
+/**************************************************************************/
+bool Adafruit_MFM_Floppy::calibrate_seek(seek_io_profile_t *profile) {
+  if (!_sectors_per_track || _tracks_per_side < 20) {
+    return false;
+  }
+  syncDevice();
+  _last_track_read = NO_TRACK;
+  _floppy->side(0);
+
+  seek_io_profile_t trial = _floppy->get_seek_profile();
+  const seek_io_profile_t *saved = _floppy->seek_profile;
+  _floppy->seek_profile = &trial;
+
+  uint8_t last = _tracks_per_side - 1;
+  // long seeks, where the step rate matters most
+  const uint8_t long_seeks[] = {0, last, 1, (uint8_t)(last / 2), last};
+  // short seeks that turn around, where the first step and reversal matter
+  const uint8_t short_seeks[] = {10, 12, 11, 13, 12, 10};
+
+  bool ok = _floppy->goto_track(0) &&
+            seekCheck(long_seeks, sizeof(long_seeks), true);
+  if (ok) {
+    calibrateTime(&trial.step_us, 1000, long_seeks, sizeof(long_seeks), false);
+    calibrateTime(&trial.first_step_us, trial.step_us, short_seeks,
+                  sizeof(short_seeks), false);
+    calibrateTime(&trial.reverse_us, trial.step_us, short_seeks,
+                  sizeof(short_seeks), false);
+    for (size_t i = 0; i < seek_io_n_settle; i++) {
+      uint8_t distance = seek_io_settle_steps[i];
+      const uint8_t seeks[] = {2, (uint8_t)(2 + distance), 2,
+                               (uint8_t)(2 + distance)};
+      calibrateTime(&trial.settle_us[i], 1000, seeks, sizeof(seeks), true);
+    }
+
+    trial.first_step_us += trial.first_step_us / 4;
+    trial.step_us += trial.step_us / 4;
+    trial.reverse_us += trial.reverse_us / 4;
+    for (size_t i = 0; i < seek_io_n_settle; i++) {
+      trial.settle_us[i] += trial.settle_us[i] / 4;
+    }
+    *profile = trial;
+  }
+
+  _floppy->seek_profile = saved;
+  _floppy->goto_track(0);
+  return ok;
+}
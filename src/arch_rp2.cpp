@@ -3,8 +3,11 @@
 #include "greasepack.h"
 #include <Arduino.h>
 #include <hardware/clocks.h>
+#include <hardware/dma.h>
 #include <hardware/gpio.h>
 #include <hardware/pio.h>
+#include <hardware/timer.h>
+#include <pico/time.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
@@ -182,6 +185,146 @@ static void free_capture(void) {
   memset(&g_reader, 0, sizeof(g_reader));
 }
 
+// DMA capture: a DMA channel copies the capture FIFO into a ring, and the
+// samples are turned into flux a block at a time with interrupts left on.
+// Each 16-bit sample is the inverted count at a flux transition, shifted up
+// one, with the index pin in bit 0.
+enum { capture_ring_bits = 12 }; // 4kB, about 6ms of HD flux
+enum { capture_ring_samples = (1 << capture_ring_bits) / sizeof(uint16_t) };
+static uint16_t g_capture_ring[capture_ring_samples]
+    __attribute__((aligned(1 << capture_ring_bits)));
+// The transfer count the DMA channel starts from. On the RP2350 the top 4 bits
+// of the count select the mode, and all 1s there would never count down.
+static const uint32_t capture_dma_count = 0x0fffffff;
+
+typedef struct {
+  uint8_t *start, *ptr, *end;
+  int32_t *falling_index_offset;
+  bool store_greaseweazle;
+  uint32_t capture_counts, total_counts;
+  uint16_t last;
+  bool last_index;
+  uint16_t block[64];
+  size_t n_block;
+} capture_sink_t;
+
+static void flush_capture_block(capture_sink_t *sink) {
+  if (sink->store_greaseweazle) {
+    sink->ptr = greasepack_u16(sink->ptr, sink->end, sink->block,
+                               sink->n_block);
+  } else {
+    for (size_t i = 0; i < sink->n_block && sink->ptr != sink->end; i++) {
+      uint16_t delta = sink->block[i];
+      *sink->ptr++ = delta > 255 ? 255 : delta;
+    }
+  }
+  sink->n_block = 0;
+}
+
+// Add samples to the flux, returning false once the capture is complete
+static bool capture_samples(capture_sink_t *sink, const uint16_t *samples,
+                            size_t n) {
+  bool more = true;
+  for (size_t i = 0; i < n && more; i++) {
+    uint16_t data = samples[i];
+    bool index = data & 1;
+    if (!index && sink->last_index && sink->falling_index_offset) {
+      flush_capture_block(sink);
+      *sink->falling_index_offset = sink->ptr - sink->start;
+      if (!sink->capture_counts) {
+        return false;
+      }
+    }
+    sink->last_index = index;
+
+    uint16_t delta = (uint16_t)(sink->last - data) / 2;
+    sink->last = data;
+    sink->total_counts += delta;
+    sink->block[sink->n_block++] = delta;
+    more = !sink->capture_counts || sink->total_counts < sink->capture_counts;
+    if (sink->n_block == sizeof(sink->block) / sizeof(sink->block[0])) {
+      flush_capture_block(sink);
+    }
+  }
+  flush_capture_block(sink);
+  return more && sink->ptr != sink->end;
+}
+
+static uint8_t *capture_dma(int channel, int index_pin, uint8_t *start,
+                            uint8_t *end, int32_t *falling_index_offset,
+                            bool store_greaseweazle, uint32_t capture_counts) {
+  capture_sink_t sink = {};
+  sink.start = sink.ptr = start;
+  sink.end = end;
+  sink.falling_index_offset = falling_index_offset;
+  sink.store_greaseweazle = store_greaseweazle;
+  sink.capture_counts = capture_counts;
+
+  pio_sm_clear_fifos(g_reader.pio, g_reader.sm);
+  dma_channel_config c = dma_channel_get_default_config(channel);
+  channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+  channel_config_set_read_increment(&c, false);
+  channel_config_set_write_increment(&c, true);
+  channel_config_set_ring(&c, true, capture_ring_bits);
+  channel_config_set_dreq(&c, pio_get_dreq(g_reader.pio, g_reader.sm, false));
+  // far more words than a capture ever takes
+  dma_channel_configure(channel, &c, g_capture_ring,
+                        &g_reader.pio->rxf[g_reader.sm], capture_dma_count,
+                        true);
+  pio_sm_set_enabled(g_reader.pio, g_reader.sm, true);
+
+  // Samples are read in pairs as the DMA writes them, and the count of words
+  // written, which only goes up, tells how far it has got even if the ring
+  // has wrapped
+  dma_channel_hw_t *hw = dma_channel_hw_addr(channel);
+  uint32_t read = 0;
+  bool started = false;
+  bool last_index = gpio_get(index_pin);
+  while (true) {
+    uint32_t written =
+        capture_dma_count - (hw->transfer_count & capture_dma_count);
+    if (written - read > capture_ring_samples / 2) {
+      // fell a whole ring behind, so the flux from here on is lost
+      break;
+    }
+    if (written == read) {
+      // no flux at all: stop at the index, as the polled capture would
+      bool index = gpio_get(index_pin);
+      if (!started && !index && last_index && falling_index_offset) {
+        *falling_index_offset = 0;
+        if (!capture_counts) {
+          break;
+        }
+      }
+      last_index = index;
+      continue;
+    }
+    size_t pos = (read * 2) % capture_ring_samples;
+    size_t n = written - read;
+    if (n > (capture_ring_samples - pos) / 2) {
+      n = (capture_ring_samples - pos) / 2;
+    }
+    const uint16_t *samples = g_capture_ring + pos;
+    read += n;
+    n *= 2;
+    if (!started) {
+      // the first sample is only where counting starts
+      sink.last = samples[0];
+      sink.last_index = samples[0] & 1;
+      samples++;
+      n--;
+      started = true;
+    }
+    if (!capture_samples(&sink, samples, n)) {
+      break;
+    }
+  }
+
+  dma_channel_abort(channel);
+  disable_capture();
+  return sink.ptr;
+}
+
 static uint8_t *capture_foreground(int index_pin, uint8_t *start, uint8_t *end,
                                    int32_t *falling_index_offset,
                                    bool store_greaseweazle,
@@ -212,6 +355,15 @@ static uint8_t *capture_foreground(int index_pin, uint8_t *start, uint8_t *end,
 
   uint32_t total_counts = 0;
 
+  int channel = dma_claim_unused_channel(false);
+  if (channel != -1) {
+    ptr = capture_dma(channel, index_pin, start, end, falling_index_offset,
+                      store_greaseweazle, capture_counts);
+    dma_channel_unclaim(channel);
+    return ptr;
+  }
+
+  // no DMA channel free, so poll the FIFO with interrupts off
   noInterrupts();
   pio_sm_clear_fifos(g_reader.pio, g_reader.sm);
   pio_sm_set_enabled(g_reader.pio, g_reader.sm, true);
@@ -316,9 +468,38 @@ static void disable_write() {
   pio_sm_set_enabled(g_writer.pio, g_writer.sm, false);
 }
 
+// The flux being written, unpacked a block at a time well ahead of the FIFO
+typedef struct {
+  uint8_t *pulses, *pulse_end;
+  bool store_greaseweazle;
+  uint16_t block[32];
+  size_t pos, len;
+} write_source_t;
+
+// Fill the write FIFO, returning false once the flux has run out
+static bool fill_write_fifo(write_source_t *source) {
+  while (!pio_sm_is_tx_fifo_full(g_writer.pio, g_writer.sm)) {
+    if (source->pos == source->len) {
+      source->len = greaseunpack_u16(
+          source->block, sizeof(source->block) / sizeof(source->block[0]),
+          &source->pulses, source->pulse_end, source->store_greaseweazle);
+      source->pos = 0;
+      if (!source->len) {
+        return false;
+      }
+      for (size_t i = 0; i < source->len; i++) {
+        uint16_t value = source->block[i];
+        source->block[i] = (value < OVERHEAD) ? 1 : value - OVERHEAD;
+      }
+    }
+    pio_sm_put(g_writer.pio, g_writer.sm, source->block[source->pos++]);
+  }
+  return true;
+}
+
 static void write_foreground(int index_pin, int wrgate_pin, uint8_t *pulses,
                              uint8_t *pulse_end, bool store_greaseweazle,
-                             bool use_index) {
+                             bool use_index, uint32_t index_delay_us) {
 
   if (use_index) {
     // don't start during an index pulse
@@ -329,34 +510,37 @@ static void write_foreground(int index_pin, int wrgate_pin, uint8_t *pulses,
     while (gpio_get(index_pin)) { /* NOTHING */
     }
   }
+  uint32_t index_time = time_us_32();
+
+  noInterrupts();
+  // splicing in part of a track: time the write gate from the index pulse
+  while (time_us_32() - index_time < index_delay_us) { /* NOTHING */
+  }
   pinMode(wrgate_pin, OUTPUT);
   digitalWrite(wrgate_pin, LOW);
 
-  noInterrupts();
   pio_sm_set_enabled(g_writer.pio, g_writer.sm, false);
   pio_sm_clear_fifos(g_writer.pio, g_writer.sm);
   pio_sm_exec(g_writer.pio, g_writer.sm, g_writer.offset);
-  while (!pio_sm_is_tx_fifo_full(g_writer.pio, g_writer.sm)) {
-    unsigned value = greaseunpack(&pulses, pulse_end, store_greaseweazle);
-    value = (value < OVERHEAD) ? 1 : value - OVERHEAD;
-    pio_sm_put_blocking(g_writer.pio, g_writer.sm, value);
-  }
+  write_source_t source = {pulses, pulse_end, store_greaseweazle};
+  bool more = fill_write_fifo(&source);
   pio_sm_set_enabled(g_writer.pio, g_writer.sm, true);
 
   bool old_index_state = false;
-  while (pulses != pulse_end) {
+  while (more) {
     bool index_state = gpio_get(index_pin);
     if (old_index_state && !index_state) {
       // falling edge of index pin
       break;
     }
-    while (!pio_sm_is_tx_fifo_full(g_writer.pio, g_writer.sm)) {
-      unsigned value = greaseunpack(&pulses, pulse_end, store_greaseweazle);
-      value = (value < OVERHEAD) ? 1 : value - OVERHEAD;
-      pio_sm_put_blocking(g_writer.pio, g_writer.sm, value);
-    }
+    more = fill_write_fifo(&source);
     old_index_state = index_state;
   }
+  if (!more) {
+    // ran out of flux before the index, let the last of it get written
+    while (!pio_sm_is_tx_fifo_empty(g_writer.pio, g_writer.sm)) { /* NOTHING */
+    }
+  }
   interrupts();
 
   pio_sm_set_enabled(g_writer.pio, g_writer.sm, false);
@@ -374,9 +558,62 @@ static void free_write() {
   memset(&g_writer, 0, sizeof(g_writer));
 }
 
+// The seek in progress, stepped along by a hardware alarm
+static seek_io_t *g_seek;
+static int g_seek_dir_pin, g_seek_step_pin;
+static volatile bool g_seek_alarm_armed;
+
+static int64_t seek_alarm(alarm_id_t id, void *user_data) {
+  (void)id;
+  (void)user_data;
+  seek_io_action_t action;
+  while ((action = seek_io_poll(g_seek, time_us_32())) != seek_io_none) {
+    switch (action) {
+    case seek_io_set_direction:
+      gpio_put(g_seek_dir_pin, !g_seek->dir_in); // low is in
+      break;
+    case seek_io_step_start:
+      gpio_put(g_seek_step_pin, 0);
+      break;
+    case seek_io_step_end:
+      gpio_put(g_seek_step_pin, 1);
+      break;
+    default:
+      break;
+    }
+  }
+  if (!seek_io_busy(g_seek)) {
+    g_seek_alarm_armed = false;
+    return 0;
+  }
+  // rescheduled this many us after returning
+  uint32_t wait = seek_io_wait(g_seek, time_us_32());
+  return wait ? wait : 1;
+}
+
 #ifdef __cplusplus
 #include <Adafruit_Floppy.h>
 
+// Carry out a seek already started with seek_io_start from a hardware alarm,
+// returning false if no alarm is free and the caller must poll instead
+bool rp2040_seek_run(seek_io_t *seek, int dir_pin, int step_pin) {
+  if (g_seek_alarm_armed) {
+    return g_seek == seek;
+  }
+  if (!seek_io_busy(seek)) {
+    return true;
+  }
+  g_seek = seek;
+  g_seek_dir_pin = dir_pin;
+  g_seek_step_pin = step_pin;
+  g_seek_alarm_armed = true;
+  if (add_alarm_in_us(0, seek_alarm, NULL, true) < 0) {
+    g_seek_alarm_armed = false;
+    return false;
+  }
+  return true;
+}
+
 uint32_t rp2040_flux_capture(int index_pin, int rdpin, volatile uint8_t *pulses,
                              volatile uint8_t *pulse_end,
                              int32_t *falling_index_offset,
@@ -426,13 +663,14 @@ uint16_t mfm_io_sample_flux(bool *index) {
 
 bool rp2040_flux_write(int index_pin, int wrgate_pin, int wrdata_pin,
                        uint8_t *pulses, uint8_t *pulse_end,
-                       bool store_greaseweazle, bool is_apple2,
-                       bool use_index) {
+                       bool store_greaseweazle, bool is_apple2, bool use_index,
+                       uint32_t index_delay_us) {
   if (!init_write(wrdata_pin, is_apple2)) {
     return false;
   }
   write_foreground(index_pin, wrgate_pin, (uint8_t *)pulses,
-                   (uint8_t *)pulse_end, store_greaseweazle, use_index);
+                   (uint8_t *)pulse_end, store_greaseweazle, use_index,
+                   index_delay_us);
   free_write();
   return true;
 }
@@ -10,6 +10,7 @@ extern "C" {
 #define clr_debug_led() gpio_put(led_pin, 0)
 #define set_write() gpio_put(_wrdatapin, 1)
 #define clr_write() gpio_put(_wrdatapin, 0)
+#include "seek_impl.h"
 #include <stdint.h>
 extern uint32_t
 rp2040_flux_capture(int indexpin, int rdpin, volatile uint8_t *pulses,
@@ -19,7 +20,8 @@ rp2040_flux_capture(int indexpin, int rdpin, volatile uint8_t *pulses,
 extern bool rp2040_flux_write(int index_pin, int wrgate_pin, int wrdata_pin,
                               uint8_t *pulses, uint8_t *pulse_end,
                               bool store_greaseweazel, bool is_apple2,
-                              bool use_index);
+                              bool use_index, uint32_t index_delay_us);
+extern bool rp2040_seek_run(seek_io_t *seek, int dir_pin, int step_pin);
 #endif
 
 #if defined(__cplusplus)
@@ -1,5 +1,8 @@
 #if defined(__SAMD51__)
+#include "arch_samd51.h"
+#include "greasepack.h"
 #include <Adafruit_Floppy.h>
+#include <Adafruit_ZeroDMA.h>
 #include <wiring_private.h> // pinPeripheral() func
 
 static const struct {
@@ -7,21 +10,23 @@ static const struct {
   IRQn_Type IRQn; // Interrupt number
   int gclk;       // GCLK ID
   int evu;        // EVSYS user ID
-} tcList[] = {{TC0, TC0_IRQn, TC0_GCLK_ID, EVSYS_ID_USER_TC0_EVU},
-              {TC1, TC1_IRQn, TC1_GCLK_ID, EVSYS_ID_USER_TC1_EVU},
-              {TC2, TC2_IRQn, TC2_GCLK_ID, EVSYS_ID_USER_TC2_EVU},
-              {TC3, TC3_IRQn, TC3_GCLK_ID, EVSYS_ID_USER_TC3_EVU},
+  int dmac;       // DMAC trigger on a CC0 capture
+} tcList[] = {
+    {TC0, TC0_IRQn, TC0_GCLK_ID, EVSYS_ID_USER_TC0_EVU, TC0_DMAC_ID_MC_0},
+    {TC1, TC1_IRQn, TC1_GCLK_ID, EVSYS_ID_USER_TC1_EVU, TC1_DMAC_ID_MC_0},
+    {TC2, TC2_IRQn, TC2_GCLK_ID, EVSYS_ID_USER_TC2_EVU, TC2_DMAC_ID_MC_0},
+    {TC3, TC3_IRQn, TC3_GCLK_ID, EVSYS_ID_USER_TC3_EVU, TC3_DMAC_ID_MC_0},
 #ifdef TC4
-              {TC4, TC4_IRQn, TC4_GCLK_ID, EVSYS_ID_USER_TC4_EVU},
+    {TC4, TC4_IRQn, TC4_GCLK_ID, EVSYS_ID_USER_TC4_EVU, TC4_DMAC_ID_MC_0},
 #endif
 #ifdef TC5
-              {TC5, TC5_IRQn, TC5_GCLK_ID, EVSYS_ID_USER_TC5_EVU},
+    {TC5, TC5_IRQn, TC5_GCLK_ID, EVSYS_ID_USER_TC5_EVU, TC5_DMAC_ID_MC_0},
 #endif
 #ifdef TC6
-              {TC6, TC6_IRQn, TC6_GCLK_ID, EVSYS_ID_USER_TC6_EVU},
+    {TC6, TC6_IRQn, TC6_GCLK_ID, EVSYS_ID_USER_TC6_EVU, TC6_DMAC_ID_MC_0},
 #endif
 #ifdef TC7
-              {TC7, TC7_IRQn, TC7_GCLK_ID, EVSYS_ID_USER_TC7_EVU}
+    {TC7, TC7_IRQn, TC7_GCLK_ID, EVSYS_ID_USER_TC7_EVU, TC7_DMAC_ID_MC_0}
 #endif
 };
 
@@ -33,6 +38,9 @@ volatile uint8_t *g_flux_pulses = NULL;
 volatile uint32_t g_max_pulses = 0;
 volatile uint32_t g_n_pulses = 0;
 volatile bool g_store_greaseweazle = false;
+// Flux is kept in units of 2 timer counts, 24MHz, by every capture and write
+// path alike. At 48MHz an 8-bit pulse could be no longer than 5.3us, too
+// short for the 8us pulses of double density disks.
 volatile uint8_t g_timing_div = 2;
 volatile bool g_writing_pulses = false;
 
@@ -42,27 +50,12 @@ void FLOPPY_TC_HANDLER() // Interrupt Service Routine (ISR) for timer TCx
   if (theReadTimer && theReadTimer->COUNT16.INTFLAG.bit.MC0) {
     uint16_t ticks =
         theReadTimer->COUNT16.CC[0].reg / g_timing_div; // Copy the period
-    if (ticks == 0) {
-      // dont do something if its 0 - thats wierd!
-    } else if (ticks < 250 || !g_store_greaseweazle) {
-      // 1-249: One byte.
-      g_flux_pulses[g_n_pulses++] = min(249, ticks);
-    } else {
-      uint8_t high = (ticks - 250) / 255;
-      if (high < 5) {
-        // 250-1524: Two bytes.
-        g_flux_pulses[g_n_pulses++] = 250 + high;
-        g_flux_pulses[g_n_pulses++] = 1 + ((ticks - 250) % 255);
-      } else {
-        // TODO MEME FIX!
-        /* 1525-(2^28-1): Seven bytes.
-        g_flux_pulses[g_n_pulses++] = 0xff;
-        g_flux_pulses[g_n_pulses++] = FLUXOP_SPACE;
-        _write_28bit(ticks - 249);
-        u_buf[U_MASK(u_prod++)] = 249;
-        }
-        */
-      }
+    // dont do something if its 0 - thats wierd!
+    if (ticks != 0) {
+      uint32_t n = g_n_pulses;
+      greasepack_capture((uint8_t *)g_flux_pulses, g_max_pulses, &n, ticks,
+                         g_store_greaseweazle);
+      g_n_pulses = n;
     }
   }
 
@@ -82,27 +75,18 @@ void FLOPPY_TC_HANDLER() // Interrupt Service Routine (ISR) for timer TCx
     // the interrupt.
     if (g_n_pulses < g_max_pulses) {
       // Set period for next pulse
-
-      uint16_t ticks = g_flux_pulses[g_n_pulses];
-      if (ticks == 0) {
-        // dont do something if its 0 - thats wierd!
-      } else if (ticks < 250 || !g_store_greaseweazle) {
-        // 1-249: One byte.
-        ticks = min(249, ticks);
-      } else {
-        // 250-1524: Two bytes.
-        uint16_t high = ((ticks - 250) + 1) * 255;
-        g_n_pulses++;
-        ticks = high + g_flux_pulses[g_n_pulses];
-      }
-      theWriteTimer->COUNT16.CCBUF[0].reg = ticks;
+      uint32_t n = g_n_pulses;
+      theWriteTimer->COUNT16.CCBUF[0].reg = greaseunpack_write(
+          (uint8_t *)g_flux_pulses, g_max_pulses, &n, g_store_greaseweazle);
+      g_n_pulses = n;
     } else if (g_n_pulses > g_max_pulses) {
       // Last pulse out was allowed its one extra PWM cycle, done now
       theWriteTimer->COUNT16.CCBUF[1].reg = 0;     // Steady high on next pulse
       theWriteTimer->COUNT16.INTENCLR.bit.MC0 = 1; // Disable interrupt
       g_writing_pulses = false;
+    } else {
+      g_n_pulses++; // the last pulse gets its one extra PWM cycle
     }
-    g_n_pulses++; // Outside if/else to allow last-pulse case
     theWriteTimer->COUNT16.INTFLAG.bit.MC0 = 1; // Clear interrupt flag
   }
 }
@@ -253,6 +237,153 @@ static void enable_capture_timer(bool interrupt_driven) {
     ; // Wait for synchronization
 }
 
+// DMA capture: the DMAC copies each period the timer captures into a ring, so
+// there's no interrupt per flux transition, and samd51_dma_capture_poll moves
+// them out in bulk into the flux buffer. Periods are never 0, so a 0 marks a
+// slot that hasn't been filled since it was last read. An interrupt at the
+// end of each lap of the ring, with the DMAC's count of what's left of the
+// lap, tells how many periods have been written in all, so that the reader
+// can tell if it fell a whole ring behind.
+enum { capture_ring_size = 4096 }; // about 8ms of HD flux
+static Adafruit_ZeroDMA g_capture_dma;
+static DmacDescriptor *g_capture_descriptor;
+static bool g_capture_dma_allocated, g_capture_dma_running;
+static bool g_capture_overrun;
+static volatile uint16_t g_capture_ring[capture_ring_size];
+static volatile uint32_t g_capture_laps;
+static uint32_t g_capture_read; // periods taken out of the ring in all
+
+static void capture_dma_lap(Adafruit_ZeroDMA *dma) {
+  (void)dma;
+  g_capture_laps++;
+}
+
+// How many periods the DMAC has written in all. Between the end of a lap and
+// its interrupt this is a lap short, which only ever hides an overrun for a
+// moment.
+static uint32_t capture_dma_written(void) {
+  DmacDescriptor *writeback =
+      (DmacDescriptor *)DMAC->WRBADDR.reg + g_capture_dma.getChannel();
+  uint32_t laps, left;
+  do {
+    laps = g_capture_laps;
+    left = writeback->BTCNT.reg;
+  } while (laps != g_capture_laps);
+  return laps * capture_ring_size + capture_ring_size - left;
+}
+
+/*!
+    @brief  Start capturing flux into g_flux_pulses by DMA, once the capture
+   timer is set up
+    @return False if there's no DMA channel free, in which case capture is left
+   to the interrupt
+*/
+bool samd51_dma_capture_start(void) {
+  if (!theReadTimer) {
+    return false;
+  }
+  if (!g_capture_dma_allocated) {
+    if (g_capture_dma.allocate() != DMA_STATUS_OK) {
+      return false;
+    }
+    g_capture_descriptor = g_capture_dma.addDescriptor(
+        (void *)&theReadTimer->COUNT16.CC[0].reg, (void *)g_capture_ring,
+        capture_ring_size, DMA_BEAT_SIZE_HWORD, false, true);
+    // interrupt at the end of each lap, to count them
+    g_capture_descriptor->BTCTRL.bit.BLOCKACT = DMA_BLOCK_ACTION_INT;
+    g_capture_dma.loop(true);
+    g_capture_dma.setCallback(capture_dma_lap);
+    g_capture_dma_allocated = true;
+  } else {
+    // the timer may be a different one from last time
+    g_capture_dma.changeDescriptor(
+        g_capture_descriptor, (void *)&theReadTimer->COUNT16.CC[0].reg,
+        (void *)g_capture_ring, capture_ring_size);
+  }
+  g_capture_dma.setTrigger(tcList[g_cap_tc_num].dmac);
+  g_capture_dma.setAction(DMA_TRIGGER_ACTON_BEAT);
+
+  memset((void *)g_capture_ring, 0, sizeof(g_capture_ring));
+  g_capture_read = 0;
+  g_capture_laps = 0;
+  g_capture_overrun = false;
+  if (g_capture_dma.startJob() != DMA_STATUS_OK) {
+    return false;
+  }
+  g_capture_dma_running = true;
+  enable_capture_timer(false);
+  return true;
+}
+
+/*!
+    @brief  Move the periods captured by DMA since the last call into
+   g_flux_pulses. Does nothing if capture isn't by DMA.
+    @return False if the DMA capture has stopped because this wasn't called
+   often enough and the ring overflowed. The flux up to that point is kept.
+*/
+bool samd51_dma_capture_poll(void) {
+  if (!g_capture_dma_running) {
+    return !g_capture_overrun;
+  }
+  uint16_t block[64];
+  while (true) {
+    uint32_t read = g_capture_read;
+    size_t n = 0;
+    while (n < sizeof(block) / sizeof(block[0])) {
+      size_t pos = g_capture_read % capture_ring_size;
+      uint16_t counts = g_capture_ring[pos];
+      if (!counts) {
+        break;
+      }
+      g_capture_ring[pos] = 0;
+      g_capture_read++;
+      // the timer counts at 48MHz, but flux is kept at the 24MHz
+      // getSampleFrequency() gives, whichever way it was captured
+      uint16_t ticks = counts / g_timing_div;
+      if (ticks) {
+        block[n++] = ticks;
+      }
+    }
+    // the DMAC mustn't have got round to any of these again while they were
+    // being read
+    if ((int32_t)(capture_dma_written() - read) > capture_ring_size) {
+      g_capture_dma.abort();
+      g_capture_dma_running = false;
+      g_capture_overrun = true;
+      return false;
+    }
+    if (!n) {
+      return true;
+    }
+    uint8_t *buf = (uint8_t *)g_flux_pulses;
+    if (g_store_greaseweazle) {
+      uint8_t *end = greasepack_u16(buf + g_n_pulses, buf + g_max_pulses,
+                                    block, n);
+      g_n_pulses = end - buf;
+    } else {
+      uint32_t n_pulses = g_n_pulses;
+      for (size_t i = 0; i < n; i++) {
+        greasepack_capture(buf, g_max_pulses, &n_pulses, block[i], false);
+      }
+      g_n_pulses = n_pulses;
+    }
+  }
+}
+
+/*!
+    @brief  Stop capturing by DMA, moving the last of the flux into
+   g_flux_pulses
+    @return False if the capture stopped early because the ring overflowed
+*/
+bool samd51_dma_capture_stop(void) {
+  if (g_capture_dma_running) {
+    g_capture_dma.abort();
+    samd51_dma_capture_poll();
+    g_capture_dma_running = false;
+  }
+  return !g_capture_overrun;
+}
+
 static bool init_generate_timer(int _wrdatapin, Stream *debug_serial) {
   MCLK->APBBMASK.reg |=
       MCLK_APBBMASK_EVSYS; // Switch on the event system peripheral
@@ -356,7 +487,10 @@ static void enable_generate_timer(void) {
   while (theWriteTimer->COUNT16.SYNCBUSY.bit.CC0)
     ;
   // Set up duration of first pulse when COUNT rolls over
-  theWriteTimer->COUNT16.CCBUF[0].reg = g_flux_pulses[0];
+  uint32_t n = 0;
+  theWriteTimer->COUNT16.CCBUF[0].reg = greaseunpack_write(
+      (uint8_t *)g_flux_pulses, g_max_pulses, &n, g_store_greaseweazle);
+  g_n_pulses = n;
   while (theWriteTimer->COUNT16.SYNCBUSY.bit.CC0)
     ;
   // Set up LOW period of pulses when COUNT rolls over
@@ -0,0 +1,7 @@
+#pragma once
+
+#if defined(__SAMD51__)
+extern bool samd51_dma_capture_start(void);
+extern bool samd51_dma_capture_poll(void);
+extern bool samd51_dma_capture_stop(void);
+#endif
@@ -0,0 +1,403 @@
+// SPDX-FileCopyrightText: 2022 Jeff Epler for Adafruit Industries
+//
+// SPDX-License-Identifier: MIT
+
+// Apple II 5.25" disks in the 16-sector "6-and-2" GCR format used by DOS 3.3
+// and ProDOS. The interface mirrors mfm_impl.h: fill in a gcr_io_t and call
+// encode_track_gcr or decode_track_gcr.
+//
+// On the disk, each bitcell (4us) is a 1 if there is a flux transition in it.
+// The bits are read as 8-bit "nibbles" which always have their top bit set.
+// The disk controller discards zero bits until a 1 arrives, so "self-sync"
+// nibbles, 0xff followed by two 0 bits, bring it into step with the nibbles
+// that follow wherever it started. Data nibbles never have more than two 0
+// bits in a row.
+//
+// A track is a gap of self-sync nibbles, then for each sector:
+//  * The address field prologue d5 aa 96
+//  * The volume, track, sector & checksum, each in two "4-and-4" nibbles
+//  * The epilogue de aa eb, and a gap of self-sync nibbles
+//  * The data field prologue d5 aa ad
+//  * 342 "6-and-2" nibbles of data and a checksum nibble
+//  * The epilogue de aa eb, and a gap of self-sync nibbles
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if !defined(DEBUG_PRINTF)
+#define DEBUG_PRINTF(...) ((void)0)
+#endif
+
+#if !defined(DEBUG_ASSERT)
+#define DEBUG_ASSERT(x) assert(x)
+#endif
+
+/// @cond false
+
+#define GCR_MAYBE_UNUSED __attribute__((unused))
+
+typedef struct gcr_io {
+  bool encode_compact; ///< When writing flux, use compact form (one bit per
+                       ///< bitcell, pos and n_pulses count bits)
+  bool decode_compact; ///< When reading flux, it is in compact form
+  uint16_t T1_nom;     ///< Nominal length of one bitcell in flux units
+  uint16_t T1_max;     ///< Decoder max length of a 1-bitcell pulse
+  uint16_t T2_max;     ///< Decoder max length of a 2-bitcell pulse
+
+  size_t n_valid; ///< Count of valid sectors decoded
+
+  uint8_t *pulses; ///< Encoded track data
+  size_t n_pulses; ///< Total size of encoded track data
+  size_t pos;      ///< Position within encoded track data
+  size_t time;     ///< Total track time in bitcells (set by encoder)
+
+  uint8_t *sectors;         ///< Pointer to decoded data, 256 bytes per sector
+  size_t n_sectors;         ///< Number of sectors on track, at most 16
+  uint8_t *sector_validity; ///< Which sectors decoded successfully
+  const uint8_t *sector_map; ///< For each physical sector, the index of its
+                             ///< data in sectors (e.g., gcr_io_dos_order), or
+                             ///< NULL to store sectors in physical order
+  uint8_t volume;            ///< Volume number written by the encoder
+  uint8_t track;             ///< Track number written by the encoder
+  uint8_t *track_ptr; ///< When decoding, the track number read is stored here
+  uint8_t *volume_ptr; ///< ... and the volume number here
+
+  uint8_t pulse_len; ///< bookkeeping value used by the encoder
+  uint8_t latch;     ///< bookkeeping value used by the decoder
+} gcr_io_t;
+
+enum {
+  gcr_io_sector_size = 256,
+  gcr_io_max_sectors = 16,
+  gcr_io_aux_size = 86, // the nibbles holding the low 2 bits of each byte
+  gcr_io_data_nibbles = gcr_io_aux_size + gcr_io_sector_size,
+};
+
+// Self-sync nibbles before the first sector, between the address and data
+// fields, and after each data field. With 4us bitcells at 300RPM there are
+// about 50000 bitcells per track; 16 sectors with these gaps take 50384.
+enum { gcr_io_gap_1 = 40, gcr_io_gap_2 = 6, gcr_io_gap_3 = 16 };
+
+// How many nibbles after the address field the decoder looks for the data
+// field before giving up
+enum { gcr_io_max_data_search = 48 };
+
+static const uint8_t gcr_io_address_prologue[] = {0xd5, 0xaa, 0x96};
+static const uint8_t gcr_io_data_prologue[] = {0xd5, 0xaa, 0xad};
+static const uint8_t gcr_io_epilogue[] = {0xde, 0xaa, 0xeb};
+
+// Where DOS 3.3 and ProDOS keep the data of each physical sector in their
+// disk images (.dsk/.do and .po)
+static const uint8_t gcr_io_dos_order[gcr_io_max_sectors] = {
+    0, 7, 14, 6, 13, 5, 12, 4, 11, 3, 10, 2, 9, 1, 8, 15};
+static const uint8_t gcr_io_prodos_order[gcr_io_max_sectors] = {
+    0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15};
+
+// The 64 nibbles that 6-bit values are written as
+static const uint8_t gcr_io_encode_62[64] = {
+    0x96, 0x97, 0x9a, 0x9b, 0x9d, 0x9e, 0x9f, 0xa6, 0xa7, 0xab, 0xac,
+    0xad, 0xae, 0xaf, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb9, 0xba,
+    0xbb, 0xbc, 0xbd, 0xbe, 0xbf, 0xcb, 0xcd, 0xce, 0xcf, 0xd3, 0xd6,
+    0xd7, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde, 0xdf, 0xe5, 0xe6, 0xe7,
+    0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef, 0xf2, 0xf3, 0xf4, 0xf5,
+    0xf6, 0xf7, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff,
+};
+
+// Automatically generated: the inverse of gcr_io_encode_62, indexed by nibble
+// - 0x80; 0xff marks nibbles that are not data
+static const uint8_t gcr_io_decode_62[128] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x01,
+    0xff, 0xff, 0x02, 0x03, 0xff, 0x04, 0x05, 0x06, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0x07, 0x08, 0xff, 0xff, 0xff, 0x09, 0x0a, 0x0b, 0x0c, 0x0d,
+    0xff, 0xff, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0xff, 0x14, 0x15, 0x16,
+    0x17, 0x18, 0x19, 0x1a, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0x1b, 0xff, 0x1c, 0x1d, 0x1e, 0xff, 0xff, 0xff, 0x1f,
+    0xff, 0xff, 0x20, 0x21, 0xff, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0x29, 0x2a, 0x2b, 0xff, 0x2c, 0x2d, 0x2e,
+    0x2f, 0x30, 0x31, 0x32, 0xff, 0xff, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38,
+    0xff, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
+};
+
+// The low 2 bits of each byte are stored swapped
+static const uint8_t gcr_io_swap_2[4] = {0, 2, 1, 3};
+
+static inline int gcr_io_eof(gcr_io_t *io) { return io->pos >= io->n_pulses; }
+
+// Count the bitcells up to and including the next one with a flux transition,
+// up to 3: longer runs of 0 bits don't happen in valid data
+static inline unsigned gcr_io_read_cells(gcr_io_t *io, bool compact) {
+  if (compact) {
+    unsigned cells = 0;
+    while (!gcr_io_eof(io)) {
+      size_t p = io->pos++;
+      cells++;
+      if (io->pulses[p / 8] & (0x80 >> (p % 8))) {
+        break;
+      }
+    }
+    return cells > 3 ? 3 : cells ? cells : 1;
+  }
+  if (gcr_io_eof(io)) {
+    return 1;
+  }
+  uint16_t pulse_len = io->pulses[io->pos++];
+  if (pulse_len > io->T2_max)
+    return 3;
+  if (pulse_len > io->T1_max)
+    return 2;
+  return 1;
+}
+
+// Read the next nibble, just as the disk controller does: bits are shifted
+// into the latch until its top bit is set. Returns 0 at the end of the flux.
+static inline uint8_t gcr_io_read_nibble(gcr_io_t *io, bool compact) {
+  while (!gcr_io_eof(io)) {
+    // the latch holds up to 7 bits; add the 0 bits and the 1 bit of a pulse
+    unsigned cells = gcr_io_read_cells(io, compact);
+    unsigned x = (io->latch << cells) | 1;
+    if (x < 0x80) {
+      io->latch = x;
+      continue;
+    }
+    // the nibble was complete at its 8th bit. Any 0 bits of the pulse after
+    // that are discarded, and its 1 bit starts the next nibble.
+    unsigned extra = 0;
+    while ((x >> extra) >= 0x100) {
+      extra++;
+    }
+    io->latch = extra ? 1 : 0;
+    return x >> extra;
+  }
+  return 0;
+}
+
+// Find the 3 nibble prologue, looking at up to `limit` nibbles
+GCR_MAYBE_UNUSED
+static bool gcr_io_find_prologue(gcr_io_t *io, bool compact,
+                                 const uint8_t *prologue, size_t limit) {
+  size_t matched = 0;
+  while (limit-- && !gcr_io_eof(io)) {
+    uint8_t nibble = gcr_io_read_nibble(io, compact);
+    if (nibble == prologue[matched]) {
+      matched++;
+      if (matched == 3) {
+        return true;
+      }
+    } else {
+      matched = nibble == prologue[0];
+    }
+  }
+  return false;
+}
+
+GCR_MAYBE_UNUSED
+static uint8_t gcr_io_read_44(gcr_io_t *io, bool compact) {
+  uint8_t odd = gcr_io_read_nibble(io, compact);
+  uint8_t even = gcr_io_read_nibble(io, compact);
+  return ((odd << 1) | 1) & even;
+}
+
+// Receive the 343 nibbles of a data field into `sector`, returning false if
+// there's an invalid nibble or the checksum is wrong
+GCR_MAYBE_UNUSED
+static bool gcr_io_receive_data(gcr_io_t *io, bool compact, uint8_t *sector) {
+  uint8_t aux[gcr_io_aux_size];
+  uint8_t value = 0;
+  // each nibble is a 6-bit value XORed with the one before it
+  for (size_t i = 0; i <= gcr_io_data_nibbles; i++) {
+    uint8_t nibble = gcr_io_read_nibble(io, compact);
+    uint8_t v = gcr_io_decode_62[nibble & 0x7f];
+    if (!(nibble & 0x80) || v == 0xff) {
+      DEBUG_PRINTF("bad nibble %02x @ %zd\n", nibble, i);
+      return false;
+    }
+    value ^= v;
+    if (i < gcr_io_aux_size) {
+      aux[i] = value;
+    } else if (i < gcr_io_data_nibbles) {
+      sector[i - gcr_io_aux_size] = value << 2;
+    }
+  }
+  if (value != 0) {
+    DEBUG_PRINTF("bad data checksum\n");
+    return false;
+  }
+  for (size_t i = 0; i < gcr_io_sector_size; i++) {
+    unsigned bits = aux[i % gcr_io_aux_size] >> (2 * (i / gcr_io_aux_size));
+    sector[i] |= gcr_io_swap_2[bits & 3];
+  }
+  return true;
+}
+
+// Read a whole track, setting validity[] for each sector actually read, up to
+// n_sectors. Data is stored by physical sector number unless there's a
+// sector_map.
+GCR_MAYBE_UNUSED
+static size_t decode_track_gcr(gcr_io_t *io) {
+  bool compact = io->decode_compact;
+  io->pos = 0;
+  io->latch = 0;
+
+  // count previous valid sectors, so we can early-terminate if we're just
+  // picking up some errored sectors on a 2nd pass
+  io->n_valid = 0;
+  for (size_t i = 0; i < io->n_sectors; i++)
+    if (io->sector_validity[i])
+      io->n_valid += 1;
+
+  while (!gcr_io_eof(io) && io->n_valid < io->n_sectors) {
+    if (!gcr_io_find_prologue(io, compact, gcr_io_address_prologue,
+                              SIZE_MAX)) {
+      continue;
+    }
+    uint8_t volume = gcr_io_read_44(io, compact);
+    uint8_t track = gcr_io_read_44(io, compact);
+    uint8_t sector = gcr_io_read_44(io, compact);
+    uint8_t checksum = gcr_io_read_44(io, compact);
+    DEBUG_PRINTF("address vol=%d track=%d sector=%d checksum=%02x\n", volume,
+                 track, sector, volume ^ track ^ sector ^ checksum);
+    // The epilogue is not checked, as some disks have it wrong on purpose
+    if ((volume ^ track ^ sector ^ checksum) != 0) {
+      continue;
+    }
+    if (sector >= io->n_sectors) {
+      continue;
+    }
+    size_t r = io->sector_map ? io->sector_map[sector] : sector;
+    if (r >= io->n_sectors || io->sector_validity[r]) {
+      continue;
+    }
+
+    if (!gcr_io_find_prologue(io, compact, gcr_io_data_prologue,
+                              gcr_io_max_data_search)) {
+      continue;
+    }
+    if (!gcr_io_receive_data(io, compact,
+                             io->sectors + gcr_io_sector_size * r)) {
+      continue;
+    }
+
+    if (io->track_ptr)
+      *io->track_ptr = track;
+    if (io->volume_ptr)
+      *io->volume_ptr = volume;
+    io->sector_validity[r] = 1;
+    io->n_valid++;
+  }
+  return io->n_valid;
+}
+
+// Write `n` bits, most significant first, as flux
+static inline void gcr_io_put_bits(gcr_io_t *io, bool compact, uint16_t bits,
+                                   int n) {
+  io->time += n;
+  for (int i = n; i-- > 0;) {
+    bool bit = (bits >> i) & 1;
+    if (compact) {
+      if (gcr_io_eof(io)) {
+        return;
+      }
+      size_t p = io->pos++;
+      uint8_t mask = 0x80 >> (p % 8);
+      if (bit) {
+        io->pulses[p / 8] |= mask;
+      } else {
+        io->pulses[p / 8] &= ~mask;
+      }
+    } else if (bit) {
+      if (gcr_io_eof(io)) {
+        return;
+      }
+      io->pulses[io->pos++] = (io->pulse_len + 1) * io->T1_nom;
+      io->pulse_len = 0;
+    } else {
+      io->pulse_len++;
+    }
+  }
+}
+
+static inline void gcr_io_put_nibble(gcr_io_t *io, bool compact,
+                                     uint8_t nibble) {
+  gcr_io_put_bits(io, compact, nibble, 8);
+}
+
+GCR_MAYBE_UNUSED
+static void gcr_io_put_sync(gcr_io_t *io, bool compact, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    gcr_io_put_bits(io, compact, 0xff << 2, 10);
+  }
+}
+
+GCR_MAYBE_UNUSED
+static void gcr_io_put_nibbles(gcr_io_t *io, bool compact,
+                               const uint8_t *nibbles, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    gcr_io_put_nibble(io, compact, nibbles[i]);
+  }
+}
+
+GCR_MAYBE_UNUSED
+static void gcr_io_put_44(gcr_io_t *io, bool compact, uint8_t b) {
+  gcr_io_put_nibble(io, compact, (b >> 1) | 0xaa);
+  gcr_io_put_nibble(io, compact, b | 0xaa);
+}
+
+GCR_MAYBE_UNUSED
+static void gcr_io_put_data(gcr_io_t *io, bool compact, const uint8_t *sector) {
+  uint8_t aux[gcr_io_aux_size] = {0};
+  for (size_t i = 0; i < gcr_io_sector_size; i++) {
+    aux[i % gcr_io_aux_size] |= gcr_io_swap_2[sector[i] & 3]
+                                << (2 * (i / gcr_io_aux_size));
+  }
+  uint8_t last = 0;
+  for (size_t i = 0; i < gcr_io_data_nibbles; i++) {
+    uint8_t v = i < gcr_io_aux_size ? aux[i]
+                                    : sector[i - gcr_io_aux_size] >> 2;
+    gcr_io_put_nibble(io, compact, gcr_io_encode_62[v ^ last]);
+    last = v;
+  }
+  gcr_io_put_nibble(io, compact, gcr_io_encode_62[last]);
+}
+
+// Convert a whole track into flux, up to n_sectors. The rest of the flux is
+// filled with self-sync nibbles. Returns the amount of flux used by the
+// sectors.
+GCR_MAYBE_UNUSED
+static size_t encode_track_gcr(gcr_io_t *io) {
+  bool compact = io->encode_compact;
+  io->pos = 0;
+  io->pulse_len = 0;
+  io->time = 0;
+
+  gcr_io_put_sync(io, compact, gcr_io_gap_1);
+  for (size_t s = 0; s < io->n_sectors; s++) {
+    size_t r = io->sector_map ? io->sector_map[s] : s;
+    gcr_io_put_nibbles(io, compact, gcr_io_address_prologue,
+                       sizeof(gcr_io_address_prologue));
+    gcr_io_put_44(io, compact, io->volume);
+    gcr_io_put_44(io, compact, io->track);
+    gcr_io_put_44(io, compact, s);
+    gcr_io_put_44(io, compact, io->volume ^ io->track ^ s);
+    gcr_io_put_nibbles(io, compact, gcr_io_epilogue, sizeof(gcr_io_epilogue));
+    gcr_io_put_sync(io, compact, gcr_io_gap_2);
+
+    gcr_io_put_nibbles(io, compact, gcr_io_data_prologue,
+                       sizeof(gcr_io_data_prologue));
+    gcr_io_put_data(io, compact, io->sectors + gcr_io_sector_size * r);
+    gcr_io_put_nibbles(io, compact, gcr_io_epilogue, sizeof(gcr_io_epilogue));
+    gcr_io_put_sync(io, compact, gcr_io_gap_3);
+  }
+  size_t result = io->pos;
+  DEBUG_ASSERT(!gcr_io_eof(io));
+
+  while (!gcr_io_eof(io)) {
+    gcr_io_put_sync(io, compact, 1);
+  }
+  return result;
+}
+
+/// @endcond
@@ -1,6 +1,8 @@
 #pragma once
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 // Encoding flux of duration T:
 // 0: Impossible
@@ -54,48 +56,243 @@ static inline uint8_t *greasepack(uint8_t *buf, uint8_t *end, unsigned value) {
   return buf;
 }
 
-static inline unsigned greaseunpack(uint8_t **buf_, uint8_t *end,
-                                    bool store_greaseweazel) {
-#define BUF (*buf_)
-  if (!store_greaseweazel) {
-    if (!BUF || BUF == end) {
-      return 0xffff;
-    }
-    return *BUF++;
-  }
-
+// Read one flux duration from greaseweazle format at *buf, skipping flux ops
+// other than Space. Returns false, leaving *buf at end, if the data ends
+// before a whole value.
+static inline bool greaseunpack_one(uint8_t **buf, uint8_t *end,
+                                    uint32_t *value) {
+  uint8_t *p = *buf;
   while (true) {
     // already no data left
-    if (!BUF || BUF == end) {
-      return 0xffff;
+    if (!p || p == end) {
+      *buf = p;
+      return false;
     }
 
-    size_t left = end - BUF;
-    uint8_t data = *BUF++;
+    size_t left = end - p;
+    uint8_t data = *p++;
     size_t need = data == 255 ? 6 : data >= cutoff_1byte ? 2 : 1;
     if (left < need) {
-      BUF = end;
-      return 0xffff;
+      *buf = end;
+      return false;
     }
 
     if (need == 1) {
-      return data;
+      *value = data;
+      break;
     }
     if (need == 2) {
-      uint8_t data2 = *BUF++;
-      return (data - cutoff_1byte + 1) * 250 + data2;
+      uint8_t data2 = *p++;
+      *value = cutoff_1byte + (data - cutoff_1byte) * 255 + data2 - 1;
+      break;
     }
-    uint8_t data2 = *BUF++;
+    uint8_t data2 = *p++;
     if (data2 != 2) {
-      BUF += 4;
+      p += 4;
       continue;
     } // something other than FluxOp.Space
-    uint32_t value = (*BUF++ & 254) >> 1;
-    value += (*BUF++ & 254) << 6;
-    value += (*BUF++ & 254) << 13;
-    value += (*BUF++ & 254) << 20;
+    uint32_t v = (*p++ & 254) >> 1;
+    v += (*p++ & 254) << 6;
+    v += (*p++ & 254) << 13;
+    v += (*p++ & 254) << 20;
+    *value = v;
+    break;
+  }
+  *buf = p;
+  return true;
+}
+
+// Read one flux duration, either a raw byte or in greaseweazle format.
+// Returns 0xffff when there is no more data.
+static inline unsigned greaseunpack(uint8_t **buf_, uint8_t *end,
+                                    bool store_greaseweazel) {
+  if (!store_greaseweazel) {
+    if (!*buf_ || *buf_ == end) {
+      return 0xffff;
+    }
+    return *(*buf_)++;
+  }
+  uint32_t value;
+  return greaseunpack_one(buf_, end, &value) ? value : 0xffff;
+}
+
+// What the capture and write interrupts do with each flux period, kept here
+// so that every board stores and writes flux the same way.
+
+// Store one captured flux period at offset *n of the `max` byte buffer `buf`,
+// in greaseweazle format or, if store_greaseweazel is false, as one byte
+// clipped to 255.
+static inline void greasepack_capture(uint8_t *buf, uint32_t max, uint32_t *n,
+                                      unsigned ticks, bool store_greaseweazel) {
+  if (*n >= max) {
+    return;
+  }
+  if (store_greaseweazel) {
+    *n = greasepack(buf + *n, buf + max, ticks) - buf;
+  } else {
+    buf[(*n)++] = ticks > 255 ? 255 : ticks;
+  }
+}
+
+// Read the flux period to write next from offset *n of the `max` byte buffer
+// `buf`, moving *n past it, clipped to the 16 bits of a timer. Returns 0, with
+// *n at max, once the flux has run out.
+static inline uint16_t greaseunpack_write(uint8_t *buf, uint32_t max,
+                                          uint32_t *n,
+                                          bool store_greaseweazel) {
+  if (*n >= max) {
+    return 0;
+  }
+  if (!store_greaseweazel) {
+    return buf[(*n)++];
+  }
+  uint8_t *p = buf + *n;
+  uint32_t value;
+  if (!greaseunpack_one(&p, buf + max, &value)) {
+    *n = max;
+    return 0;
+  }
+  *n = p - buf;
+  return value > 0xffff ? 0xffff : value;
+}
+
+// Bulk conversions of whole arrays. Nearly all MFM flux durations fit in one
+// byte, so these look at 4 bytes at a time and copy them straight through
+// when none of them needs more, going one value at a time only around the
+// rest. The results are the same as calling greasepack or greaseunpack for
+// each value.
 
-    return value;
+// True if none of the 4 bytes in `w` is 248 or more. That takes in every byte
+// that is the start of a longer value (250 and up), and is quick to check:
+// a byte is 248 or more if its top 5 bits are all set.
+static inline bool greasepack_all_short(uint32_t w) {
+  uint32_t top = (w & 0xf8f8f8f8) ^ 0xf8f8f8f8; // 0 bytes where all set
+  return !((top - 0x01010101) & ~top & 0x80808080);
+}
+
+// Pack n 8-bit flux durations, like those capture_track stores without
+// greaseweazle format, into greaseweazle format. Returns the new `buf` as
+// greasepack does.
+static inline uint8_t *greasepack_u8(uint8_t *buf, uint8_t *end,
+                                     const uint8_t *values, size_t n) {
+  if (!buf) {
+    return buf;
+  }
+  while (n >= 4 && end - buf > 4) {
+    uint32_t w;
+    memcpy(&w, values, 4);
+    if (greasepack_all_short(w)) {
+      memcpy(buf, values, 4);
+      buf += 4;
+      values += 4;
+      n -= 4;
+    } else {
+      buf = greasepack(buf, end, *values++);
+      n--;
+    }
+  }
+  while (n-- && buf != end) {
+    buf = greasepack(buf, end, *values++);
+  }
+  return buf;
+}
+
+// Pack n 16-bit flux durations into greaseweazle format. Returns the new
+// `buf` as greasepack does.
+static inline uint8_t *greasepack_u16(uint8_t *buf, uint8_t *end,
+                                      const uint16_t *values, size_t n) {
+  if (!buf) {
+    return buf;
+  }
+  while (n >= 4 && end - buf > 4) {
+    // like greasepack_all_short: a value is 248 or more if its high byte is
+    // set, or adding 8 sets it
+    uint64_t w;
+    memcpy(&w, values, 8);
+    if (!((w | (w + 0x0008000800080008ull)) & 0xff00ff00ff00ff00ull)) {
+      buf[0] = values[0];
+      buf[1] = values[1];
+      buf[2] = values[2];
+      buf[3] = values[3];
+      buf += 4;
+      values += 4;
+      n -= 4;
+    } else {
+      buf = greasepack(buf, end, *values++);
+      n--;
+    }
+  }
+  while (n-- && buf != end) {
+    buf = greasepack(buf, end, *values++);
+  }
+  return buf;
+}
+
+// Unpack up to max_values flux durations from greaseweazle format, or raw
+// bytes when store_greaseweazel is false, clipping them to 16 bits. *buf is
+// moved past the data used. Returns the number of values stored.
+static inline size_t greaseunpack_u16(uint16_t *values, size_t max_values,
+                                      uint8_t **buf, uint8_t *end,
+                                      bool store_greaseweazel) {
+  uint8_t *p = *buf;
+  size_t n = 0;
+  if (!p) {
+    return 0;
+  }
+  if (!store_greaseweazel) {
+    n = (size_t)(end - p) < max_values ? (size_t)(end - p) : max_values;
+    for (size_t i = 0; i < n; i++) {
+      values[i] = p[i];
+    }
+    *buf = p + n;
+    return n;
+  }
+  while (n < max_values) {
+    uint32_t w;
+    if (max_values - n >= 4 && end - p >= 4 &&
+        (memcpy(&w, p, 4), greasepack_all_short(w))) {
+      values[n++] = p[0];
+      values[n++] = p[1];
+      values[n++] = p[2];
+      values[n++] = p[3];
+      p += 4;
+      continue;
+    }
+    uint32_t value;
+    if (!greaseunpack_one(&p, end, &value)) {
+      break;
+    }
+    values[n++] = value > 0xffff ? 0xffff : value;
+  }
+  *buf = p;
+  return n;
+}
+
+// Unpack up to max_values flux durations from greaseweazle format into 8-bit
+// values, clipping them to 255 as capture_track does. *buf is moved past the
+// data used. Returns the number of values stored.
+static inline size_t greaseunpack_u8(uint8_t *values, size_t max_values,
+                                     uint8_t **buf, uint8_t *end) {
+  uint8_t *p = *buf;
+  size_t n = 0;
+  if (!p) {
+    return 0;
+  }
+  while (n < max_values) {
+    uint32_t w;
+    if (max_values - n >= 4 && end - p >= 4 &&
+        (memcpy(&w, p, 4), greasepack_all_short(w))) {
+      memcpy(values + n, p, 4);
+      n += 4;
+      p += 4;
+      continue;
+    }
+    uint32_t value;
+    if (!greaseunpack_one(&p, end, &value)) {
+      break;
+    }
+    values[n++] = value > 255 ? 255 : value;
   }
+  *buf = p;
+  return n;
 }
-#undef BUF
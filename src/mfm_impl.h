@@ -21,6 +21,18 @@
 
 #define MFM_MAYBE_UNUSED __attribute__((unused))
 
+// The codec is written once, with the encoding (FM/MFM), the form of the flux
+// (compact/pulses) and the sector size as arguments to functions that are
+// always inlined. Passing constants, as the specialized encoders and decoders
+// below do, lets the compiler drop the branches on them from the inner loops.
+#define MFM_IO_INLINE static inline __attribute__((always_inline))
+
+// Encode flux with lookup tables instead of bit by bit. This is several times
+// faster and costs about 2kB of flash; define as 0 to save the space.
+#if !defined(MFM_IO_TABLE_ENCODE)
+#define MFM_IO_TABLE_ENCODE (1)
+#endif
+
 typedef struct mfm_io mfm_io_t;
 
 MFM_MAYBE_UNUSED
@@ -48,7 +60,10 @@ static const mfm_io_settings_t standard_fm = {
 
 struct mfm_io {
   bool encode_compact; ///< When writing flux, use compact form
-  uint16_t T2_max;     ///< MFM decoder max length of 2us pulse
+  bool decode_compact; ///< When reading flux, it is in compact form (one bit
+                       ///< per bitcell) and pos and n_pulses count bits
+  uint16_t T2_max;     ///< MFM decoder max length of 2us pulse (FM: of a
+                       ///< pulse 2 bitcells long)
   uint16_t T3_max;     ///< MFM decoder max length of 3us pulse
   uint16_t T1_nom;     ///< MFM nominal 1us pulse value
 
@@ -65,11 +80,23 @@ struct mfm_io {
   uint8_t *sector_validity; ///< Which sectors decoded successfully
   uint8_t
       *cylinder_ptr; ///< When decoding, the cylinder number read is stored here
+  size_t *sector_pos; ///< When decoding, the flux position just after each
+                      ///< valid sector's data sync mark is stored here (in
+                      ///< FM, the start of its data address mark)
+  uint8_t *candidates; ///< When decoding, if not NULL, mfm_io_candidates_size
+                       ///< bytes in which the last 3 copies of each sector that
+                       ///< fails its CRC check are kept, to rebuild it from
+                       ///< several revolutions. Zero them with sector_validity
   uint8_t head, cylinder; ///< Location of the track on disk
   uint8_t pulse_len;      ///< bookkeeping value used by MFM decoder
   uint8_t y;              ///< bookkeeping value used by MFM encoder
   uint8_t n; ///< Sector size value. Sector is (128<<n) bytes big. Valid values
              ///< are 0..7
+  uint8_t interleave; ///< When encoding, the spacing of consecutively numbered
+                      ///< sectors around the track. 0 and 1 mean adjacent
+  uint8_t cylinder_skew; ///< When encoding, how many sector places the first
+                         ///< sector moves along by on each cylinder
+  uint8_t head_skew;     ///< ... and on head 1
 
   uint16_t crc; ///< bookkeeping value used by encoder & decoder
   const mfm_io_settings_t *settings; ///< various settings, used by encoder
@@ -109,13 +136,30 @@ static const uint8_t mfm_io_iam_sync_bytes_fm[] = {0xaa, 0xaa, 0xf7, 0x7a};
 
 enum { fm_default_sync_clk = 0xc7 };
 
-static int mfm_io_eof(mfm_io_t *io) { return io->pos >= io->n_pulses; }
+MFM_IO_INLINE int mfm_io_eof(mfm_io_t *io) { return io->pos >= io->n_pulses; }
+
+// Count the bitcells up to and including the next one with a flux transition,
+// and scale by T1_nom so the result compares with T2_max and T3_max just like
+// a captured pulse length
+MFM_IO_INLINE uint16_t mfm_io_read_compact(mfm_io_t *io) {
+  uint16_t cells = 0;
+  while (!mfm_io_eof(io) && cells < 255) {
+    size_t p = io->pos++;
+    cells++;
+    if (io->pulses[p / 8] & (0x80 >> (p % 8))) {
+      break;
+    }
+  }
+  return cells * io->T1_nom;
+}
 
-static mfm_io_symbol_t mfm_io_read_symbol(mfm_io_t *io) {
+MFM_IO_INLINE mfm_io_symbol_t mfm_io_read_symbol_mode(mfm_io_t *io,
+                                                      bool compact) {
   if (mfm_io_eof(io)) {
     return mfm_io_pulse_10;
   }
-  uint8_t pulse_len = io->pulses[io->pos++];
+  uint16_t pulse_len =
+      compact ? mfm_io_read_compact(io) : io->pulses[io->pos++];
   if (pulse_len > io->T3_max)
     return mfm_io_pulse_1000;
   if (pulse_len > io->T2_max)
@@ -123,6 +167,11 @@ static mfm_io_symbol_t mfm_io_read_symbol(mfm_io_t *io) {
   return mfm_io_pulse_10;
 }
 
+MFM_MAYBE_UNUSED
+static mfm_io_symbol_t mfm_io_read_symbol(mfm_io_t *io) {
+  return mfm_io_read_symbol_mode(io, io->decode_compact);
+}
+
 // Automatically generated CRC function
 // polynomial: 0x11021
 static const uint16_t mfm_io_crc16_table[256] = {
@@ -174,10 +223,11 @@ enum {
   mfm_io_triple_mark_mask = 0x0fffffff
 };
 
-static bool skip_triple_sync_mark(mfm_io_t *io) {
+MFM_IO_INLINE bool skip_triple_sync_mark(mfm_io_t *io, bool compact) {
   uint32_t state = 0;
   while (!mfm_io_eof(io) && state != mfm_io_triple_mark_magic) {
-    state = ((state << 2) | mfm_io_read_symbol(io)) & mfm_io_triple_mark_mask;
+    state = ((state << 2) | mfm_io_read_symbol_mode(io, compact)) &
+            mfm_io_triple_mark_mask;
   }
   DEBUG_PRINTF("mark @ %zd ? %d\n", io->pos, state == mfm_io_triple_mark_magic);
   return state == mfm_io_triple_mark_magic;
@@ -186,13 +236,12 @@ static bool skip_triple_sync_mark(mfm_io_t *io) {
 // The MFM crc initialization value, _excluding the three 0xa1 sync bytes_
 enum { mfm_io_crc_preload_value = 0xcdb4 };
 
-// Copy data into a series of buffers, returning the CRC.
-// This must be called right after sync_triple_sync_mark, because an assumption
-// is made about the code that's about to be read.
-//
-// The "..." arguments must be pairs of (uint8_t *buf, size_t n), ending with a
-// NULL buf.
-__attribute__((sentinel)) static uint16_t receive_crc(mfm_io_t *io, ...) {
+// Copy the mark, `n` bytes of data and the CRC that follow into `mark`, `buf`
+// and `crc_buf`, returning the CRC. This must be called right after
+// skip_triple_sync_mark, because an assumption is made about the code that's
+// about to be read.
+MFM_IO_INLINE uint16_t receive_crc(mfm_io_t *io, bool compact, uint8_t *mark,
+                                   uint8_t *buf, size_t n, uint8_t *crc_buf) {
   // `tmp` holds up to 9 bits of data, in bits 6..15.
   unsigned tmp = 0, weight = 0x8000;
   uint16_t crc = mfm_io_crc_preload_value;
@@ -220,7 +269,7 @@ __attribute__((sentinel)) static uint16_t receive_crc(mfm_io_t *io, ...) {
   // final '1' data bit of the MFM sync mark. This means we apply a special rule
   // to the first word, starting as though in the 'mfm_io_even' state but not
   // recording the '1' bit.
-  mfm_io_symbol_t s = mfm_io_read_symbol(io);
+  mfm_io_symbol_t s = mfm_io_read_symbol_mode(io, compact);
   mfm_state_t state = mfm_io_even;
   switch (s) {
   case mfm_io_pulse_100: // first data bit is a 0, and we start in the ODD state
@@ -234,13 +283,15 @@ __attribute__((sentinel)) static uint16_t receive_crc(mfm_io_t *io, ...) {
     break;
   }
 
-  va_list ap;
-  va_start(ap, io);
-  uint8_t *buf;
-  while ((buf = va_arg(ap, uint8_t *)) != NULL) {
-    size_t n = va_arg(ap, size_t);
+  struct {
+    uint8_t *buf;
+    size_t n;
+  } segments[] = {{mark, 1}, {buf, n}, {crc_buf, mfm_io_crc_size}};
+  for (size_t i = 0; i < sizeof(segments) / sizeof(segments[0]); i++) {
+    buf = segments[i].buf;
+    n = segments[i].n;
     while (n) {
-      s = mfm_io_read_symbol(io);
+      s = mfm_io_read_symbol_mode(io, compact);
       PUT_BIT(
           state); // 'mfm_io_even' is 1, so record a '1' or '0' as appropriate
       if (s == mfm_io_pulse_1000) {
@@ -263,15 +314,257 @@ __attribute__((sentinel)) static uint16_t receive_crc(mfm_io_t *io, ...) {
       }
     }
   }
-  va_end(ap);
+#undef PUT_BIT
   return crc;
 }
 
+// FM address marks are written with some clock bits missing, so they can't
+// occur in ordinary data. These are the 16 bitcells of the IDAM and DAM (data
+// 0xfe and 0xfb, clock fm_default_sync_clk) followed by the clock bitcell of
+// the next byte, which is always a flux transition.
+enum {
+  mfm_io_fm_idam_cells = 0x1eafd,
+  mfm_io_fm_dam_cells = 0x1eadf,
+  mfm_io_fm_mark_mask = 0x1ffff,
+  mfm_io_fm_mark_bits = 17,
+  mfm_io_fm_mark_pulses = 13, // the flux transitions in either mark
+};
+
+// In FM, flux transitions are 1 or 2 bitcells apart (3 only in a damaged
+// track). The timings are the same ones MFM uses: T1_nom is one bitcell and
+// T2_max is 2.5 bitcells, so the 1/2 bitcell boundary is T2_max - T1_nom.
+MFM_IO_INLINE unsigned mfm_io_read_fm_cells(mfm_io_t *io, bool compact) {
+  if (mfm_io_eof(io)) {
+    return 1;
+  }
+  uint16_t pulse_len =
+      compact ? mfm_io_read_compact(io) : io->pulses[io->pos++];
+  if (pulse_len > io->T2_max)
+    return 3;
+  if (pulse_len > io->T2_max - io->T1_nom)
+    return 2;
+  return 1;
+}
+
+// Find the next FM IDAM or DAM, returning its mark byte or 0 at the end of the
+// flux. On return, the clock bitcell of the byte after the mark has been read.
+MFM_IO_INLINE uint8_t mfm_io_skip_fm_mark(mfm_io_t *io, bool compact) {
+  uint32_t state = 0;
+  while (!mfm_io_eof(io)) {
+    state = (state << mfm_io_read_fm_cells(io, compact)) | 1;
+    switch (state & mfm_io_fm_mark_mask) {
+    case mfm_io_fm_idam_cells:
+      DEBUG_PRINTF("fm idam @ %zd\n", io->pos);
+      return MFM_IO_IDAM;
+    case mfm_io_fm_dam_cells:
+      DEBUG_PRINTF("fm dam @ %zd\n", io->pos);
+      return MFM_IO_DAM;
+    }
+  }
+  return 0;
+}
+
+// The FM counterpart of receive_crc, called right after mfm_io_skip_fm_mark
+// found `mark`. The CRC covers the mark too, from an initial value of 0xffff.
+MFM_IO_INLINE uint16_t mfm_io_receive_fm_crc(mfm_io_t *io, bool compact,
+                                            uint8_t mark, uint8_t *buf,
+                                            size_t n, uint8_t *crc_buf) {
+  uint16_t crc = mfm_io_crc16(&mark, 1, 0xffff);
+  // bitcells not yet made into bytes are in the low `n_cells` bits of `cells`,
+  // starting with the clock bitcell read by mfm_io_skip_fm_mark
+  uint32_t cells = 1;
+  unsigned n_cells = 1;
+
+  struct {
+    uint8_t *buf;
+    size_t n;
+  } segments[] = {{buf, n}, {crc_buf, mfm_io_crc_size}};
+  for (size_t i = 0; i < sizeof(segments) / sizeof(segments[0]); i++) {
+    buf = segments[i].buf;
+    n = segments[i].n;
+    while (n) {
+      unsigned k = mfm_io_read_fm_cells(io, compact);
+      cells = (cells << k) | 1;
+      n_cells += k;
+      if (n_cells >= 16) {
+        n_cells -= 16;
+        // keep the data bitcells, which alternate with the clock bitcells
+        uint16_t x = (cells >> n_cells) & 0x5555;
+        x = (x | (x >> 1)) & 0x3333;
+        x = (x | (x >> 2)) & 0x0f0f;
+        x = (x | (x >> 4)) & 0x00ff;
+        *buf = x;
+        crc = mfm_io_crc16_table[*buf ^ (uint8_t)(crc >> 8)] ^ (crc << 8);
+        buf++;
+        n--;
+      }
+    }
+  }
+  return crc;
+}
+
+// Find the next address mark, then receive it and the `n` bytes of data and
+// the CRC that follow, returning false if there's no address mark left.
+// `sync_pos` is set to the flux position just after the sync mark; FM has no
+// sync bytes, so there it is the start of the address mark itself.
+MFM_IO_INLINE bool mfm_io_receive_field(mfm_io_t *io, bool fm, bool compact,
+                                        uint8_t *mark, uint8_t *buf, size_t n,
+                                        uint8_t *crc_buf, uint16_t *crc,
+                                        size_t *sync_pos) {
+  if (fm) {
+    *mark = mfm_io_skip_fm_mark(io, compact);
+    if (!*mark) {
+      return false;
+    }
+    *sync_pos = io->pos - (compact ? mfm_io_fm_mark_bits
+                                   : mfm_io_fm_mark_pulses);
+    *crc = mfm_io_receive_fm_crc(io, compact, *mark, buf, n, crc_buf);
+    return true;
+  }
+  if (!skip_triple_sync_mark(io, compact)) {
+    return false;
+  }
+  *sync_pos = io->pos;
+  *crc = receive_crc(io, compact, mark, buf, n, crc_buf);
+  return true;
+}
+
+// Recovering sectors that fail their CRC check from several revolutions.
+//
+// A sector's data field is only accepted with a good CRC, but a marginal
+// sector is often read with a few different bits wrong on each revolution.
+// The copies that fail are kept, and rebuilt into a good one either by a
+// bitwise majority vote of three copies, or, for two copies, by searching the
+// combinations of the bits where they differ for one that makes the CRC good.
+// The search uses the CRC being linear: flipping bits of a field changes its
+// CRC by the CRC of the flipped bits alone, whatever else is in the field.
+//
+// sector_validity says how a sector was read, so that callers can decide how
+// far to trust it. A vote or search that is accepted is wrong only if its
+// CRC is good by chance: about 1 in 65536 for a vote, and for a search about
+// 1 in 65536 for each combination tried, so at most 2^mfm_io_max_search_bits
+// in 65536.
+enum {
+  mfm_io_sector_read = 1,   // read with a good CRC
+  mfm_io_sector_voted = 2,  // rebuilt by a vote of three bad copies
+  mfm_io_sector_search = 3, // rebuilt from two bad copies by a bit search
+};
+
+enum { mfm_io_n_candidates = 3, mfm_io_max_search_bits = 8 };
+
+// The size of io->candidates: for each sector a count of copies kept, and
+// room for mfm_io_n_candidates copies of its data and CRC
+MFM_IO_INLINE size_t mfm_io_candidates_size(size_t n_sectors, uint8_t n) {
+  return n_sectors * (1 + mfm_io_n_candidates * ((128 << n) + mfm_io_crc_size));
+}
+
+// The CRC of an error bit, moved on by one more bit after it
+MFM_IO_INLINE uint16_t mfm_io_crc_shift(uint16_t crc) {
+  return (crc << 1) ^ (crc & 0x8000 ? 0x1021 : 0);
+}
+
+// Flip bits of `a`, `len` bytes of data and CRC whose CRC check gave `crc`,
+// where it differs from `b`, trying each combination until the CRC is good.
+// Returns false, leaving `a` as it was, if none is, or if they differ in too
+// many bits.
+MFM_MAYBE_UNUSED
+static bool mfm_io_search_bits(uint8_t *a, const uint8_t *b, size_t len,
+                               uint16_t crc) {
+  size_t bytes[mfm_io_max_search_bits];
+  uint8_t masks[mfm_io_max_search_bits];
+  uint16_t crcs[mfm_io_max_search_bits];
+  size_t n_bits = 0;
+  // the CRC of a single bit, starting from the last bit of the field
+  uint16_t bit_crc = 0x1021;
+  for (size_t i = len; i-- > 0;) {
+    uint8_t diff = a[i] ^ b[i];
+    for (int bit = 0; bit < 8; bit++, bit_crc = mfm_io_crc_shift(bit_crc)) {
+      if (!(diff & (1 << bit))) {
+        continue;
+      }
+      if (n_bits == mfm_io_max_search_bits) {
+        return false;
+      }
+      bytes[n_bits] = i;
+      masks[n_bits] = 1 << bit;
+      crcs[n_bits] = bit_crc;
+      n_bits++;
+    }
+  }
+  // walk the combinations in Gray code order, one bit changing at each
+  uint16_t flipped_crc = 0;
+  for (uint32_t g = 1; g < (1u << n_bits); g++) {
+    flipped_crc ^= crcs[__builtin_ctz(g)];
+    if (flipped_crc == crc) {
+      uint32_t flips = g ^ (g >> 1);
+      for (size_t j = 0; j < n_bits; j++) {
+        if (flips & (1u << j)) {
+          a[bytes[j]] ^= masks[j];
+        }
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+// Keep the copy of sector r just read into `data` with `crc_buf`, whose CRC
+// check gave `crc`, and try to rebuild the sector from the copies kept. On
+// success the good data is in `data` and the mfm_io_sector_ value saying how
+// it was rebuilt is returned, otherwise 0.
+MFM_MAYBE_UNUSED
+static uint8_t mfm_io_repair_sector(mfm_io_t *io, bool fm, size_t r,
+                                    uint8_t *data, size_t n,
+                                    const uint8_t *crc_buf, uint16_t crc) {
+  size_t len = n + mfm_io_crc_size;
+  uint8_t *count = io->candidates + r;
+  uint8_t *copies =
+      io->candidates + io->n_sectors + r * mfm_io_n_candidates * len;
+  // once full, the oldest copy is replaced
+  uint8_t *copy = copies + *count % mfm_io_n_candidates * len;
+  memcpy(copy, data, n);
+  memcpy(copy + n, crc_buf, mfm_io_crc_size);
+  *count = *count == 2 * mfm_io_n_candidates - 1 ? mfm_io_n_candidates
+                                                 : *count + 1;
+  size_t n_copies =
+      *count < mfm_io_n_candidates ? *count : mfm_io_n_candidates;
+
+  if (n_copies == mfm_io_n_candidates) {
+    const uint8_t *c0 = copies, *c1 = copies + len, *c2 = copies + 2 * len;
+    uint8_t voted[mfm_io_crc_size];
+    for (size_t i = 0; i < len; i++) {
+      uint8_t v = (c0[i] & c1[i]) | (c0[i] & c2[i]) | (c1[i] & c2[i]);
+      if (i < n) {
+        data[i] = v;
+      } else {
+        voted[i - n] = v;
+      }
+    }
+    uint8_t mark = MFM_IO_DAM;
+    uint16_t voted_crc = mfm_io_crc16(
+        &mark, 1, fm ? 0xffff : mfm_io_crc_preload_value);
+    voted_crc = mfm_io_crc16(data, n, voted_crc);
+    if (mfm_io_crc16(voted, mfm_io_crc_size, voted_crc) == 0) {
+      return mfm_io_sector_voted;
+    }
+    memcpy(data, copy, n);
+  }
+
+  for (size_t i = 0; i < n_copies; i++) {
+    const uint8_t *other = copies + i * len;
+    if (other != copy && mfm_io_search_bits(copy, other, len, crc)) {
+      memcpy(data, copy, n);
+      return mfm_io_sector_search;
+    }
+  }
+  return 0;
+}
+
 // Read a whole track, setting validity[] for each sector actually read, up to
 // n_sectors indexing of validity & data is 0-based, mfm_io_even though
 // MFM_IO_IDAMs store sectors as 1-based
-MFM_MAYBE_UNUSED
-static size_t decode_track_mfm(mfm_io_t *io) {
+MFM_IO_INLINE size_t mfm_io_decode_track(mfm_io_t *io, bool fm, bool compact,
+                                         uint8_t n) {
   io->pos = 0;
 
   // count previous valid sectors, so we can early-terminate if we're just
@@ -284,6 +577,8 @@ static size_t decode_track_mfm(mfm_io_t *io) {
   uint8_t mark;
   uint8_t idam_buf[mfm_io_idam_size];
   uint8_t crc_buf[mfm_io_crc_size];
+  uint16_t crc;
+  size_t dam_pos;
 
   // IDAM structure is:
   //  * buf[0]: cylinder
@@ -294,13 +589,11 @@ static size_t decode_track_mfm(mfm_io_t *io) {
   // validated and we are only interested in working with DOS/Windows MFM
   // floppies which always use 512 byte sectors
   while (!mfm_io_eof(io) && io->n_valid < io->n_sectors) {
-    if (!skip_triple_sync_mark(io)) {
+    if (!mfm_io_receive_field(io, fm, compact, &mark, idam_buf,
+                              sizeof(idam_buf), crc_buf, &crc, &dam_pos)) {
       continue;
     }
 
-    uint16_t crc = receive_crc(io, &mark, 1, idam_buf, sizeof(idam_buf),
-                               crc_buf, sizeof(crc_buf), NULL);
-
     DEBUG_PRINTF("mark=%02x [expecting IDAM=%02x]\n", mark, MFM_IO_IDAM);
     DEBUG_PRINTF("idam=%02x %02x %02x %02x\n", idam_buf[0], idam_buf[1],
                  idam_buf[2], idam_buf[3]);
@@ -323,43 +616,162 @@ static size_t decode_track_mfm(mfm_io_t *io) {
       continue;
     }
 
-    if (!skip_triple_sync_mark(io)) {
+    size_t io_block_size = 128 << n;
+    if (!mfm_io_receive_field(io, fm, compact, &mark,
+                              io->sectors + io_block_size * r, io_block_size,
+                              crc_buf, &crc, &dam_pos)) {
       continue;
     }
-    size_t io_block_size = 128 << io->n;
-    crc = receive_crc(io, &mark, 1, io->sectors + io_block_size * r,
-                      io_block_size, crc_buf, sizeof(crc_buf), NULL);
     DEBUG_PRINTF("mark=%02x [expecting DAM=%02x]\n", mark, MFM_IO_DAM);
     DEBUG_PRINTF("crc_buf=%02x %02x\n", crc_buf[0], crc_buf[1]);
     DEBUG_PRINTF("crc=%04x [expecting 0]\n", crc);
     if (mark != MFM_IO_DAM) {
       continue;
     }
+    uint8_t how = mfm_io_sector_read;
     if (crc != 0) {
-      continue;
+      if (!io->candidates) {
+        continue;
+      }
+      how = mfm_io_repair_sector(io, fm, r, io->sectors + io_block_size * r,
+                                 io_block_size, crc_buf, crc);
+      if (!how) {
+        continue;
+      }
     }
 
     if (io->cylinder_ptr)
       *io->cylinder_ptr = idam_buf[0];
-    io->sector_validity[r] = 1;
+    if (io->sector_pos)
+      io->sector_pos[r] = dam_pos;
+    io->sector_validity[r] = how;
     io->n_valid++;
   }
   return io->n_valid;
 }
 
-static void mfm_io_flux_put(mfm_io_t *io, uint8_t len) {
+// Decode FM or MFM flux according to settings. With no settings, the flux is
+// MFM.
+MFM_MAYBE_UNUSED
+static size_t decode_track_mfm(mfm_io_t *io) {
+  bool fm = io->settings && io->settings->is_fm;
+  return mfm_io_decode_track(io, fm, io->decode_compact, io->n);
+}
+
+// Convert the flux positions recorded in sector_pos into times, in flux units,
+// since the start of the flux data. Entries of pos[] that are 0 are skipped.
+// The flux data is walked only once no matter how many sectors are converted.
+MFM_MAYBE_UNUSED
+static void mfm_io_sector_times(mfm_io_t *io, const size_t *pos,
+                                uint32_t *times) {
+  size_t p = 0, done = 0;
+  uint32_t t = 0;
+  while (true) {
+    // find the earliest sector not yet converted
+    size_t best = io->n_sectors;
+    for (size_t i = 0; i < io->n_sectors; i++) {
+      if (pos[i] > done && pos[i] <= io->n_pulses &&
+          (best == io->n_sectors || pos[i] < pos[best])) {
+        best = i;
+      }
+    }
+    if (best == io->n_sectors) {
+      return;
+    }
+    for (; p < pos[best]; p++) {
+      t += io->pulses[p];
+    }
+    times[best] = t;
+    done = pos[best];
+  }
+}
+
+MFM_IO_INLINE void mfm_io_flux_put(mfm_io_t *io, uint8_t len) {
   if (mfm_io_eof(io))
     return;
   io->pulses[io->pos++] = len;
 }
 
-static void mfm_io_flux_byte_compact(mfm_io_t *io, uint8_t b) {
+MFM_IO_INLINE void mfm_io_flux_byte_compact(mfm_io_t *io, uint8_t b) {
   if (mfm_io_eof(io))
     return;
   io->pulses[io->pos++] = b;
 }
 
-static void mfm_io_flux_byte(mfm_io_t *io, uint8_t b) {
+#if MFM_IO_TABLE_ENCODE
+// Automatically generated: the flux transitions in each byte of bitcells. Bits
+// 0-3 are the number of transitions, bits 4-7 the number of bitcells before
+// the first one, then 3 bits for the distance to each following transition.
+static const uint32_t mfm_io_flux_runs[256] = {
+    0x00000000U, 0x00000071U, 0x00000061U, 0x00000162U, 0x00000051U, 0x00000252U,
+    0x00000152U, 0x00000953U, 0x00000041U, 0x00000342U, 0x00000242U, 0x00000A43U,
+    0x00000142U, 0x00001143U, 0x00000943U, 0x00004944U, 0x00000031U, 0x00000432U,
+    0x00000332U, 0x00000B33U, 0x00000232U, 0x00001233U, 0x00000A33U, 0x00004A34U,
+    0x00000132U, 0x00001933U, 0x00001133U, 0x00005134U, 0x00000933U, 0x00008934U,
+    0x00004934U, 0x00024935U, 0x00000021U, 0x00000522U, 0x00000422U, 0x00000C23U,
+    0x00000322U, 0x00001323U, 0x00000B23U, 0x00004B24U, 0x00000222U, 0x00001A23U,
+    0x00001223U, 0x00005224U, 0x00000A23U, 0x00008A24U, 0x00004A24U, 0x00024A25U,
+    0x00000122U, 0x00002123U, 0x00001923U, 0x00005924U, 0x00001123U, 0x00009124U,
+    0x00005124U, 0x00025125U, 0x00000923U, 0x0000C924U, 0x00008924U, 0x00028925U,
+    0x00004924U, 0x00044925U, 0x00024925U, 0x00124926U, 0x00000011U, 0x00000612U,
+    0x00000512U, 0x00000D13U, 0x00000412U, 0x00001413U, 0x00000C13U, 0x00004C14U,
+    0x00000312U, 0x00001B13U, 0x00001313U, 0x00005314U, 0x00000B13U, 0x00008B14U,
+    0x00004B14U, 0x00024B15U, 0x00000212U, 0x00002213U, 0x00001A13U, 0x00005A14U,
+    0x00001213U, 0x00009214U, 0x00005214U, 0x00025215U, 0x00000A13U, 0x0000CA14U,
+    0x00008A14U, 0x00028A15U, 0x00004A14U, 0x00044A15U, 0x00024A15U, 0x00124A16U,
+    0x00000112U, 0x00002913U, 0x00002113U, 0x00006114U, 0x00001913U, 0x00009914U,
+    0x00005914U, 0x00025915U, 0x00001113U, 0x0000D114U, 0x00009114U, 0x00029115U,
+    0x00005114U, 0x00045115U, 0x00025115U, 0x00125116U, 0x00000913U, 0x00010914U,
+    0x0000C914U, 0x0002C915U, 0x00008914U, 0x00048915U, 0x00028915U, 0x00128916U,
+    0x00004914U, 0x00064915U, 0x00044915U, 0x00144916U, 0x00024915U, 0x00224916U,
+    0x00124916U, 0x00924917U, 0x00000001U, 0x00000702U, 0x00000602U, 0x00000E03U,
+    0x00000502U, 0x00001503U, 0x00000D03U, 0x00004D04U, 0x00000402U, 0x00001C03U,
+    0x00001403U, 0x00005404U, 0x00000C03U, 0x00008C04U, 0x00004C04U, 0x00024C05U,
+    0x00000302U, 0x00002303U, 0x00001B03U, 0x00005B04U, 0x00001303U, 0x00009304U,
+    0x00005304U, 0x00025305U, 0x00000B03U, 0x0000CB04U, 0x00008B04U, 0x00028B05U,
+    0x00004B04U, 0x00044B05U, 0x00024B05U, 0x00124B06U, 0x00000202U, 0x00002A03U,
+    0x00002203U, 0x00006204U, 0x00001A03U, 0x00009A04U, 0x00005A04U, 0x00025A05U,
+    0x00001203U, 0x0000D204U, 0x00009204U, 0x00029205U, 0x00005204U, 0x00045205U,
+    0x00025205U, 0x00125206U, 0x00000A03U, 0x00010A04U, 0x0000CA04U, 0x0002CA05U,
+    0x00008A04U, 0x00048A05U, 0x00028A05U, 0x00128A06U, 0x00004A04U, 0x00064A05U,
+    0x00044A05U, 0x00144A06U, 0x00024A05U, 0x00224A06U, 0x00124A06U, 0x00924A07U,
+    0x00000102U, 0x00003103U, 0x00002903U, 0x00006904U, 0x00002103U, 0x0000A104U,
+    0x00006104U, 0x00026105U, 0x00001903U, 0x0000D904U, 0x00009904U, 0x00029905U,
+    0x00005904U, 0x00045905U, 0x00025905U, 0x00125906U, 0x00001103U, 0x00011104U,
+    0x0000D104U, 0x0002D105U, 0x00009104U, 0x00049105U, 0x00029105U, 0x00129106U,
+    0x00005104U, 0x00065105U, 0x00045105U, 0x00145106U, 0x00025105U, 0x00225106U,
+    0x00125106U, 0x00925107U, 0x00000903U, 0x00014904U, 0x00010904U, 0x00030905U,
+    0x0000C904U, 0x0004C905U, 0x0002C905U, 0x0012C906U, 0x00008904U, 0x00068905U,
+    0x00048905U, 0x00148906U, 0x00028905U, 0x00228906U, 0x00128906U, 0x00928907U,
+    0x00004904U, 0x00084905U, 0x00064905U, 0x00164906U, 0x00044905U, 0x00244906U,
+    0x00144906U, 0x00944907U, 0x00024905U, 0x00324906U, 0x00224906U, 0x00A24907U,
+    0x00124906U, 0x01124907U, 0x00924907U, 0x04924908U,
+};
+#endif
+
+MFM_IO_INLINE void mfm_io_flux_byte(mfm_io_t *io, uint8_t b) {
+#if MFM_IO_TABLE_ENCODE
+  uint32_t run = mfm_io_flux_runs[b];
+  size_t n = run & 0xf;
+  if (n == 0) {
+    io->pulse_len += 8;
+    return;
+  }
+  uint8_t len = io->pulse_len + ((run >> 4) & 0xf) + 1;
+  size_t cells = len; // including the ones before this byte
+  run >>= 8;
+  while (true) {
+    mfm_io_flux_put(io, len * io->T1_nom);
+    if (--n == 0) {
+      break;
+    }
+    len = run & 7;
+    run >>= 3;
+    cells += len;
+  }
+  io->time += cells;
+  io->pulse_len = 8 - (cells - io->pulse_len);
+#else
   for (int i = 8; i-- > 0;) {
     if (b & (1 << i)) {
       io->time += io->pulse_len + 1;
@@ -369,26 +781,44 @@ static void mfm_io_flux_byte(mfm_io_t *io, uint8_t b) {
       io->pulse_len += 1;
     }
   }
+#endif
 }
 
-static void mfm_io_encode_raw_fm(mfm_io_t *io, uint8_t b) {
-  if ((b & 0xaa) == 0) {
-    b |= 0xaa;
+MFM_IO_INLINE void mfm_io_put_cells(mfm_io_t *io, bool compact, uint8_t b) {
+  if (compact) {
+    mfm_io_flux_byte_compact(io, b);
+  } else {
+    mfm_io_flux_byte(io, b);
   }
-  io->flux_byte(io, b);
 }
 
-static void mfm_io_encode_raw_mfm(mfm_io_t *io, uint8_t b) {
+MFM_IO_INLINE void mfm_io_encode_raw(mfm_io_t *io, bool fm, bool compact,
+                                    uint8_t b) {
+  if (fm) {
+    if ((b & 0xaa) == 0) {
+      b |= 0xaa;
+    }
+    mfm_io_put_cells(io, compact, b);
+    return;
+  }
   uint16_t y = (io->y << 8) | b;
   if ((b & 0xaa) == 0) {
     // if there are no clocks, synthesize them
     y |= ~((y >> 1) | (y << 1)) & 0xaaaa;
     y &= 0xff;
   }
-  io->flux_byte(io, y);
+  mfm_io_put_cells(io, compact, y);
   io->y = y;
 }
 
+static void mfm_io_encode_raw_fm(mfm_io_t *io, uint8_t b) {
+  mfm_io_encode_raw(io, true, io->encode_compact, b);
+}
+
+static void mfm_io_encode_raw_mfm(mfm_io_t *io, uint8_t b) {
+  mfm_io_encode_raw(io, false, io->encode_compact, b);
+}
+
 static const uint16_t mfm_encode_list[] = {
     // taken from greaseweazle
     0x00,   0x01,   0x04,   0x05,   0x10,   0x11,   0x14,   0x15,   0x40,
@@ -421,7 +851,80 @@ static const uint16_t mfm_encode_list[] = {
     0x5505, 0x5510, 0x5511, 0x5514, 0x5515, 0x5540, 0x5541, 0x5544, 0x5545,
     0x5550, 0x5551, 0x5554, 0x5555};
 
-static void mfm_io_encode_fm_sync(mfm_io_t *io, uint8_t data, uint8_t clock) {
+#if MFM_IO_TABLE_ENCODE
+// Automatically generated: the 16 MFM bitcells of each data byte, clock bits
+// included, as mfm_io_encode_raw_mfm() would produce them from
+// mfm_encode_list. The first 256 entries follow a 0 bitcell, the rest a 1.
+static const uint16_t mfm_io_mfm_cells[512] = {
+    0xAAAAU, 0xAAA9U, 0xAAA4U, 0xAAA5U, 0xAA92U, 0xAA91U, 0xAA94U, 0xAA95U,
+    0xAA4AU, 0xAA49U, 0xAA44U, 0xAA45U, 0xAA52U, 0xAA51U, 0xAA54U, 0xAA55U,
+    0xA92AU, 0xA929U, 0xA924U, 0xA925U, 0xA912U, 0xA911U, 0xA914U, 0xA915U,
+    0xA94AU, 0xA949U, 0xA944U, 0xA945U, 0xA952U, 0xA951U, 0xA954U, 0xA955U,
+    0xA4AAU, 0xA4A9U, 0xA4A4U, 0xA4A5U, 0xA492U, 0xA491U, 0xA494U, 0xA495U,
+    0xA44AU, 0xA449U, 0xA444U, 0xA445U, 0xA452U, 0xA451U, 0xA454U, 0xA455U,
+    0xA52AU, 0xA529U, 0xA524U, 0xA525U, 0xA512U, 0xA511U, 0xA514U, 0xA515U,
+    0xA54AU, 0xA549U, 0xA544U, 0xA545U, 0xA552U, 0xA551U, 0xA554U, 0xA555U,
+    0x92AAU, 0x92A9U, 0x92A4U, 0x92A5U, 0x9292U, 0x9291U, 0x9294U, 0x9295U,
+    0x924AU, 0x9249U, 0x9244U, 0x9245U, 0x9252U, 0x9251U, 0x9254U, 0x9255U,
+    0x912AU, 0x9129U, 0x9124U, 0x9125U, 0x9112U, 0x9111U, 0x9114U, 0x9115U,
+    0x914AU, 0x9149U, 0x9144U, 0x9145U, 0x9152U, 0x9151U, 0x9154U, 0x9155U,
+    0x94AAU, 0x94A9U, 0x94A4U, 0x94A5U, 0x9492U, 0x9491U, 0x9494U, 0x9495U,
+    0x944AU, 0x9449U, 0x9444U, 0x9445U, 0x9452U, 0x9451U, 0x9454U, 0x9455U,
+    0x952AU, 0x9529U, 0x9524U, 0x9525U, 0x9512U, 0x9511U, 0x9514U, 0x9515U,
+    0x954AU, 0x9549U, 0x9544U, 0x9545U, 0x9552U, 0x9551U, 0x9554U, 0x9555U,
+    0x4AAAU, 0x4AA9U, 0x4AA4U, 0x4AA5U, 0x4A92U, 0x4A91U, 0x4A94U, 0x4A95U,
+    0x4A4AU, 0x4A49U, 0x4A44U, 0x4A45U, 0x4A52U, 0x4A51U, 0x4A54U, 0x4A55U,
+    0x492AU, 0x4929U, 0x4924U, 0x4925U, 0x4912U, 0x4911U, 0x4914U, 0x4915U,
+    0x494AU, 0x4949U, 0x4944U, 0x4945U, 0x4952U, 0x4951U, 0x4954U, 0x4955U,
+    0x44AAU, 0x44A9U, 0x44A4U, 0x44A5U, 0x4492U, 0x4491U, 0x4494U, 0x4495U,
+    0x444AU, 0x4449U, 0x4444U, 0x4445U, 0x4452U, 0x4451U, 0x4454U, 0x4455U,
+    0x452AU, 0x4529U, 0x4524U, 0x4525U, 0x4512U, 0x4511U, 0x4514U, 0x4515U,
+    0x454AU, 0x4549U, 0x4544U, 0x4545U, 0x4552U, 0x4551U, 0x4554U, 0x4555U,
+    0x52AAU, 0x52A9U, 0x52A4U, 0x52A5U, 0x5292U, 0x5291U, 0x5294U, 0x5295U,
+    0x524AU, 0x5249U, 0x5244U, 0x5245U, 0x5252U, 0x5251U, 0x5254U, 0x5255U,
+    0x512AU, 0x5129U, 0x5124U, 0x5125U, 0x5112U, 0x5111U, 0x5114U, 0x5115U,
+    0x514AU, 0x5149U, 0x5144U, 0x5145U, 0x5152U, 0x5151U, 0x5154U, 0x5155U,
+    0x54AAU, 0x54A9U, 0x54A4U, 0x54A5U, 0x5492U, 0x5491U, 0x5494U, 0x5495U,
+    0x544AU, 0x5449U, 0x5444U, 0x5445U, 0x5452U, 0x5451U, 0x5454U, 0x5455U,
+    0x552AU, 0x5529U, 0x5524U, 0x5525U, 0x5512U, 0x5511U, 0x5514U, 0x5515U,
+    0x554AU, 0x5549U, 0x5544U, 0x5545U, 0x5552U, 0x5551U, 0x5554U, 0x5555U,
+    0x2AAAU, 0x2AA9U, 0x2AA4U, 0x2AA5U, 0x2A92U, 0x2A91U, 0x2A94U, 0x2A95U,
+    0x2A4AU, 0x2A49U, 0x2A44U, 0x2A45U, 0x2A52U, 0x2A51U, 0x2A54U, 0x2A55U,
+    0x292AU, 0x2929U, 0x2924U, 0x2925U, 0x2912U, 0x2911U, 0x2914U, 0x2915U,
+    0x294AU, 0x2949U, 0x2944U, 0x2945U, 0x2952U, 0x2951U, 0x2954U, 0x2955U,
+    0x24AAU, 0x24A9U, 0x24A4U, 0x24A5U, 0x2492U, 0x2491U, 0x2494U, 0x2495U,
+    0x244AU, 0x2449U, 0x2444U, 0x2445U, 0x2452U, 0x2451U, 0x2454U, 0x2455U,
+    0x252AU, 0x2529U, 0x2524U, 0x2525U, 0x2512U, 0x2511U, 0x2514U, 0x2515U,
+    0x254AU, 0x2549U, 0x2544U, 0x2545U, 0x2552U, 0x2551U, 0x2554U, 0x2555U,
+    0x12AAU, 0x12A9U, 0x12A4U, 0x12A5U, 0x1292U, 0x1291U, 0x1294U, 0x1295U,
+    0x124AU, 0x1249U, 0x1244U, 0x1245U, 0x1252U, 0x1251U, 0x1254U, 0x1255U,
+    0x112AU, 0x1129U, 0x1124U, 0x1125U, 0x1112U, 0x1111U, 0x1114U, 0x1115U,
+    0x114AU, 0x1149U, 0x1144U, 0x1145U, 0x1152U, 0x1151U, 0x1154U, 0x1155U,
+    0x14AAU, 0x14A9U, 0x14A4U, 0x14A5U, 0x1492U, 0x1491U, 0x1494U, 0x1495U,
+    0x144AU, 0x1449U, 0x1444U, 0x1445U, 0x1452U, 0x1451U, 0x1454U, 0x1455U,
+    0x152AU, 0x1529U, 0x1524U, 0x1525U, 0x1512U, 0x1511U, 0x1514U, 0x1515U,
+    0x154AU, 0x1549U, 0x1544U, 0x1545U, 0x1552U, 0x1551U, 0x1554U, 0x1555U,
+    0x4AAAU, 0x4AA9U, 0x4AA4U, 0x4AA5U, 0x4A92U, 0x4A91U, 0x4A94U, 0x4A95U,
+    0x4A4AU, 0x4A49U, 0x4A44U, 0x4A45U, 0x4A52U, 0x4A51U, 0x4A54U, 0x4A55U,
+    0x492AU, 0x4929U, 0x4924U, 0x4925U, 0x4912U, 0x4911U, 0x4914U, 0x4915U,
+    0x494AU, 0x4949U, 0x4944U, 0x4945U, 0x4952U, 0x4951U, 0x4954U, 0x4955U,
+    0x44AAU, 0x44A9U, 0x44A4U, 0x44A5U, 0x4492U, 0x4491U, 0x4494U, 0x4495U,
+    0x444AU, 0x4449U, 0x4444U, 0x4445U, 0x4452U, 0x4451U, 0x4454U, 0x4455U,
+    0x452AU, 0x4529U, 0x4524U, 0x4525U, 0x4512U, 0x4511U, 0x4514U, 0x4515U,
+    0x454AU, 0x4549U, 0x4544U, 0x4545U, 0x4552U, 0x4551U, 0x4554U, 0x4555U,
+    0x52AAU, 0x52A9U, 0x52A4U, 0x52A5U, 0x5292U, 0x5291U, 0x5294U, 0x5295U,
+    0x524AU, 0x5249U, 0x5244U, 0x5245U, 0x5252U, 0x5251U, 0x5254U, 0x5255U,
+    0x512AU, 0x5129U, 0x5124U, 0x5125U, 0x5112U, 0x5111U, 0x5114U, 0x5115U,
+    0x514AU, 0x5149U, 0x5144U, 0x5145U, 0x5152U, 0x5151U, 0x5154U, 0x5155U,
+    0x54AAU, 0x54A9U, 0x54A4U, 0x54A5U, 0x5492U, 0x5491U, 0x5494U, 0x5495U,
+    0x544AU, 0x5449U, 0x5444U, 0x5445U, 0x5452U, 0x5451U, 0x5454U, 0x5455U,
+    0x552AU, 0x5529U, 0x5524U, 0x5525U, 0x5512U, 0x5511U, 0x5514U, 0x5515U,
+    0x554AU, 0x5549U, 0x5544U, 0x5545U, 0x5552U, 0x5551U, 0x5554U, 0x5555U,
+};
+#endif
+
+MFM_IO_INLINE void mfm_io_encode_fm_sync(mfm_io_t *io, bool compact,
+                                        uint8_t data, uint8_t clock) {
   uint16_t encoded = 0;
   // can this be done with two lookups in encoded[] ?
   for (size_t i = 0; i < 8; i++) {
@@ -430,98 +933,115 @@ static void mfm_io_encode_fm_sync(mfm_io_t *io, uint8_t data, uint8_t clock) {
     encoded <<= 1;
     encoded |= (data >> (7 - i)) & 1;
   }
-  io->encode_raw(io, encoded >> 8);
-  io->encode_raw(io, encoded & 0xff);
+  mfm_io_encode_raw(io, true, compact, encoded >> 8);
+  mfm_io_encode_raw(io, true, compact, encoded & 0xff);
 }
 
-static void mfm_io_encode_fm_sync_crc(mfm_io_t *io, uint8_t data,
-                                      uint8_t clock) {
-  mfm_io_encode_fm_sync(io, data, clock);
+MFM_IO_INLINE void mfm_io_encode_fm_sync_crc(mfm_io_t *io, bool compact,
+                                            uint8_t data, uint8_t clock) {
+  mfm_io_encode_fm_sync(io, compact, data, clock);
   io->crc = mfm_io_crc16(&data, 1, io->crc);
 }
 
-static void mfm_io_encode_byte(mfm_io_t *io, uint8_t b) {
+MFM_IO_INLINE void mfm_io_encode_byte(mfm_io_t *io, bool fm, bool compact,
+                                     uint8_t b) {
+#if MFM_IO_TABLE_ENCODE
+  uint16_t cells;
+  if (fm) {
+    cells = mfm_encode_list[b] | 0xaaaa; // every FM clock bit is set
+  } else {
+    cells = mfm_io_mfm_cells[(io->y & 1) << 8 | b];
+    io->y = cells & 0xff;
+  }
+  mfm_io_put_cells(io, compact, cells >> 8);
+  mfm_io_put_cells(io, compact, cells & 0xff);
+#else
   uint16_t encoded = mfm_encode_list[b];
-  io->encode_raw(io, encoded >> 8);
-  io->encode_raw(io, encoded & 0xff);
+  mfm_io_encode_raw(io, fm, compact, encoded >> 8);
+  mfm_io_encode_raw(io, fm, compact, encoded & 0xff);
+#endif
 }
 
-static void mfm_io_encode_raw_buf(mfm_io_t *io, const uint8_t *buf, size_t n) {
+MFM_IO_INLINE void mfm_io_encode_raw_buf(mfm_io_t *io, bool fm, bool compact,
+                                        const uint8_t *buf, size_t n) {
   for (size_t i = 0; i < n; i++) {
-    io->encode_raw(io, buf[i]);
+    mfm_io_encode_raw(io, fm, compact, buf[i]);
   }
 }
 
-static void mfm_io_encode_gap(mfm_io_t *io, size_t n_gap) {
+MFM_IO_INLINE void mfm_io_encode_gap(mfm_io_t *io, bool fm, bool compact,
+                                    size_t n_gap) {
   for (size_t i = 0; i < n_gap; i++) {
-    mfm_io_encode_byte(io, io->settings->gap_byte);
+    mfm_io_encode_byte(io, fm, compact, io->settings->gap_byte);
   }
 }
 
-static void mfm_io_encode_gap_and_presync(mfm_io_t *io, size_t n_gap) {
-  mfm_io_encode_gap(io, n_gap);
+MFM_IO_INLINE void mfm_io_encode_gap_and_presync(mfm_io_t *io, bool fm,
+                                                bool compact, size_t n_gap) {
+  mfm_io_encode_gap(io, fm, compact, n_gap);
   for (size_t i = 0; i < io->settings->gap_presync; i++) {
-    mfm_io_encode_byte(io, 0);
+    mfm_io_encode_byte(io, fm, compact, 0);
   }
 }
 
-static void mfm_io_encode_gap_and_sync(mfm_io_t *io, size_t n_gap) {
-  mfm_io_encode_gap_and_presync(io, n_gap);
-  if (io->settings->is_fm) {
-    mfm_io_encode_raw_buf(io, mfm_io_sync_bytes_fm,
+MFM_IO_INLINE void mfm_io_encode_gap_and_sync(mfm_io_t *io, bool fm,
+                                             bool compact, size_t n_gap) {
+  mfm_io_encode_gap_and_presync(io, fm, compact, n_gap);
+  if (fm) {
+    mfm_io_encode_raw_buf(io, fm, compact, mfm_io_sync_bytes_fm,
                           sizeof(mfm_io_sync_bytes_fm));
   } else {
-    mfm_io_encode_raw_buf(io, mfm_io_sync_bytes_mfm,
+    mfm_io_encode_raw_buf(io, fm, compact, mfm_io_sync_bytes_mfm,
                           sizeof(mfm_io_sync_bytes_mfm));
   }
 }
 
-static void mfm_io_encode_iam(mfm_io_t *io) {
-  mfm_io_encode_gap_and_presync(io, io->settings->gap_4a);
-  if (io->settings->is_fm) {
-    mfm_io_encode_raw_buf(io, mfm_io_iam_sync_bytes_fm,
+MFM_IO_INLINE void mfm_io_encode_iam(mfm_io_t *io, bool fm, bool compact) {
+  mfm_io_encode_gap_and_presync(io, fm, compact, io->settings->gap_4a);
+  if (fm) {
+    mfm_io_encode_raw_buf(io, fm, compact, mfm_io_iam_sync_bytes_fm,
                           sizeof(mfm_io_iam_sync_bytes_fm));
   } else {
-    mfm_io_encode_raw_buf(io, mfm_io_iam_sync_bytes_mfm,
+    mfm_io_encode_raw_buf(io, fm, compact, mfm_io_iam_sync_bytes_mfm,
                           sizeof(mfm_io_iam_sync_bytes_mfm));
   }
-  mfm_io_encode_byte(io, MFM_IO_IAM);
+  mfm_io_encode_byte(io, fm, compact, MFM_IO_IAM);
 }
 
-static void mfm_io_encode_buf(mfm_io_t *io, const uint8_t *buf, size_t n) {
+MFM_IO_INLINE void mfm_io_encode_buf(mfm_io_t *io, bool fm, bool compact,
+                                    const uint8_t *buf, size_t n) {
   for (size_t i = 0; i < n; i++) {
-    mfm_io_encode_byte(io, buf[i]);
+    mfm_io_encode_byte(io, fm, compact, buf[i]);
   }
 }
 
-static void mfm_io_crc_preload(mfm_io_t *io) {
-  if (io->settings->is_fm) {
+MFM_IO_INLINE void mfm_io_crc_preload(mfm_io_t *io, bool fm) {
+  if (fm) {
     io->crc = 0xffff;
   } else {
     io->crc = mfm_io_crc_preload_value;
   }
 }
 
-static void mfm_io_encode_buf_crc(mfm_io_t *io, const uint8_t *buf, size_t n) {
-  mfm_io_encode_buf(io, buf, n);
+MFM_IO_INLINE void mfm_io_encode_buf_crc(mfm_io_t *io, bool fm, bool compact,
+                                        const uint8_t *buf, size_t n) {
+  mfm_io_encode_buf(io, fm, compact, buf, n);
   io->crc = mfm_io_crc16(buf, n, io->crc);
 }
 
-static void mfm_io_encode_byte_crc(mfm_io_t *io, uint8_t b) {
-  mfm_io_encode_buf_crc(io, &b, 1);
+MFM_IO_INLINE void mfm_io_encode_byte_crc(mfm_io_t *io, bool fm, bool compact,
+                                         uint8_t b) {
+  mfm_io_encode_buf_crc(io, fm, compact, &b, 1);
 }
 
-static void mfm_io_encode_crc(mfm_io_t *io) {
+MFM_IO_INLINE void mfm_io_encode_crc(mfm_io_t *io, bool fm, bool compact) {
   unsigned crc = io->crc;
-  mfm_io_encode_byte_crc(io, crc >> 8);
-  mfm_io_encode_byte_crc(io, crc & 0xff);
+  mfm_io_encode_byte_crc(io, fm, compact, crc >> 8);
+  mfm_io_encode_byte_crc(io, fm, compact, crc & 0xff);
   DEBUG_ASSERT(io->crc == 0);
 }
 
-// Convert a whole track into flux, up to n_sectors. indexing of data is
-// 0-based, mfm_io_even though MFM_IO_IDAMs store sectors as 1-based
-MFM_MAYBE_UNUSED
-static size_t encode_track_mfm(mfm_io_t *io) {
+static void mfm_io_encode_start(mfm_io_t *io) {
   io->pos = 0;
   io->pulse_len = 0;
   io->y = 0;
@@ -530,53 +1050,168 @@ static size_t encode_track_mfm(mfm_io_t *io) {
       io->encode_compact ? mfm_io_flux_byte_compact : mfm_io_flux_byte;
   io->encode_raw =
       io->settings->is_fm ? mfm_io_encode_raw_fm : mfm_io_encode_raw_mfm;
+}
 
-  // sector_validity might end up reused for interleave?
-  // memset(io->sector_validity, 0, io->n_sectors);
+MFM_IO_INLINE void mfm_io_encode_dam(mfm_io_t *io, bool fm, bool compact,
+                                    uint8_t n, size_t i) {
+  mfm_io_crc_preload(io, fm);
+  if (fm) {
+    mfm_io_encode_fm_sync_crc(io, compact, MFM_IO_DAM, fm_default_sync_clk);
+  } else {
+    mfm_io_encode_byte_crc(io, fm, compact, MFM_IO_DAM);
+  }
+  size_t io_block_size = 128 << n;
+  mfm_io_encode_buf_crc(io, fm, compact, &io->sectors[io_block_size * i],
+                        io_block_size);
+  mfm_io_encode_crc(io, fm, compact);
+}
+
+// Lay the sectors out around the track: order[p] is the (0-based) sector at
+// place p after the index. With an interleave of k, sector i+1 is k places
+// after sector i, moving on to the next free place when that one is taken. The
+// whole pattern is rotated by the skew of the cylinder and head, so that a
+// controller reading the disk sequentially doesn't just miss the first sector
+// of the next track while it steps or switches heads.
+MFM_MAYBE_UNUSED
+static void mfm_io_sector_order(const mfm_io_t *io, uint8_t *order) {
+  size_t n = io->n_sectors;
+  if (n == 0) {
+    return;
+  }
+  DEBUG_ASSERT(n < 256);
+  size_t step = io->interleave ? io->interleave : 1;
+  size_t place =
+      (io->cylinder * io->cylinder_skew + io->head * io->head_skew) % n;
+  memset(order, 0xff, n);
+  for (size_t i = 0; i < n; i++) {
+    while (order[place] != 0xff) {
+      place = (place + 1) % n;
+    }
+    order[place] = i;
+    place = (place + step) % n;
+  }
+}
+
+// Convert a whole track into flux, up to n_sectors. indexing of data is
+// 0-based, mfm_io_even though MFM_IO_IDAMs store sectors as 1-based
+MFM_IO_INLINE size_t mfm_io_encode_track(mfm_io_t *io, bool fm, bool compact,
+                                        uint8_t n) {
+  mfm_io_encode_start(io);
 
   unsigned char buf[mfm_io_idam_size + 1];
+  uint8_t order[256];
+  mfm_io_sector_order(io, order);
 
-  mfm_io_encode_iam(io);
+  mfm_io_encode_iam(io, fm, compact);
 
-  mfm_io_encode_gap_and_sync(io, io->settings->gap_1);
-  for (size_t i = 0; i < io->n_sectors; i++) {
+  mfm_io_encode_gap_and_sync(io, fm, compact, io->settings->gap_1);
+  for (size_t p = 0; p < io->n_sectors; p++) {
+    size_t i = order[p];
     buf[0] = MFM_IO_IDAM;
     buf[1] = io->cylinder;
     buf[2] = io->head;
     buf[3] = i + 1; // sectors are 1-based
-    buf[4] = io->n;
+    buf[4] = n;
 
-    mfm_io_crc_preload(io);
-    if (io->settings->is_fm) {
-      mfm_io_encode_fm_sync_crc(io, buf[0], fm_default_sync_clk);
-      mfm_io_encode_buf_crc(io, buf + 1, sizeof(buf) - 1);
+    mfm_io_crc_preload(io, fm);
+    if (fm) {
+      mfm_io_encode_fm_sync_crc(io, compact, buf[0], fm_default_sync_clk);
+      mfm_io_encode_buf_crc(io, fm, compact, buf + 1, sizeof(buf) - 1);
     } else {
-      mfm_io_encode_buf_crc(io, buf, sizeof(buf));
+      mfm_io_encode_buf_crc(io, fm, compact, buf, sizeof(buf));
     }
-    mfm_io_encode_crc(io);
+    mfm_io_encode_crc(io, fm, compact);
 
-    mfm_io_encode_gap_and_sync(io, io->settings->gap_2);
-    mfm_io_crc_preload(io);
-    if (io->settings->is_fm) {
-      mfm_io_encode_fm_sync_crc(io, MFM_IO_DAM, fm_default_sync_clk);
-    } else {
-      mfm_io_encode_byte_crc(io, MFM_IO_DAM);
-    }
-    size_t io_block_size = 128 << io->n;
-    mfm_io_encode_buf_crc(io, &io->sectors[io_block_size * i], io_block_size);
-    mfm_io_encode_crc(io);
+    mfm_io_encode_gap_and_sync(io, fm, compact, io->settings->gap_2);
+    mfm_io_encode_dam(io, fm, compact, n, i);
 
-    mfm_io_encode_gap_and_sync(io, io->settings->gap_3[io->n]);
+    mfm_io_encode_gap_and_sync(io, fm, compact, io->settings->gap_3[n]);
   }
   size_t result = io->pos;
   DEBUG_ASSERT(!mfm_io_eof(io));
 
   while (!mfm_io_eof(io)) {
-    mfm_io_encode_byte(io, io->settings->gap_byte);
+    mfm_io_encode_byte(io, fm, compact, io->settings->gap_byte);
   }
   return result;
 }
 
+MFM_MAYBE_UNUSED
+static size_t encode_track_mfm(mfm_io_t *io) {
+  return mfm_io_encode_track(io, io->settings->is_fm, io->encode_compact,
+                             io->n);
+}
+
+// When one sector's data field is rewritten in place, the write begins halfway
+// through gap 2 so that the splice tolerates timing error in either direction,
+// and ends with a few gap bytes so the CRC is completely written before the
+// write gate turns off.
+enum { mfm_io_splice_tail = 4 };
+
+// The number of bitcells between the start of a sector splice and the end of
+// its data sync mark, the point recorded in sector_pos by the decoder
+MFM_MAYBE_UNUSED
+static size_t mfm_io_splice_lead(const mfm_io_t *io) {
+  size_t n_sync = io->settings->is_fm ? sizeof(mfm_io_sync_bytes_fm)
+                                      : sizeof(mfm_io_sync_bytes_mfm);
+  return (io->settings->gap_2 / 2 + io->settings->gap_presync) * 16 +
+         n_sync * 8;
+}
+
+// Convert one sector's data field into flux, to be written in place of the
+// data field already on the disk, leaving the IDAM and all other sectors
+// untouched. Returns the number of flux values generated.
+MFM_IO_INLINE size_t mfm_io_encode_sector(mfm_io_t *io, bool fm, bool compact,
+                                         uint8_t n, size_t sector) {
+  mfm_io_encode_start(io);
+
+  mfm_io_encode_gap_and_sync(io, fm, compact, io->settings->gap_2 / 2);
+  mfm_io_encode_dam(io, fm, compact, n, sector);
+  mfm_io_encode_gap(io, fm, compact, mfm_io_splice_tail);
+
+  return io->pos;
+}
+
+MFM_MAYBE_UNUSED
+static size_t encode_sector_mfm(mfm_io_t *io, size_t sector) {
+  return mfm_io_encode_sector(io, io->settings->is_fm, io->encode_compact,
+                              io->n, sector);
+}
+
+// Specialized codecs for the common formats, named after the generic ones with
+// a suffix, e.g. encode_track_mfm_512(). The settings and sector size in io
+// must match the specialization.
+#define MFM_IO_SPECIALIZE_ENCODER(suffix, FM, COMPACT, N)                      \
+  MFM_MAYBE_UNUSED                                                             \
+  static size_t encode_track_##suffix(mfm_io_t *io) {                          \
+    DEBUG_ASSERT(io->settings->is_fm == (FM) &&                                \
+                 io->encode_compact == (COMPACT) && io->n == (N));             \
+    return mfm_io_encode_track(io, FM, COMPACT, N);                            \
+  }                                                                            \
+  MFM_MAYBE_UNUSED                                                             \
+  static size_t encode_sector_##suffix(mfm_io_t *io, size_t sector) {          \
+    DEBUG_ASSERT(io->settings->is_fm == (FM) &&                                \
+                 io->encode_compact == (COMPACT) && io->n == (N));             \
+    return mfm_io_encode_sector(io, FM, COMPACT, N, sector);                   \
+  }
+
+#define MFM_IO_SPECIALIZE_DECODER(suffix, FM, COMPACT, N)                      \
+  MFM_MAYBE_UNUSED                                                             \
+  static size_t decode_track_##suffix(mfm_io_t *io) {                          \
+    DEBUG_ASSERT((io->settings && io->settings->is_fm) == (FM) &&              \
+                 io->decode_compact == (COMPACT) && io->n == (N));             \
+    return mfm_io_decode_track(io, FM, COMPACT, N);                            \
+  }
+
+MFM_IO_SPECIALIZE_ENCODER(mfm_512, false, false, 2)
+MFM_IO_SPECIALIZE_ENCODER(mfm_compact_512, false, true, 2)
+MFM_IO_SPECIALIZE_ENCODER(fm_128, true, false, 0)
+MFM_IO_SPECIALIZE_ENCODER(fm_compact_128, true, true, 0)
+MFM_IO_SPECIALIZE_DECODER(mfm_512, false, false, 2)
+MFM_IO_SPECIALIZE_DECODER(mfm_compact_512, false, true, 2)
+MFM_IO_SPECIALIZE_DECODER(fm_128, true, false, 0)
+MFM_IO_SPECIALIZE_DECODER(fm_compact_128, true, true, 0)
+
 // Encoding sectors in MFM:
 //  * Each sector is preceded by "gap" bytes with value "gapbyte"
 //  * Then "gap_presync" '\0' bytes
@@ -589,4 +1224,263 @@ static size_t encode_track_mfm(mfm_io_t *io) {
 // ref:
 // https://github.com/keirf/greaseweazle/blob/2484a089d6a50bdbc9fb9a2117ca3968ab3aa2a8/scripts/greaseweazle/codec/ibm/mfm.py
 // https://retrocmp.de/hardware/kryoflux/track-mfm-format.htm
+
+// Amiga "trackdisk" tracks use the same MFM bitcells, but not the IBM layout.
+// The whole track is written at once, with no gaps between sectors. Each
+// sector is:
+//  * Two 0x00 bytes, then two 0x4489 sync words (a1 with a missing clock, as
+//    in the IBM sync mark)
+//  * The info long: 0xff, the track (cylinder * 2 + head), the sector and the
+//    number of sectors until the end of the write
+//  * 16 bytes of "sector label", normally 0
+//  * The header checksum, over the info and label
+//  * The data checksum
+//  * 512 bytes of data
+// Every long or block of longs is split in two: first the odd bits of each
+// long, then the even bits, each sent as 16 data bits with their clocks in a
+// 32-bitcell word. A word's data bits are the ones in 0x55555555, so a long is
+// ((odd_word & 0x55555555) << 1) | (even_word & 0x55555555) and no bit by bit
+// shuffling is needed. The checksums are the XOR of the words of the field,
+// masked with 0x55555555.
+enum {
+  mfm_io_amiga_sector_size = 512,
+  mfm_io_amiga_label_size = 16,
+  mfm_io_amiga_format = 0xff,
+  // The data bytes of one whole sector, from its first 0x00 byte to the end
+  mfm_io_amiga_sector_bytes = 4 + 4 + mfm_io_amiga_label_size + 4 + 4 +
+                              mfm_io_amiga_sector_size,
+  // 0x00 bytes written between the index and the first sector
+  mfm_io_amiga_gap = 64,
+};
+
+// The symbols of the two 0x00 bytes and both sync words, after the first
+// flux transition
+enum {
+  mfm_io_amiga_sync_magic = 0x066499,
+  mfm_io_amiga_sync_mask = 0xffffff,
+};
+
+MFM_IO_INLINE bool mfm_io_skip_amiga_sync(mfm_io_t *io, bool compact) {
+  uint32_t state = 0;
+  while (!mfm_io_eof(io) && state != mfm_io_amiga_sync_magic) {
+    state = ((state << 2) | mfm_io_read_symbol_mode(io, compact)) &
+            mfm_io_amiga_sync_mask;
+  }
+  return state == mfm_io_amiga_sync_magic;
+}
+
+// Bitcells decoded from flux but not yet returned as words. The newest
+// bitcell is in bit 0.
+typedef struct {
+  uint64_t cells;
+  unsigned n;
+} mfm_io_amiga_cells_t;
+
+// Return the data bits of the next 32 bitcells, in place: bits 0, 2, .. 30.
+// Each symbol is some 0 bitcells, then the 1 of its flux transition. The
+// first call after mfm_io_skip_amiga_sync starts right after the sync words.
+MFM_IO_INLINE uint32_t mfm_io_read_amiga_word(mfm_io_t *io, bool compact,
+                                              mfm_io_amiga_cells_t *c) {
+  while (c->n < 32) {
+    unsigned n_cells = 2 + mfm_io_read_symbol_mode(io, compact);
+    c->cells = (c->cells << n_cells) | 1;
+    c->n += n_cells;
+  }
+  c->n -= 32;
+  return (uint32_t)(c->cells >> c->n) & 0x55555555;
+}
+
+// Read an odd word then an even word, returning the long they make and adding
+// both into `sum`
+MFM_IO_INLINE uint32_t mfm_io_read_amiga_long(mfm_io_t *io, bool compact,
+                                              mfm_io_amiga_cells_t *c,
+                                              uint32_t *sum) {
+  uint32_t odd = mfm_io_read_amiga_word(io, compact, c);
+  uint32_t even = mfm_io_read_amiga_word(io, compact, c);
+  *sum ^= odd ^ even;
+  return (odd << 1) | even;
+}
+
+MFM_IO_INLINE uint32_t mfm_io_get_long(const uint8_t *buf) {
+  return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+         ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+MFM_IO_INLINE void mfm_io_set_long(uint8_t *buf, uint32_t v) {
+  buf[0] = v >> 24;
+  buf[1] = v >> 16;
+  buf[2] = v >> 8;
+  buf[3] = v;
+}
+
+// Read a whole Amiga track in one pass, setting validity[] for each sector
+// read, up to n_sectors. The sector numbers on the disk are 0-based.
+// cylinder_ptr gets the track number / 2 and sector_pos the flux position
+// just after the sync words.
+MFM_IO_INLINE size_t mfm_io_decode_amiga(mfm_io_t *io, bool compact) {
+  io->pos = 0;
+
+  io->n_valid = 0;
+  for (size_t i = 0; i < io->n_sectors; i++)
+    if (io->sector_validity[i])
+      io->n_valid += 1;
+
+  while (!mfm_io_eof(io) && io->n_valid < io->n_sectors) {
+    if (!mfm_io_skip_amiga_sync(io, compact)) {
+      break;
+    }
+    size_t sync_pos = io->pos;
+    mfm_io_amiga_cells_t c = {0, 0};
+
+    uint32_t sum = 0, unused = 0;
+    uint32_t info = mfm_io_read_amiga_long(io, compact, &c, &sum);
+    for (size_t i = 0; i < mfm_io_amiga_label_size / 2; i++) {
+      sum ^= mfm_io_read_amiga_word(io, compact, &c);
+    }
+    uint32_t header_sum = mfm_io_read_amiga_long(io, compact, &c, &unused);
+    uint32_t data_sum = mfm_io_read_amiga_long(io, compact, &c, &unused);
+    DEBUG_PRINTF("info=%08x sum=%08x [expecting %08x]\n", info, sum,
+                 header_sum);
+    if (sum != header_sum || (info >> 24) != mfm_io_amiga_format) {
+      continue;
+    }
+
+    size_t r = (info >> 8) & 0xff;
+    if (r >= io->n_sectors || io->sector_validity[r]) {
+      continue;
+    }
+
+    // The odd words are kept in the sector buffer until their even words
+    // arrive
+    uint8_t *data = io->sectors + mfm_io_amiga_sector_size * r;
+    uint32_t words[mfm_io_amiga_sector_size / 4 / 4];
+    const size_t n_words = sizeof(words) / sizeof(words[0]);
+    sum = 0;
+    for (size_t i = 0; i < mfm_io_amiga_sector_size; i += sizeof(words)) {
+      for (size_t j = 0; j < n_words; j++) {
+        words[j] = mfm_io_read_amiga_word(io, compact, &c);
+        sum ^= words[j];
+      }
+      memcpy(data + i, words, sizeof(words));
+    }
+    for (size_t i = 0; i < mfm_io_amiga_sector_size; i += sizeof(words)) {
+      memcpy(words, data + i, sizeof(words));
+      for (size_t j = 0; j < n_words; j++) {
+        uint32_t even = mfm_io_read_amiga_word(io, compact, &c);
+        sum ^= even;
+        mfm_io_set_long(data + i + 4 * j, (words[j] << 1) | even);
+      }
+    }
+    DEBUG_PRINTF("data sum=%08x [expecting %08x]\n", sum, data_sum);
+    if (sum != data_sum) {
+      continue;
+    }
+
+    if (io->cylinder_ptr)
+      *io->cylinder_ptr = (info >> 16 & 0xff) / 2;
+    if (io->sector_pos)
+      io->sector_pos[r] = sync_pos;
+    io->sector_validity[r] = 1;
+    io->n_valid++;
+  }
+  return io->n_valid;
+}
+
+MFM_MAYBE_UNUSED
+static size_t decode_track_amiga(mfm_io_t *io) {
+  return io->decode_compact ? mfm_io_decode_amiga(io, true)
+                            : mfm_io_decode_amiga(io, false);
+}
+
+// Encode a word's 16 data bits, which are in 0x55555555, with their clock bits,
+// all 32 bitcells at once. A clock bit is 1 when the data bits on both sides
+// of it are 0; the one before the first data bit is the last one written.
+MFM_IO_INLINE void mfm_io_encode_amiga_word(mfm_io_t *io, bool compact,
+                                            uint32_t bits) {
+  uint32_t prev = (uint32_t)(io->y & 1) << 31;
+  uint32_t cells = bits | (~((bits << 1) | (bits >> 1) | prev) & 0xaaaaaaaa);
+  mfm_io_put_cells(io, compact, cells >> 24);
+  mfm_io_put_cells(io, compact, cells >> 16);
+  mfm_io_put_cells(io, compact, cells >> 8);
+  mfm_io_put_cells(io, compact, cells);
+  io->y = cells;
+}
+
+// Encode n_longs big-endian longs: the odd bits of them all, then the even
+// bits. Returns their checksum.
+MFM_IO_INLINE uint32_t mfm_io_encode_amiga_block(mfm_io_t *io, bool compact,
+                                                 const uint8_t *buf,
+                                                 size_t n_longs) {
+  uint32_t sum = 0;
+  for (int shift = 1; shift >= 0; shift--) {
+    for (size_t i = 0; i < n_longs; i++) {
+      uint32_t bits = (mfm_io_get_long(buf + 4 * i) >> shift) & 0x55555555;
+      mfm_io_encode_amiga_word(io, compact, bits);
+      sum ^= bits;
+    }
+  }
+  return sum;
+}
+
+// The checksum of a block, without encoding it
+MFM_IO_INLINE uint32_t mfm_io_amiga_checksum(const uint8_t *buf,
+                                             size_t n_longs) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < n_longs; i++) {
+    uint32_t v = mfm_io_get_long(buf + 4 * i);
+    sum ^= v ^ (v >> 1);
+  }
+  return sum & 0x55555555;
+}
+
+// Convert a whole Amiga track into flux. The sectors are written in order
+// from just after the index, and the rest of the flux is filled with 0x00
+// bytes. Returns the position just after the last sector.
+MFM_IO_INLINE size_t mfm_io_encode_amiga(mfm_io_t *io, bool compact) {
+  io->pos = 0;
+  io->pulse_len = 0;
+  io->y = 0;
+  io->time = 0;
+
+  for (size_t i = 0; i < mfm_io_amiga_gap; i++) {
+    mfm_io_encode_byte(io, false, compact, 0);
+  }
+
+  uint8_t header[4 + mfm_io_amiga_label_size] = {0};
+  uint8_t buf[4];
+  for (size_t i = 0; i < io->n_sectors; i++) {
+    const uint8_t *data = io->sectors + mfm_io_amiga_sector_size * i;
+    header[0] = mfm_io_amiga_format;
+    header[1] = io->cylinder * 2 + io->head;
+    header[2] = i;
+    header[3] = io->n_sectors - i;
+
+    mfm_io_encode_byte(io, false, compact, 0);
+    mfm_io_encode_byte(io, false, compact, 0);
+    mfm_io_encode_raw_buf(io, false, compact, mfm_io_sync_bytes_mfm, 4);
+    uint32_t sum = mfm_io_encode_amiga_block(io, compact, header, 1);
+    sum ^= mfm_io_encode_amiga_block(io, compact, header + 4,
+                                     mfm_io_amiga_label_size / 4);
+    mfm_io_set_long(buf, sum);
+    mfm_io_encode_amiga_block(io, compact, buf, 1);
+    mfm_io_set_long(buf,
+                    mfm_io_amiga_checksum(data, mfm_io_amiga_sector_size / 4));
+    mfm_io_encode_amiga_block(io, compact, buf, 1);
+    mfm_io_encode_amiga_block(io, compact, data, mfm_io_amiga_sector_size / 4);
+  }
+  size_t result = io->pos;
+  DEBUG_ASSERT(!mfm_io_eof(io));
+
+  while (!mfm_io_eof(io)) {
+    mfm_io_encode_byte(io, false, compact, 0);
+  }
+  return result;
+}
+
+MFM_MAYBE_UNUSED
+static size_t encode_track_amiga(mfm_io_t *io) {
+  return io->encode_compact ? mfm_io_encode_amiga(io, true)
+                            : mfm_io_encode_amiga(io, false);
+}
+
 /// @endcond
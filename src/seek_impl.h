@@ -0,0 +1,219 @@
+// SPDX-FileCopyrightText: 2022 Jeff Epler for Adafruit Industries
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+// Head stepping as a state machine driven by a microsecond clock, with no
+// pins or delays of its own, so that it can run from a timer interrupt, from
+// a polling loop, or on the host against a fake clock.
+//
+// Call seek_io_start with the target, then call seek_io_poll with the time
+// until it returns seek_io_none, carrying out each action it returns. The
+// next call is due seek_io_wait microseconds later. Positions are in steps
+// and only relative to each other: the caller keeps track of which cylinder
+// the head is on.
+//
+// The times come from a seek_io_profile_t. Each step is a pulse of pulse_us.
+// A head starting from rest takes first_step_us to the second step, then
+// step_us between each later step. Before the first step, and whenever the
+// direction changes, the direction is set dir_us ahead of the step; a step
+// the other way also waits at least reverse_us after the last one. After the
+// last step its whole step time passes, then the settle time for the length
+// of the seek, before the seek is done. Every time is measured from when the
+// previous action was actually carried out, so polling late never makes the
+// steps come faster than the drive allows.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// @cond false
+
+#define SEEK_MAYBE_UNUSED __attribute__((unused))
+
+typedef enum {
+  seek_io_idle,   // no seek in progress
+  seek_io_ready,  // waiting to set the direction or take the next step
+  seek_io_pulse,  // in a step pulse
+  seek_io_settle, // all steps taken, waiting for the head to settle
+} seek_io_state_t;
+
+typedef enum {
+  seek_io_none,          // nothing to do yet
+  seek_io_set_direction, // set the direction pin according to dir_in
+  seek_io_step_start,    // start a step pulse
+  seek_io_step_end,      // end the step pulse
+  seek_io_done,          // the head is at the target and has settled
+} seek_io_action_t;
+
+// The settle times are by the number of steps in the seek: settle_us[i] is
+// used for seeks of at least seek_io_settle_steps[i] steps
+enum { seek_io_n_settle = 4 };
+static const uint8_t seek_io_settle_steps[seek_io_n_settle] = {1, 2, 4, 16};
+
+typedef struct {
+  uint32_t first_step_us; ///< time from the first step from rest to the next
+  uint32_t step_us;       ///< time from the start of one later step to the next
+  uint32_t reverse_us;    ///< least time from a step to one the other way
+  uint32_t settle_us[seek_io_n_settle]; ///< time from the end of the last
+                                        ///< step to reading, by seek length
+} seek_io_profile_t;
+
+// Drive models. 3.5" drives are rated for 3ms steps and 15ms settling, and
+// 5.25" drives for 6ms steps and 15-18ms settling, but a head starting from
+// rest or turning around needs a little longer.
+static const seek_io_profile_t seek_io_profile_35 = {
+    4000, 3000, 6000, {15000, 15000, 15000, 15000},
+};
+
+static const seek_io_profile_t seek_io_profile_525 = {
+    8000, 6000, 12000, {18000, 18000, 18000, 18000},
+};
+
+// The same time for every step and settle
+static inline seek_io_profile_t seek_io_profile_uniform(uint32_t step_us,
+                                                        uint32_t settle_us) {
+  seek_io_profile_t profile = {step_us, step_us, step_us, {0}};
+  for (int i = 0; i < seek_io_n_settle; i++) {
+    profile.settle_us[i] = settle_us;
+  }
+  return profile;
+}
+
+typedef struct {
+  seek_io_profile_t profile; ///< the step and settle times
+  uint32_t pulse_us;         ///< length of each step pulse
+  uint32_t dir_us;           ///< time from setting the direction to a step
+  bool settle;               ///< whether to wait the settle time at the end
+
+  int32_t position; ///< the head position in steps, as stepping goes on
+  int32_t target;   ///< where the head is going
+  bool dir_in;      ///< the direction last set, true towards higher positions
+  bool dir_valid;   ///< whether the direction has been set at all
+
+  seek_io_state_t state;
+  uint32_t n_steps;   ///< steps taken since the seek started
+  uint32_t run;       ///< steps taken since starting from rest or reversing
+  uint32_t last_step; ///< when the last step started
+  uint32_t deadline;  ///< when the next action is due
+} seek_io_t;
+
+// true if the time `now` has reached `t`, allowing for the clock wrapping
+static inline bool seek_io_due(uint32_t now, uint32_t t) {
+  return (int32_t)(now - t) >= 0;
+}
+
+static inline bool seek_io_busy(const seek_io_t *s) {
+  return s->state != seek_io_idle;
+}
+
+static inline uint32_t seek_io_settle_time(const seek_io_profile_t *profile,
+                                           uint32_t n_steps) {
+  int i = seek_io_n_settle - 1;
+  while (i > 0 && n_steps < seek_io_settle_steps[i]) {
+    i--;
+  }
+  return profile->settle_us[i];
+}
+
+// Start seeking to `target`, or change the target of a seek in progress.
+// Seeking to where the head already is does nothing.
+SEEK_MAYBE_UNUSED
+static void seek_io_start(seek_io_t *s, int32_t target, uint32_t now) {
+  s->target = target;
+  if (s->state == seek_io_idle) {
+    if (target == s->position) {
+      return;
+    }
+    s->state = seek_io_ready;
+    s->deadline = now;
+    s->n_steps = 0;
+    s->run = 0;
+  } else if (s->state == seek_io_settle && target != s->position) {
+    // the last step's step time has already passed
+    s->state = seek_io_ready;
+    s->deadline = now;
+  }
+}
+
+// Return the action due at `now`, if any, moving on to the next state
+SEEK_MAYBE_UNUSED
+static seek_io_action_t seek_io_poll(seek_io_t *s, uint32_t now) {
+  if (s->state == seek_io_idle || !seek_io_due(now, s->deadline)) {
+    return seek_io_none;
+  }
+  switch (s->state) {
+  case seek_io_ready:
+    if (s->position == s->target) {
+      s->state = seek_io_settle;
+      s->deadline =
+          now + (s->settle ? seek_io_settle_time(&s->profile, s->n_steps) : 0);
+      return seek_io_poll(s, now);
+    } else {
+      bool in = s->target > s->position;
+      if (!s->dir_valid || in != s->dir_in) {
+        uint32_t wait = s->dir_us;
+        uint32_t since_step = now - s->last_step;
+        if (s->dir_valid && since_step < s->profile.reverse_us &&
+            s->profile.reverse_us - since_step > wait) {
+          wait = s->profile.reverse_us - since_step;
+        }
+        s->dir_in = in;
+        s->dir_valid = true;
+        s->deadline = now + wait;
+        s->run = 0;
+        return seek_io_set_direction;
+      }
+      s->position += in ? 1 : -1;
+      s->n_steps++;
+      s->run++;
+      s->state = seek_io_pulse;
+      s->last_step = now;
+      s->deadline = now + s->pulse_us;
+      return seek_io_step_start;
+    }
+  case seek_io_pulse:
+    s->state = seek_io_ready;
+    s->deadline = s->last_step + (s->run == 1 ? s->profile.first_step_us
+                                              : s->profile.step_us);
+    if (seek_io_due(now, s->deadline)) {
+      s->deadline = now; // late: the next step can't be any sooner
+    }
+    return seek_io_step_end;
+  case seek_io_settle:
+    s->state = seek_io_idle;
+    return seek_io_done;
+  default:
+    return seek_io_none;
+  }
+}
+
+// The time from `now` until the next action is due, 0 if it is due already or
+// there is no seek in progress
+SEEK_MAYBE_UNUSED
+static uint32_t seek_io_wait(const seek_io_t *s, uint32_t now) {
+  if (s->state == seek_io_idle || seek_io_due(now, s->deadline)) {
+    return 0;
+  }
+  return s->deadline - now;
+}
+
+// What to do when a seek ends, from the track 0 sensor and the cylinder the
+// head should be on. A head that arrives in the wrong place is sent to track 0
+// and the seek retried once; if the sensor still disagrees after that, it is
+// stuck or the head can't move, and the seek has failed.
+typedef enum {
+  seek_io_arrived, // the sensor agrees with where the head should be
+  seek_io_reseek,  // find track 0 again and restart the seek
+  seek_io_failed,  // the sensor disagreed again after the reseek
+} seek_io_arrival_t;
+
+static inline seek_io_arrival_t
+seek_io_check_arrival(bool at_track0, int32_t cylinder, bool reseeked) {
+  if (at_track0 == (cylinder == 0)) {
+    return seek_io_arrived;
+  }
+  return reseeked ? seek_io_failed : seek_io_reseek;
+}
+
+/// @endcond